@@ -0,0 +1,92 @@
+/**
+ * @file binaryCodes.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for binaryCodes.cpp, packed binary signatures and a Hamming top-K prefilter
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef BINARYCODES_H
+#define BINARYCODES_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "featureMatrix.h"
+
+// SimHash bits per image unless asked otherwise
+#define BINARY_CODE_BITS 256
+// seed of the SimHash hyperplanes
+#define BINARY_CODE_SEED 20240225
+// first bytes of a code file
+#define BINARY_CODE_MAGIC "CBIRBIN1"
+// longest code read() accepts
+#define BINARY_CODE_MAX_BITS 65536
+
+// How the bits of a signature are set
+enum BinaryCodeKind {
+    BINARY_SIMHASH = 0,     // sign of a random projection: Hamming distance tracks the angle between the features
+    BINARY_THRESHOLD = 1    // one bit per histogram bin, set when the bin is above its mean over the database
+};
+
+/*
+  A compact signature per image next to the float features, packed in
+  64-bit words, row r at code(r). Comparing two signatures is an XOR
+  and a popcount per word: 256 bits are 32 bytes, against 2 KB for a
+  512-d float row, so a Hamming scan of the whole store is a cheap
+  candidate filter. The shortlist is then reranked exactly with the
+  method's metric (rankCandidateRows), the Hamming order itself is only
+  approximate.
+ */
+class BinaryCodes {
+public:
+    BinaryCodes() : kind_(BINARY_SIMHASH), bits_(0), words_(0), cols_(0), rows_(0), fingerprint_(0) {}
+
+    // threshold codes for the histogram intersection methods, SimHash for the others (dnn, SSD methods)
+    static BinaryCodeKind kindForMethod(const std::string& method);
+
+    // signatures of every row; bits is the SimHash length, threshold codes have one bit per column
+    // returns non-zero if data is empty or bits is 0
+    int build(const FeatureMatrix& data, BinaryCodeKind kind, size_t bits = BINARY_CODE_BITS);
+
+    // signature of a target in the original column order, words() words
+    std::vector<uint64_t> encode(const std::vector<float>& values) const;
+
+    // the k rows nearest to code in Hamming distance, (distance, row) nearest first, ties to the lower row
+    std::vector<std::pair<int, int>> hammingTopRows(const std::vector<uint64_t>& code, size_t k) const;
+    // just the rows of hammingTopRows, ready for rankCandidateRows
+    std::vector<int> candidateRows(const std::vector<float>& target, size_t k) const;
+
+    const uint64_t* code(size_t r) const { return &codes_[r * words_]; }
+    size_t rows() const { return rows_; }
+    size_t bits() const { return bits_; }
+    size_t words() const { return words_; }
+    BinaryCodeKind kind() const { return kind_; }
+    // bytes of the packed signatures
+    size_t bytes() const { return codes_.size() * sizeof(uint64_t); }
+
+    /*
+      Code file, little endian:
+        "CBIRBIN1", uint32 kind, uint32 bits, uint32 cols, uint32 rows, uint64 fingerprint of the features
+        float32 mean[cols], SimHash only: float32 planes[bits * cols]
+        uint64 codes[rows * words]
+      read() refuses a file built from other features, a threshold code whose bits are not one per
+      column, and a file whose size does not match its header. Both return non-zero on failure.
+     */
+    int write(const std::string& path) const;
+    int read(const std::string& path, const FeatureMatrix& data);
+
+private:
+    BinaryCodeKind kind_;
+    size_t bits_;
+    size_t words_;
+    size_t cols_;
+    size_t rows_;
+    unsigned long long fingerprint_;
+    std::vector<float> mean_;       // column means, the threshold or the center of the projection
+    std::vector<float> planes_;     // SimHash hyperplanes, bits x cols
+    std::vector<uint64_t> codes_;
+};
+
+#endif
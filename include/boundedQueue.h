@@ -0,0 +1,72 @@
+/**
+ * @file boundedQueue.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief blocking queue with a fixed capacity, connects the stages of a pipeline
+ * @version 0.1
+ * @date 2024-02-21
+*/
+
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/*
+  A producer blocks in push() while the queue is full, which is the
+  backpressure that keeps a fast stage from running ahead of a slow
+  one. A consumer blocks in pop() while the queue is empty. Once
+  close() is called, push() fails and pop() drains what is left and
+  then returns false.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1), closed_(false) {}
+
+    // add an item, waits while the queue is full, returns false if the queue is closed
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // take the oldest item, waits while the queue is empty, returns false once closed and drained
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+
+    // no more items will be pushed, wakes every waiting thread
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    size_t capacity_;
+    bool closed_;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+};
+
+#endif
@@ -10,7 +10,16 @@
 #ifndef CVS_UTIL_H
 #define CVS_UTIL_H
 
+#include <cstdio>
+#include <string>
 #include <vector>
+#include "featureMatrix.h"
+
+// longest image filename a row can hold, the terminating 0 included
+#define CSV_MAX_FILENAME 256
+
+// true if a name can be the first column of a row: shorter than CSV_MAX_FILENAME, no ',', '\n' or '\r'
+bool isCsvFilename(const std::string& name);
 
 /*
   Given a filename, and image filename, and the image features, by
@@ -24,7 +33,17 @@
 
   The function returns a non-zero value in case of an error.
  */
-int append_image_data_csv( char *filename, char *image_filename, std::vector<float> &image_data, int reset_file = 0 );
+int append_image_data_csv( char *filename, char *image_filename, const std::vector<float> &image_data, int reset_file = 0 );
+
+
+/*
+  Writes one line of data to a CSV file that is already open for
+  writing, in the same format as append_image_data_csv. Use it when
+  many rows go to the same file, so the file is opened only once.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_csv_row( FILE *fp, const char *image_filename, const std::vector<float> &image_data );
 
 
 /*
@@ -43,4 +62,50 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
  */
 int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file = 0 );
 
+
+/*
+  The filenames of a feature file held in one buffer instead of one
+  new char[] per row. Name i is the 0-terminated string starting at
+  chars[offsets[i]], so a row is referred to by its index and the
+  names cost a couple of allocations however many rows there are.
+ */
+struct FilenameArena {
+  std::vector<char> chars;
+  std::vector<size_t> offsets;
+
+  size_t size() const { return offsets.size(); }
+  bool empty() const { return offsets.empty(); }
+  const char *name( size_t i ) const { return &chars[offsets[i]]; }
+  // length of name i without the terminator
+  size_t length( size_t i ) const {
+    return ( i + 1 < offsets.size() ? offsets[i+1] : chars.size() ) - offsets[i] - 1;
+  }
+  std::string str( size_t i ) const { return std::string( name(i), length(i) ); }
+  void add( const char *name, size_t length ) {
+    offsets.push_back( chars.size() );
+    chars.insert( chars.end(), name, name + length );
+    chars.push_back( '\0' );
+  }
+  void clear() { chars.clear(); offsets.clear(); }
+};
+
+
+/*
+  Same as above, but the filenames are appended to a FilenameArena,
+  there is nothing to delete[] afterwards.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_data_csv( char *filename, FilenameArena &filenames, std::vector<std::vector<float>> &data, int echo_file = 0 );
+
+
+/*
+  Same as above, but the features go into a FeatureMatrix, every row
+  in one contiguous block. This is the loader the matching code uses.
+  All the rows must have the same number of features.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_data_csv( char *filename, FilenameArena &filenames, FeatureMatrix &data, int echo_file = 0 );
+
 #endif
@@ -0,0 +1,59 @@
+/**
+ * @file extractPipeline.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for extractPipeline.cpp, staged feature extraction of a directory
+ * @version 0.1
+ * @date 2024-02-21
+*/
+
+#ifndef EXTRACTPIPELINE_H
+#define EXTRACTPIPELINE_H
+
+#include <string>
+#include "faceDetect.h"
+#include "imageIO.h"
+
+// default capacity of the queues between the stages
+#define PIPELINE_QUEUE_DEPTH 16
+// default number of threads reading files, more hide the latency of network mounts
+#define PIPELINE_IO_THREADS 2
+
+/*
+  Settings of the extraction pipeline.
+
+  The pipeline runs five stages at the same time, connected by bounded
+  queues of queueDepth items:
+    list    - reads the directory and hands out the image file names, asking
+              the kernel to prefetch each file as it is listed, a queue ahead
+              of the readers (unpack for a tar archive: hands out the members
+              with their bytes)
+    read    - reads whole files into memory (ioThreads), nothing to do for a
+              tar archive
+    decode  - decodes the bytes with cv::imdecode and the decode policy (decodeThreads)
+    extract - runs the method's extractor (extractThreads)
+    write   - appends the rows to the csv file in input order
+  so a cold-cache run goes at the speed of its slowest stage instead
+  of the sum of all stages.
+ */
+struct PipelineOptions {
+    int ioThreads;
+    int decodeThreads;
+    int extractThreads;
+    int queueDepth;
+    DecodePolicy decodePolicy;
+};
+
+// defaults: PIPELINE_IO_THREADS readers, one decoder and one extractor per core, full decode
+PipelineOptions defaultPipelineOptions();
+
+// extract the features of every image of a directory into csvFile, prints the per-stage utilization
+// returns non-zero if the directory cannot be read or the csv file cannot be written
+int runExtractPipeline(const std::string& method, const std::string& directory_of_images, const std::string& csvFile,
+                       const PipelineOptions& options, FaceDetector& faceDetector);
+
+// the same for the image members of a tar archive, "-" reads a tar stream from stdin; the rows are keyed by the
+// member path and nothing is unpacked to disk. Returns non-zero if the archive cannot be read to its end
+int runTarExtractPipeline(const std::string& method, const std::string& archive, const std::string& csvFile,
+                          const PipelineOptions& options, FaceDetector& faceDetector);
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * @file extractScratch.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for extractScratch.cpp, reusable buffers of the feature extractors
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef EXTRACTSCRATCH_H
+#define EXTRACTSCRATCH_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "integralHistogram.h"
+
+// floats reserved for the output feature, more than the longest feature (custom, 4 x (512 + 8))
+#define SCRATCH_OUTPUT_CAPACITY 4096
+
+// The intermediate images an extractor keeps from one image to the next
+enum ScratchMat {
+    SCRATCH_GRAY,               // grayscale copy of the image
+    SCRATCH_QUANTIZED,          // gray levels of the GLCM
+    SCRATCH_SOBEL_X,            // sobelX3x3 output
+    SCRATCH_SOBEL_Y,            // sobelY3x3 output
+    SCRATCH_MAGNITUDE,          // magnitude of the two
+    SCRATCH_RGB_BIN_MAP,        // computeRGBBinMap output
+    SCRATCH_GRADIENT_BIN_MAP,   // computeGradientBinMap output
+    SCRATCH_GLCM,               // co-occurrence matrix
+    SCRATCH_FILTER_RESPONSE,    // Gabor filter response
+    SCRATCH_MAT_COUNT
+};
+
+// Float rows kept from one image to the next
+enum ScratchRows {
+    SCRATCH_LAWS_ROWS,          // horizontal Laws passes of the rows around the current one
+    SCRATCH_ROW_COUNT
+};
+
+/*
+  Scratch context of one extraction worker: the gray images, Sobel
+  outputs, bin maps, integral histograms, GLCM and filter responses of the extractors, and the output feature itself. Every buffer keeps its
+  memory and only grows when an image needs more than it holds; smaller
+  images, or the same pixels in another orientation, use a prefix of it.
+  Once the largest image of a catalog has been seen, extracting any
+  image does no heap allocation (for the methods of
+  extractsWithoutAllocation()).
+
+  Not thread-safe: every thread extracting features owns its own scratch.
+  The output returned by extractFeatureByMethod(..., scratch) stays
+  valid until the next extraction with the same scratch.
+ */
+class ExtractScratch {
+public:
+    // outputCapacity floats of the output are reserved, 0 for a scratch used once
+    explicit ExtractScratch(size_t outputCapacity = SCRATCH_OUTPUT_CAPACITY);
+
+    // the slot's image with the given size and type, a header over the start of the slot's buffer,
+    // which is only reallocated when the image needs more bytes than any image before it.
+    // create() on the returned image with the same size and type keeps it in the buffer
+    cv::Mat& mat(ScratchMat slot, int rows, int cols, int type);
+
+    // n floats of a row buffer, contents undefined
+    float* rows(ScratchRows slot, size_t n);
+
+    // integral histograms of the RGB and gradient bin maps, rebuilt in place
+    IntegralHistogram& rgbIntegral() { return rgbIntegral_; }
+    IntegralHistogram& gradientIntegral() { return gradientIntegral_; }
+
+    // the output feature, SCRATCH_OUTPUT_CAPACITY floats are reserved up front
+    std::vector<float>& output() { return output_; }
+
+    // constant filter kernels, filled by the extractor on first use (the Gabor bank)
+    std::vector<cv::Mat>& kernels() { return kernels_; }
+
+    // memory held by the scratch
+    size_t bytes() const;
+
+private:
+    ExtractScratch(const ExtractScratch&);
+    ExtractScratch& operator=(const ExtractScratch&);
+
+    cv::Mat buffers_[SCRATCH_MAT_COUNT];    // one row of bytes per slot, grown only
+    cv::Mat views_[SCRATCH_MAT_COUNT];      // the current image of each slot, inside its buffer
+    std::vector<float> rows_[SCRATCH_ROW_COUNT];
+    IntegralHistogram rgbIntegral_;
+    IntegralHistogram gradientIntegral_;
+    std::vector<float> output_;
+    std::vector<cv::Mat> kernels_;
+};
+
+#endif
@@ -11,10 +11,79 @@
 
 #include <iostream>
 #include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
 #include <opencv2/opencv.hpp>
 
-// put the path to the haar cascade file here
+// put the path to the haar cascade file here, or override it at build time
+#ifndef FACE_CASCADE_FILE
 #define FACE_CASCADE_FILE "/Users/jeff/Desktop/Project2_YZ/bin/haarcascade_frontalface_alt2.xml"
+#endif
+
+// default detectMultiScale parameters
+#define FACE_SCALE_FACTOR 1.1
+#define FACE_MIN_NEIGHBORS 3
+#define FACE_MIN_SIZE 0
+
+/*
+  Haar cascade face detector that can be shared between threads.
+
+  Every thread that calls detect() borrows a worker from a pool. A
+  worker owns its own cv::CascadeClassifier and the scratch images
+  used for resizing and equalizing, so concurrent calls never share
+  state and steady-state calls reuse the same buffers. Workers are
+  created on demand, so the pool grows to the number of threads that
+  detect at the same time.
+
+  scaleFactor and minSize bound the per-image detection cost: a larger
+  scale factor tries fewer scales and a larger minimum size (in pixels
+  of the full image) skips the smallest windows.
+ */
+class FaceDetector {
+public:
+    explicit FaceDetector(const std::string& cascadeFile = FACE_CASCADE_FILE,
+                          double scaleFactor = FACE_SCALE_FACTOR,
+                          int minNeighbors = FACE_MIN_NEIGHBORS,
+                          int minSize = FACE_MIN_SIZE);
+
+    // load the cascade once up front, returns non-zero if the file cannot be loaded
+    int load();
+
+    // detect faces in a greyscale image, returns non-zero if the cascade cannot be loaded
+    int detect(const cv::Mat& grey, std::vector<cv::Rect>& faces);
+
+    const std::string& cascadeFile() const { return cascadeFile_; }
+    double scaleFactor() const { return scaleFactor_; }
+    int minNeighbors() const { return minNeighbors_; }
+    int minSize() const { return minSize_; }
+    // number of workers created so far
+    size_t poolSize();
+
+private:
+    struct Worker {
+        cv::CascadeClassifier cascade;
+        cv::Mat half;
+        cv::Mat equalized;
+    };
+
+    // borrow an idle worker, or create and load a new one, nullptr if loading fails
+    Worker* acquire();
+    // give a worker back to the pool
+    void release(Worker* worker);
+
+    std::string cascadeFile_;
+    double scaleFactor_;
+    int minNeighbors_;
+    int minSize_;
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<Worker*> idle_;
+};
+
+// process-wide detector on FACE_CASCADE_FILE, used by the functions below
+FaceDetector& defaultFaceDetector();
 
 // prototypes
 int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces );
@@ -23,5 +92,7 @@ int drawBoxes( cv::Mat &frame, std::vector<cv::Rect> &faces, int minWidth = 50,
 // EXTENSION: face detection and feature extraction
 // Define a function to extract face features
 std::vector<float> extractFaceFeatures(cv::Mat& img);
+// Extract face features with a given detector, safe to call from several threads
+std::vector<float> extractFaceFeatures(const cv::Mat& img, FaceDetector& detector);
 
 #endif
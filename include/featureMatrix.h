@@ -0,0 +1,114 @@
+/**
+ * @file featureMatrix.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for featureMatrix.cpp, feature database stored as one contiguous row-major block
+ * @version 0.1
+ * @date 2024-02-24
+*/
+
+#ifndef FEATUREMATRIX_H
+#define FEATUREMATRIX_H
+
+#include <cstddef>
+#include <vector>
+
+// row starts are aligned to a cache line
+#define FEATURE_MATRIX_ALIGN 64
+// alignment of the block when huge pages are asked for
+#define FEATURE_MATRIX_HUGE_PAGE (2 * 1024 * 1024)
+
+/*
+  The feature rows of a database in one allocation instead of one heap
+  block per row. Every row starts on a 64-byte boundary: the stride is
+  the row length rounded up to 16 floats, and the padding is kept at
+  zero so kernels may run over it (zeros add nothing to SSD,
+  intersection or dot products). A scan over the rows is then a linear
+  walk through memory that the prefetcher can follow.
+
+  With setHugePages(true) before the first row, the block is aligned to
+  2 MB and, on Linux, transparent huge pages are requested for it to
+  cut TLB misses on large databases.
+
+  All rows have the length of the first one, appendRow() refuses others.
+
+  orderColumnsByVariance() stores the columns of every row with the
+  highest variance first, for scans that stop a sum early (SSD). Rows
+  and targets go in and out in the original order (appendRow,
+  rowVector, toColumnOrder); only row() exposes the stored order, which
+  is fine for metrics that do not depend on the order of the values.
+ */
+class FeatureMatrix {
+public:
+    FeatureMatrix();
+    ~FeatureMatrix();
+    FeatureMatrix(FeatureMatrix&& other) noexcept;
+    FeatureMatrix& operator=(FeatureMatrix&& other) noexcept;
+
+    // use huge pages for the next allocation
+    void setHugePages(bool enable) { hugePages_ = enable; }
+
+    // room for rows of cols values, returns non-zero if the memory cannot be had
+    int reserve(size_t rows, size_t cols);
+
+    // copy one row to the end, returns non-zero if its length differs from the other rows
+    int appendRow(const float* values, size_t count);
+    int appendRow(const std::vector<float>& values) { return appendRow(values.data(), values.size()); }
+
+    void clear();
+
+    size_t rows() const { return rows_; }
+    size_t cols() const { return cols_; }
+    // floats between the starts of two rows
+    size_t stride() const { return stride_; }
+    bool empty() const { return rows_ == 0; }
+
+    float* row(size_t r) { return data_ + r * stride_; }
+    const float* row(size_t r) const { return data_ + r * stride_; }
+
+    // copy of a row in the original column order, for code that still takes std::vector
+    std::vector<float> rowVector(size_t r) const;
+
+    // bytes held by the block
+    size_t bytes() const { return capacity_ * stride_ * sizeof(float); }
+    // FNV-1a hash of the stored values, padding left out; index files keep it to detect a changed CSV
+    unsigned long long fingerprint() const;
+
+    // scale every row to unit length (all-zero rows stay zero), so cosine similarity is a dot product
+    void normalizeRows();
+    // true after normalizeRows() until a row is appended
+    bool unitRows() const { return unitRows_; }
+
+    // store the columns in decreasing order of their variance over the rows
+    void orderColumnsByVariance();
+    // stored position i holds original column columnOrder()[i], empty while in the original order
+    const std::vector<int>& columnOrder() const { return columnOrder_; }
+    // a target in the stored column order, ready to compare with row()
+    std::vector<float> toColumnOrder(const std::vector<float>& values) const;
+
+private:
+    FeatureMatrix(const FeatureMatrix&);
+    FeatureMatrix& operator=(const FeatureMatrix&);
+
+    int grow(size_t rows);
+
+    float* data_;
+    size_t rows_;
+    size_t cols_;
+    size_t stride_;
+    size_t capacity_;
+    bool hugePages_;
+    bool unitRows_;
+    std::vector<int> columnOrder_;
+};
+
+// stride in floats for rows of cols values
+size_t featureMatrixStride(size_t cols);
+
+/*
+  scores[r] = dot(row r, query) for every row, query has cols() values.
+  Four rows are streamed together so each query value loaded is used
+  four times, the scan is one pass over the block like a GEMV.
+ */
+void matrixVectorDot(const FeatureMatrix& matrix, const float* query, float* scores);
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * @file featureMethods.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for featureMethods.cpp, one place that maps a method name to its extractor and metric
+ * @version 0.1
+ * @date 2024-02-20
+*/
+
+#ifndef FEATUREMETHODS_H
+#define FEATUREMETHODS_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "faceDetect.h"
+#include "extractScratch.h"
+
+// all the methods accepted by extractFeature, in menu order
+const std::vector<std::string>& featureMethodNames();
+
+// true if the method is one of featureMethodNames()
+bool isFeatureMethod(const std::string& method);
+
+// name used in the feature file, image_features_<name>.csv
+std::string methodCsvName(const std::string& method);
+
+// extract the feature vector of an image with the method
+// the face method uses the given detector, or the default detector if none is given
+std::vector<float> extractFeatureByMethod(const std::string& method, const cv::Mat& image, FaceDetector* faceDetector = nullptr);
+
+// the same with the buffers of a scratch, one per extracting thread; the result is the scratch's output,
+// valid until its next extraction. Once the scratch has seen an image of the size, the methods of
+// extractsWithoutAllocation() do no heap allocation
+const std::vector<float>& extractFeatureByMethod(const std::string& method, const cv::Mat& image, FaceDetector* faceDetector,
+                                                 ExtractScratch& scratch);
+
+// true if the method's extraction with a warm scratch does no heap allocation
+bool extractsWithoutAllocation(const std::string& method);
+
+// score a target feature vector against a database row with the method's metric
+// besides the extractor methods, "dnn" scores precomputed embeddings with cosine similarity
+float scoreByMethod(const std::string& method, const std::vector<float>& target, const std::vector<float>& row);
+
+// the method's metric on raw rows of n values, looked up once per scan instead of once per row
+typedef float (*FeatureMetric)(const float* target, const float* row, size_t n);
+FeatureMetric metricForMethod(const std::string& method);
+
+// true if the method's metric sums over the values (SSD), so the scan may stop early against a top-K bound
+bool isSSDMethod(const std::string& method);
+
+// true if the metric does not depend on the order of the values (all but the split histograms of m and tc)
+bool metricIgnoresColumnOrder(const std::string& method);
+
+// true if a higher score means more similar (histogram intersection), false for distances (SSD)
+bool isSimilarityMethod(const std::string& method);
+
+// true if the method has a metric, i.e. can be used by matching (dnn included)
+bool isMatchingMethod(const std::string& method);
+
+#endif
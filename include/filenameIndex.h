@@ -0,0 +1,46 @@
+/**
+ * @file filenameIndex.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for filenameIndex.cpp, filename to row lookup for a loaded feature file
+ * @version 0.1
+ * @date 2024-02-24
+*/
+
+#ifndef FILENAMEINDEX_H
+#define FILENAMEINDEX_H
+
+#include <string>
+#include <vector>
+#include "csv_util.h"
+
+/*
+  Hash table from filename to row, built once after the feature file is
+  loaded so a target is found in O(1) instead of a scan over every row.
+  The table only holds row numbers, open addressing with linear probing,
+  and compares against the names in the FilenameArena, so the names are
+  not copied. The arena must outlive the index.
+  If a name appears more than once the first row wins, like the scan.
+ */
+class FilenameIndex {
+public:
+    FilenameIndex() : names_(nullptr), mask_(0) {}
+
+    // index the filenames returned by read_image_data_csv
+    void build(const FilenameArena& filenames);
+
+    // row of the name, -1 if it is not in the file
+    int find(const char* name, size_t length) const;
+    int find(const std::string& name) const { return find(name.data(), name.size()); }
+
+    // rows of a batch of names, -1 for the ones not in the file
+    std::vector<int> findAll(const std::vector<std::string>& names) const;
+
+    size_t size() const { return names_ ? names_->size() : 0; }
+
+private:
+    const FilenameArena* names_;
+    std::vector<int> slots_;    // row of each slot, -1 if empty
+    size_t mask_;               // slots_.size() - 1, the size is a power of two
+};
+
+#endif
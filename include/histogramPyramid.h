@@ -0,0 +1,90 @@
+/**
+ * @file histogramPyramid.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for histogramPyramid.cpp, coarse-to-fine exact top-K for histogram intersection
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef HISTOGRAMPYRAMID_H
+#define HISTOGRAMPYRAMID_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "featureMatrix.h"
+
+// coarse levels kept per histogram: 8x8x8 bins merged to 4x4x4, then 2x2x2
+#define PYRAMID_LEVELS 2
+// first bytes of a pyramid file
+#define PYRAMID_MAGIC "CBIRPYR1"
+// bytes of the method name in a pyramid file
+#define PYRAMID_METHOD_BYTES 16
+
+/*
+  Coarse copies of the histograms of a database, for an exact top-K
+  intersection scan that skips most of the fine bins.
+
+  Merging bins can only raise an intersection: min(a1 + a2, b1 + b2) is
+  at least min(a1, b1) + min(a2, b2). So the intersection of two coarse
+  histograms is an upper bound on the intersection of the fine ones.
+  The scan scores every row on the coarsest level (8 bins per RGB cube),
+  visits the rows from the highest bound down, checks the next level,
+  and only computes the fine intersection of rows whose bound can still
+  beat the K-th best found so far. It stops at the first row whose
+  coarsest bound cannot. The result is the same as rankTopRows.
+
+  Each level is summed from the level below it (the fine bins for the
+  first), so building reads the fine bins once. The levels are saved
+  next to the CSV (matching --pyramid) so a query only reads them.
+
+  Layouts, from featureMethods / matchings:
+    h3        one 8x8x8 RGB cube
+    m         two cubes (top and bottom), the score is the mean of the two intersections
+    custom_*  four scales of a cube followed by 8 gradient magnitude bins
+ */
+class HistogramPyramid {
+public:
+    HistogramPyramid() : scale_(1.0f), cols_(0), rows_(0), fingerprint_(0) {}
+
+    // true for the methods whose layout is known (h3, m, custom_s, custom_m, custom_l)
+    static bool supports(const std::string& method);
+
+    // sum the fine bins of every row into the first coarse level, and every level into the next
+    // returns non-zero if the method is not supported or the rows do not have its layout
+    int build(const std::string& method, const FeatureMatrix& data);
+
+    /*
+      Pyramid file, little endian:
+        "CBIRPYR1", char method[16], uint32 levels, uint32 cols, uint32 rows, uint64 fingerprint of the features
+        per level: uint32 bins, float32 rows[rows * bins]
+      read() refuses a file built from other features or for another method.
+      Both return non-zero on failure.
+     */
+    int write(const std::string& path) const;
+    int read(const std::string& path, const std::string& method, const FeatureMatrix& data);
+
+    // the k best rows of data (the matrix given to build), best match first
+    std::vector<std::pair<float, int>> topRows(const std::vector<float>& target, const FeatureMatrix& data, size_t k) const;
+
+    bool empty() const { return levels_.empty(); }
+    // bytes of the coarse levels
+    size_t bytes() const;
+
+private:
+    // the bin groups of every level for the method, returns non-zero if the rows do not have its layout
+    int layout(const std::string& method, size_t cols);
+    // sum the bins of the level below into the level's bins
+    void coarsen(const float* finer, size_t level, float* coarse) const;
+
+    std::string method_;
+    float scale_;                              // 0.5 for m, the mean of two intersections
+    size_t cols_;                              // fine bins of a row
+    size_t rows_;
+    unsigned long long fingerprint_;           // of the features the levels were built from
+    std::vector<std::vector<int>> groups_;     // per level, the coarse bin of each bin of the level below
+    std::vector<size_t> levelBins_;            // per level, number of coarse bins
+    std::vector<FeatureMatrix> levels_;        // per level, the coarse rows, coarsest last
+};
+
+#endif
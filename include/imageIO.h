@@ -0,0 +1,71 @@
+/**
+ * @file imageIO.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for imageIO.cpp, listing and decoding the images of a directory
+ * @version 0.1
+ * @date 2024-02-20
+*/
+
+#ifndef IMAGEIO_H
+#define IMAGEIO_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/*
+  How an image file is decoded before feature extraction.
+
+  reduction is 1 (full size), 2, 4 or 8. JPEG files are then decoded
+  in the DCT domain at 1/reduction of the size, which is much cheaper
+  than a full decode. maxDimension, when non-zero, further shrinks the
+  decoded image so that its larger side is at most that many pixels.
+ */
+struct DecodePolicy {
+    int reduction;
+    int maxDimension;
+};
+
+// full resolution, what cv::imread(path, IMREAD_COLOR) gives
+DecodePolicy fullDecodePolicy();
+
+// reduced decode for the methods whose features are normalized histograms, full size for the others
+DecodePolicy decodePolicyForMethod(const std::string& method);
+
+// parse full, auto, 2, 4, 8 or max:<pixels>, auto picks decodePolicyForMethod(method)
+// returns non-zero if the text is not a valid policy
+int parseDecodePolicy(const std::string& text, const std::string& method, DecodePolicy& policy);
+
+// short description for reports, e.g. "1/4" or "full, max 800"
+std::string describeDecodePolicy(const DecodePolicy& policy);
+
+// true if the policy gives the same image as a full decode
+bool isFullDecode(const DecodePolicy& policy);
+
+// cv::imread flags for the policy
+int decodeFlags(const DecodePolicy& policy);
+
+// shrink an image that is already decoded (a video frame) as the policy would have decoded it
+cv::Mat applyDecodePolicy(const cv::Mat& image, const DecodePolicy& policy);
+
+// read and decode an image file with the policy, empty Mat on failure
+cv::Mat readImage(const std::string& path, const DecodePolicy& policy);
+
+// decode an encoded image held in memory with the policy, empty Mat on failure
+cv::Mat decodeImage(const std::vector<uchar>& bytes, const DecodePolicy& policy);
+
+// ask the kernel to start reading a file in the background (POSIX_FADV_WILLNEED), so that a
+// readFileBytes() of it a little later finds it in the page cache; errors are ignored
+void prefetchFile(const std::string& path);
+
+// read a whole file into memory, with sequential read-ahead
+// returns non-zero if the file cannot be read
+int readFileBytes(const std::string& path, std::vector<uchar>& bytes);
+
+// true if the file name has an image extension (jpg, jpeg, png, tif)
+bool isImageFileName(const std::string& file_name);
+
+// list the image files of a directory in directory order, returns non-zero if it cannot be opened
+int listImageFiles(const std::string& directory, std::vector<std::string>& file_names);
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file integralHistogram.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for integralHistogram.cpp, region histograms from one pass over an image
+ * @version 0.1
+ * @date 2024-02-20
+*/
+
+#ifndef INTEGRALHISTOGRAM_H
+#define INTEGRALHISTOGRAM_H
+
+#include <vector>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+// bin index marking a pixel that is not counted in any bin
+#define INTEGRAL_HIST_SKIP 0xFFFF
+// upper bound on the number of grid cells, keeps the table at cells * bins counts
+#define INTEGRAL_HIST_MAX_CELLS 4096
+// smallest grid cell side in pixels
+#define INTEGRAL_HIST_MIN_CELL 8
+
+/*
+  Integral histogram over a per-pixel bin-index map.
+
+  The bin map is a CV_16UC1 image holding the bin of every pixel, or
+  INTEGRAL_HIST_SKIP for pixels that belong to no bin. build() makes one
+  pass over the map and stores per-bin summed-area tables on a coarse
+  grid of cells. Any rectangle then costs O(bins) table lookups for the
+  cell-aligned interior, plus a scan of the thin border strips that do
+  not line up with the grid, so the counts are exact for any region.
+
+  When the regions are known up front, build() can size the grid for
+  them: a coarse grid keeps the table small, a fine one keeps the
+  border strips thin. If scanning the regions straight from the bin map
+  costs less than the pass, the table and the strips together, no grid
+  is built and every region is scanned directly (the halves of m, the
+  RGB bins of custom on small images).
+ */
+class IntegralHistogram {
+public:
+    IntegralHistogram();
+    IntegralHistogram(const cv::Mat& binMap, int bins);
+
+    // build the tables from a CV_16UC1 bin map, returns non-zero on error
+    int build(const cv::Mat& binMap, int bins);
+    // the same for the count regions that will be asked for, the grid is sized to them or left out
+    int build(const cv::Mat& binMap, int bins, const cv::Rect* regions, size_t count);
+
+    // add the raw bin counts of the region to counts (resized to bins if needed)
+    void regionCounts(const cv::Rect& region, std::vector<float>& counts) const;
+    // the same into bins() floats
+    void regionCounts(const cv::Rect& region, float* counts) const;
+
+    // histogram of the region normalized so that the bins sum to 1
+    std::vector<float> regionHistogram(const cv::Rect& region) const;
+    // the same written to bins() floats, no allocation
+    void regionHistogram(const cv::Rect& region, float* histogram) const;
+
+    int bins() const { return bins_; }
+    int rows() const { return binMap_.rows; }
+    int cols() const { return binMap_.cols; }
+    bool empty() const { return binMap_.empty(); }
+    // true if the regions are scanned from the bin map, without a grid
+    bool direct() const { return cellSize_ == 0; }
+    // memory of the tables
+    size_t bytes() const { return (table_.capacity() + scanTotals_.capacity()) * sizeof(int); }
+
+private:
+    // pixel coordinate of a grid line, clamped to the image
+    int gridX(int gx) const { return std::min(gx * cellSize_, binMap_.cols); }
+    int gridY(int gy) const { return std::min(gy * cellSize_, binMap_.rows); }
+    // count the pixels of a rectangle straight from the bin map
+    void scanCounts(int x0, int y0, int x1, int y1, float* counts) const;
+    // fill the summed-area tables for cells of cellSize pixels
+    void buildGrid(int cellSize);
+
+    cv::Mat binMap_;
+    int bins_;
+    int cellSize_;                // 0 when there is no grid
+    int gridCols_;
+    int gridRows_;
+    // (gridRows_ + 1) x (gridCols_ + 1) x bins_ cumulative counts
+    std::vector<int> table_;
+    // bins_ integer counts of a direct scan, a float count stops growing at 2^24 pixels
+    mutable std::vector<int> scanTotals_;
+};
+
+// Normalize a count histogram in place so that the bins sum to 1
+void normalizeHistogram(std::vector<float>& histogram);
+void normalizeHistogram(float* histogram, size_t n);
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file knnGraph.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for knnGraph.cpp, k nearest neighbor graph of a whole feature database
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef KNNGRAPH_H
+#define KNNGRAPH_H
+
+#include <string>
+#include <vector>
+#include "csv_util.h"
+#include "featureMatrix.h"
+
+// rows of a tile that share one pass over the other rows
+#define KNN_TILE_ROWS 32
+// rows of the other side of a tile, sized so they stay in L2
+#define KNN_TILE_COLS 128
+// first bytes of a graph file
+#define KNN_GRAPH_MAGIC "CBIRKNN1"
+
+/*
+  The k best matches of every row of a database, the row itself left
+  out: row r's neighbors are neighbors[r * k .. r * k + k), best first,
+  with their scores. Rows with fewer than k other rows pad with -1.
+ */
+struct KnnGraph {
+    size_t rows;
+    int k;
+    bool similarity;              // true if a higher score is better
+    std::vector<int> neighbors;
+    std::vector<float> scores;
+};
+
+// A pair of rows whose score passes a threshold, a < b
+struct KnnPair {
+    int a;
+    int b;
+    float score;
+};
+
+/*
+  Computes the kNN graph of the database with the method's metric in
+  one process, instead of one query per row.
+
+  The rows are cut in tiles of KNN_TILE_ROWS x KNN_TILE_COLS and the
+  row tiles are shared out to the threads, each thread owns the
+  neighbor lists of its rows so nothing is locked. Inside a tile:
+    dnn on normalized rows - the tile is a small matrix product, cosine is the dot product
+    SSD methods            - |a|^2 + |b|^2 - 2 a.b, with the squared norms computed once
+    the other methods      - the method's metric for each pair of the tile
+  Every pair is scored from both ends, which keeps threads independent.
+
+  If pairs is given, every pair of rows with a similarity >= threshold
+  (or an SSD <= threshold) is also collected there, whether or not it
+  made either row's k neighbors. Each pair is taken once, when it is
+  scored from its lower row, and the pairs are sorted by row.
+
+  Returns non-zero if the method has no metric.
+ */
+int computeKnnGraph(const std::string& method, const FeatureMatrix& data, int k, int threads, KnnGraph& graph,
+                    std::vector<KnnPair>* pairs = nullptr, float threshold = 0.0f);
+
+/*
+  Binary graph file, little endian:
+    "CBIRKNN1", uint32 rows, uint32 k, uint32 similarity, uint32 name bytes
+    the filenames, each 0-terminated, in row order
+    int32 neighbors[rows * k], float32 scores[rows * k]
+  Returns non-zero if the file cannot be written.
+ */
+int writeKnnGraph(const std::string& path, const KnnGraph& graph, const FilenameArena& filenames);
+
+#endif
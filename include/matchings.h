@@ -14,6 +14,9 @@
 
 #define SPLIT_POINT (BINS_3D * BINS_3D * BINS_3D)
 
+// values summed between two checks of the early-abandon SSD
+#define SSD_ABANDON_BLOCK 8
+
 #define GLCM_DISTANCE 1
 #define GLCM_ANGLE 0
 #define GLCM_LEVELS 256
@@ -22,27 +25,54 @@ const std::vector<int> WEIGHT_CONFIG_S = {1, 2, 4, 8};
 const std::vector<int> WEIGHT_CONFIG_M = {1, 2, 8, 4};
 const std::vector<int> WEIGHT_CONFIG_L = {1, 8, 4, 2};
 
+// reusable buffers of the extractors, see extractScratch.h
+class ExtractScratch;
+
+/*
+  Every extractor comes in two forms: the one returning a new vector,
+  and the one writing into featureVector and keeping its intermediate
+  images in an ExtractScratch. The second gives the same values and,
+  with the same scratch and vector, reuses their memory from image to
+  image.
+ */
+
 
 // Task 1: baseline matching
 // Function to extract 7x7 feature vector from an image
 std::vector<float> extract7x7FeatureVector(const cv::Mat &image);
+void extract7x7FeatureVector(const cv::Mat &image, std::vector<float>& featureVector);
 // Function to compute the sum of squared differences between two vectors
 float computeSSD(const std::vector<float>& vec1, const std::vector<float>& vec2);
+// Same on raw rows of n values, e.g. FeatureMatrix rows
+float computeSSD(const float* vec1, const float* vec2, size_t n);
+// SSD that stops once the partial sum exceeds bound, checked every SSD_ABANDON_BLOCK values
+// returns the exact SSD if it is at most bound, otherwise some partial sum above bound
+float computeSSDBounded(const float* vec1, const float* vec2, size_t n, float bound);
 
 // Task 2: 2D & 3D histogram matching
 // Function to extract the 2D histogram feature vector from an image
 std::vector<float> calculateRG_2DChromaHistogram(const cv::Mat& image, int binsPerChannel);
+void calculateRG_2DChromaHistogram(const cv::Mat& image, int binsPerChannel, std::vector<float>& featureVector);
 // Function to extract the 3D histogram feature vector from an image
 std::vector<float> calculateRGB_3DChromaHistogram(const cv::Mat& image, int binsPerChannel);
+void calculateRGB_3DChromaHistogram(const cv::Mat& image, int binsPerChannel, std::vector<float>& featureVector);
 // Function to compute the histogram intersection distance between two vectors
 float computeHistogramIntersection(const std::vector<float>& vec1, const std::vector<float>& vec2);
+float computeHistogramIntersection(const float* vec1, const float* vec2, size_t n);
+
+// Build the per-pixel RGB 3D bin map (CV_16UC1) used by the integral histogram
+int computeRGBBinMap(const cv::Mat& image, int binsPerChannel, cv::Mat& binMap);
+// RGB 3D histograms of several regions of an image, from a single pass over the pixels
+std::vector<std::vector<float>> calculateRegionRGBHistograms(const cv::Mat& image, int binsPerChannel, const std::vector<cv::Rect>& regions);
 
 // Task 3: Multi-histogram matching
 // Extract the multi-channel histogram feature vector from an image
 // Divided the image into 2 parts, top and bottom
 std::vector<float> calculateMultiPartRGBHistogram(const cv::Mat& image, int binsPerChannel);
+void calculateMultiPartRGBHistogram(const cv::Mat& image, int binsPerChannel, ExtractScratch& scratch, std::vector<float>& featureVector);
 // Function to compute the histogram intersection distance between two vectors
 float combinedHistogramIntersection(const std::vector<float>& vec1, const std::vector<float>& vec2, size_t splitPoint);
+float combinedHistogramIntersection(const float* vec1, const float* vec2, size_t n, size_t splitPoint);
 
 // Task 4: Texture and Color matching
 // SobelX and SobelY filter from Project 1
@@ -54,29 +84,44 @@ int sobelY3x3(const cv::Mat &src, cv::Mat &dst );
 int magnitude(const cv::Mat &sx, const cv::Mat &sy, cv::Mat &dst);
 // Extract the Texture Histogram from Sobel Magnitude Image
 std::vector<float> calculateTextureHistogram(const cv::Mat& magnitudeImage, int bins);
+void calculateTextureHistogram(const cv::Mat& magnitudeImage, int bins, float* histogram);
 // Combine the color and texture histograms into a single feature vector, giving equal weight to both
 std::vector<float> calculateColorTextureFeatureVector(const cv::Mat& image, int colorBinsPerChannel, int textureBins);
+void calculateColorTextureFeatureVector(const cv::Mat& image, int colorBinsPerChannel, int textureBins,
+                                        ExtractScratch& scratch, std::vector<float>& featureVector);
 
 
 // Task 5: Deep Network Embeddings
 // Function to calculate the cosine similarity between two vectors.
 float calculateCosineSimilarity(const std::vector<float>& vec1, const std::vector<float>& vec2);
+float calculateCosineSimilarity(const float* vec1, const float* vec2, size_t n);
+// Dot product, the cosine similarity of vectors already scaled to unit length
+float dotProduct(const float* vec1, const float* vec2, size_t n);
 
 // Task 7: Custom Design
 // Calculate the custom feature vector from an image
+// Build the per-pixel gradient magnitude bin map (CV_16UC1) used by the integral histogram
+int computeGradientBinMap(const cv::Mat& image, int bins, cv::Mat& binMap);
+int computeGradientBinMap(const cv::Mat& image, int bins, ExtractScratch& scratch, cv::Mat& binMap);
 // Function to calculate gradient magnitude histogram
 std::vector<float> calculateGradientMagnitudeHistogram(const cv::Mat& image, int bins);
 
 std::vector<float> calculateCustomFeature(const cv::Mat& image, int bins, const std::vector<int>& weightConfig);
+void calculateCustomFeature(const cv::Mat& image, int bins, const std::vector<int>& weightConfig,
+                            ExtractScratch& scratch, std::vector<float>& featureVector);
 
 
 
 // EXTENSION: GLCM texture features
 std::vector<float> calculateGLCMFeatures(const cv::Mat& src, int distance, int angle, int levels);
+void calculateGLCMFeatures(const cv::Mat& src, int distance, int angle, int levels, ExtractScratch& scratch, std::vector<float>& featureVector);
 // EXTENSION: Laws texture features
 std::vector<float> calculateLawsTextureFeatures(const cv::Mat& src);
+void calculateLawsTextureFeatures(const cv::Mat& src, ExtractScratch& scratch, std::vector<float>& featureVector);
 // EXTENSION: Gabor texture features
 std::vector<float> computeGaborFeatures(const cv::Mat& img);
+// cv::filter2D still allocates its own buffers, the filter bank and response are kept in the scratch
+void computeGaborFeatures(const cv::Mat& img, ExtractScratch& scratch, std::vector<float>& featureVector);
 // EXTENSION: face detection and feature extraction
 // Define a function to extract face features
 std::vector<float> extractFaceFeatures(cv::Mat& img);
@@ -0,0 +1,102 @@
+/**
+ * @file profiler.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for profiler.cpp, scoped stage timers and counters
+ * @version 0.1
+ * @date 2024-02-23
+*/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+
+/*
+  Lightweight instrumentation for the front ends and the shared code.
+
+  PROFILE_SCOPE("csv.read") times the rest of the enclosing block,
+  wall clock and thread CPU time, and PROFILE_COUNT("csv.rows", n)
+  adds to a named counter. Both cost a single flag test while the
+  profiler is off, which is the default, and compile to nothing when
+  CBIR_NO_PROFILE is defined.
+
+  The profiler is turned on by profilerInitFromEnv() when the
+  CBIR_PROFILE environment variable is set:
+    CBIR_PROFILE=summary  table of stages and counters
+    CBIR_PROFILE=json     the same numbers as JSON
+    CBIR_PROFILE=trace    Chrome trace-event JSON, open it in chrome://tracing or Perfetto
+  The report goes to stderr, or to the file named by CBIR_PROFILE_FILE
+  (default cbir_trace.json for the trace format). Heap allocations are
+  counted too when the front ends are built with
+  -DCBIR_PROFILE_ALLOCATIONS=ON.
+ */
+
+enum ProfileFormat {
+    PROFILE_OFF = 0,
+    PROFILE_SUMMARY,
+    PROFILE_JSON,
+    PROFILE_TRACE
+};
+
+// global switch read by the macros, set through profilerEnable()
+extern bool profilerActive;
+
+// turn the profiler on with a report format, PROFILE_OFF turns it off
+void profilerEnable(ProfileFormat format, const std::string& outputFile = "");
+
+// turn the profiler on from CBIR_PROFILE / CBIR_PROFILE_FILE and report at exit
+// returns non-zero for an unknown format
+int profilerInitFromEnv();
+
+// write the report in the selected format, nothing if the profiler is off
+void profilerReport();
+
+// record one finished scope, used by ProfileScope
+void profilerRecord(const char* name, long long startNs, long long wallNs, long long cpuNs);
+
+// add to a named counter
+void profilerCount(const char* name, long long value);
+
+// count one heap allocation while the profiler is on, reported as alloc.count; called by the
+// operator new of profileAllocations.cpp, which is only linked with -DCBIR_PROFILE_ALLOCATIONS=ON
+void profilerCountAllocation();
+
+// monotonic clock and thread CPU clock, in nanoseconds
+long long profilerWallNs();
+long long profilerCpuNs();
+
+// Times its own lifetime and records it under a name when the profiler is on
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name) : name_(name), startWall_(0), startCpu_(0) {
+        if (profilerActive) {
+            startWall_ = profilerWallNs();
+            startCpu_ = profilerCpuNs();
+        }
+    }
+    ~ProfileScope() {
+        if (startWall_ != 0) {
+            profilerRecord(name_, startWall_, profilerWallNs() - startWall_, profilerCpuNs() - startCpu_);
+        }
+    }
+
+private:
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+
+    const char* name_;
+    long long startWall_;
+    long long startCpu_;
+};
+
+#ifdef CBIR_NO_PROFILE
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name, value)
+#else
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#define PROFILE_COUNT(name, value) do { if (profilerActive) profilerCount((name), (value)); } while (0)
+#endif
+
+#endif
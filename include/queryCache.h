@@ -0,0 +1,87 @@
+/**
+ * @file queryCache.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for queryCache.cpp, target features and query results keyed by the target's content hash
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef QUERYCACHE_H
+#define QUERYCACHE_H
+
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// part of every key, bump it when an extractor changes so old entries are not used
+#define QUERY_CACHE_VERSION 1
+// entries of each kind kept in memory before the oldest is dropped
+#define QUERY_CACHE_MEMORY_ENTRIES 256
+// first bytes of a cache file
+#define QUERY_CACHE_MAGIC "CBIRQC01"
+
+// 64-bit FNV-1a of a file's bytes, returns non-zero if it cannot be read
+int contentHash(const std::string& path, unsigned long long& hash);
+
+// size, modification time in nanoseconds and inode of each feature store, results cached under another
+// version are stale (a store replaced by rename gets a new inode even within the clock's resolution)
+std::string featureStoreVersion(const std::vector<std::string>& paths);
+
+// The printed answer of a query
+struct CachedResults {
+    std::string header;
+    std::vector<std::pair<std::string, float>> matches;
+};
+
+/*
+  Cache of the work a repeated query can skip. Keys start with the
+  content hash of the target file, so a renamed copy hits and an edited
+  file misses:
+    features  hash + method                the extracted target, skips decode and extraction
+    results   hash + method + parameters   the matches, also skips loading and scanning the CSV;
+                                           only valid for the feature store version they were stored with
+  Entries live in memory (for a process that answers many queries) and,
+  if a directory is given, in one file per entry there (for CLI runs).
+  Every write goes to a temporary file of its own (mkstemp) that is
+  synced and renamed over the entry, so concurrent runs never read half
+  an entry or a mix of two writers.
+ */
+class QueryCache {
+public:
+    // empty directory: memory only
+    explicit QueryCache(const std::string& directory = std::string());
+
+    static std::string featureKey(unsigned long long hash, const std::string& method);
+    static std::string resultKey(unsigned long long hash, const std::string& method, const std::string& parameters);
+
+    bool findFeatures(const std::string& key, std::vector<float>& features);
+    void storeFeatures(const std::string& key, const std::vector<float>& features);
+    bool findResults(const std::string& key, const std::string& storeVersion, CachedResults& results);
+    void storeResults(const std::string& key, const std::string& storeVersion, const CachedResults& results);
+
+    size_t featureHits() const { return featureHits_; }
+    size_t featureMisses() const { return featureMisses_; }
+    size_t resultHits() const { return resultHits_; }
+    size_t resultMisses() const { return resultMisses_; }
+    // one line of hit and miss counts
+    void report(FILE* fp) const;
+
+private:
+    std::string entryPath(const std::string& key, const char* kind) const;
+    void remember(std::deque<std::string>& order, const std::string& key, bool features);
+
+    std::string directory_;
+    std::map<std::string, std::vector<float>> features_;
+    std::map<std::string, std::pair<std::string, CachedResults>> results_;   // key -> (store version, results)
+    std::deque<std::string> featureOrder_;
+    std::deque<std::string> resultOrder_;
+    size_t featureHits_;
+    size_t featureMisses_;
+    size_t resultHits_;
+    size_t resultMisses_;
+};
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file retrieval.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for retrieval.cpp, ranks the rows of a feature database against a target
+ * @version 0.1
+ * @date 2024-02-22
+*/
+
+#ifndef RETRIEVAL_H
+#define RETRIEVAL_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "featureMatrix.h"
+
+/*
+  Scores the target against every row of the database with the
+  method's metric (see featureMethods.h) and returns all the rows as
+  (score, row index) pairs, best match first: descending for histogram
+  intersection and cosine similarity, ascending for SSD. Callers look
+  the filenames of the rows they print up in the FilenameArena.
+
+  For dnn on a matrix whose rows were normalized at load time
+  (FeatureMatrix::normalizeRows), cosine similarity is computed as one
+  matrix-vector product instead of three sums per row.
+
+  This is the scan used by matching and dnn_embedding.
+ */
+std::vector<std::pair<float, int>> rankRows(const std::string& method, const std::vector<float>& target,
+                                            const FeatureMatrix& data);
+
+/*
+  Only the k best rows, best match first, the same rows and order as
+  the start of rankRows. The SSD methods (b, glcm, l, gabor) abandon a
+  row's sum once it passes the K-th best distance found so far; on a
+  matrix with orderColumnsByVariance() the large differences come first
+  and rows are abandoned sooner. The other methods score every row and
+  partially sort.
+ */
+std::vector<std::pair<float, int>> rankTopRows(const std::string& method, const std::vector<float>& target,
+                                               const FeatureMatrix& data, size_t k);
+
+/*
+  The k best of the candidate rows only, best match first, scored the
+  way rankRows scores them (dnn on normalized rows as dot products).
+  Used by the cascade of matching: a cheap method shortlists the
+  candidates, an expensive one reranks them.
+ */
+std::vector<std::pair<float, int>> rankCandidateRows(const std::string& method, const std::vector<float>& target,
+                                                     const FeatureMatrix& data, const std::vector<int>& candidates,
+                                                     size_t k);
+
+// rows sampled per source to normalize its scores for fusion
+#define FUSION_SAMPLE_ROWS 512
+
+/*
+  One feature store of a fusion query. rows maps every fused row to
+  the row of data holding the same image (aligned by filename, see
+  FilenameIndex), -1 if the store does not have it.
+ */
+struct FusionSource {
+    std::string method;
+    const FeatureMatrix* data;
+    std::vector<float> target;
+    std::vector<int> rows;
+    float weight;
+};
+
+/*
+  Ranks the images of several stores by one combined score. The metrics
+  do not share a scale (intersections near 1, SSDs in the thousands), so
+  each source's score is turned into a z-score with the mean and
+  standard deviation of its scores over a strided sample of
+  FUSION_SAMPLE_ROWS rows, negated for distances, then weighted and
+  summed. Every row is scored by all the sources in one pass and only
+  the k best fused scores are kept, so there is no per-source scan and
+  no full-size score array. Rows missing from any source are skipped.
+  Returns (fused score, fused row) pairs, highest first.
+ */
+std::vector<std::pair<float, int>> fuseTopRows(const std::vector<FusionSource>& sources, size_t rows, size_t k);
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * @file shardedStore.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for shardedStore.cpp, feature CSVs split in shards and queried by scatter-gather
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef SHARDEDSTORE_H
+#define SHARDEDSTORE_H
+
+#include <string>
+#include <vector>
+
+// How the images of a feature CSV are shared out to the shards
+enum ShardPolicy {
+    SHARD_BY_HASH,      // FNV-1a of the file name modulo the shard count: an image always lands in the same shard
+    SHARD_BY_RANGE      // consecutive blocks of rows, in CSV order
+};
+
+// One match of a sharded query
+struct ShardMatch {
+    float score;
+    size_t shard;
+    int row;            // row in its shard
+    std::string name;
+};
+
+/*
+  Shard i of K of a feature CSV is a feature CSV of its own, next to it:
+  image_features_3D_histogram.csv -> image_features_3D_histogram.shard-<i>-of-<K>.csv
+  Every shard can be rebuilt or moved on its own, and no process has to
+  hold more than the shards it queries.
+ */
+std::string shardCsvPath(const std::string& csvFile, size_t shard, size_t shards);
+
+// shard of an image name under SHARD_BY_HASH
+size_t shardOfName(const char* name, size_t length, size_t shards);
+
+/*
+  Writes the K shard CSVs of a feature CSV.
+  Returns non-zero if the CSV cannot be read or a shard cannot be written.
+ */
+int splitFeatureCsv(const std::string& csvFile, size_t shards, ShardPolicy policy);
+
+/*
+  Scatter-gather query on one machine: the K shards are loaded and
+  ranked with rankTopRows in parallel threads (at most threads at a
+  time), each returns its k best, and the K lists are merged into the
+  global k best, best match first. The result is the same as ranking
+  the unsplit CSV, except that equal scores in different shards are
+  ordered by shard rather than by CSV row.
+  Returns non-zero if a shard cannot be read or ranked (features of
+  another width than the target).
+ */
+int scatterGatherTopRows(const std::string& method, const std::vector<float>& target, const std::string& csvFile,
+                         size_t shards, size_t k, int threads, std::vector<ShardMatch>& matches);
+
+#endif
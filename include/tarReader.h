@@ -0,0 +1,74 @@
+/**
+ * @file tarReader.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for tarReader.cpp, streaming the members of a tar archive
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef TARREADER_H
+#define TARREADER_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// size of a tar header and of the blocks the member data is padded to
+#define TAR_BLOCK_SIZE 512
+// largest member read() loads into memory, a larger size is taken for a damaged header
+#define TAR_MAX_MEMBER_BYTES (1ULL << 30)
+
+// true if an input is read as a tar archive: "-" (a tar stream on stdin) or a name ending in .tar
+bool isTarInput(const std::string& input);
+
+// A regular file of the archive
+struct TarMember {
+    std::string path;   // member path inside the archive, ustar prefix, GNU long names and pax paths included
+    size_t size;
+};
+
+/*
+  Reads a tar archive front to back, never seeking, so it works the same
+  on a file and on a pipe:
+    TarMember member;
+    while (reader.next(member) > 0) {
+        if (wanted) reader.read(bytes);
+    }
+  Only regular files are returned. The data of a member that is not
+  read is skipped by the next call to next(). Directories, links and
+  other entries are skipped, ustar, GNU long name ('L') and pax ('x')
+  headers are understood. On a regular file every header's size is
+  checked against the bytes left, so a truncated archive is an error
+  rather than an early end (a pipe finds out when a read comes up short).
+ */
+class TarReader {
+public:
+    TarReader();
+    ~TarReader();
+
+    // "-" reads stdin, returns non-zero if the file cannot be opened
+    int open(const std::string& input);
+
+    // moves to the next regular file, returns 1 with a member, 0 at the end of the archive,
+    // -1 if the archive is damaged or cut short
+    int next(TarMember& member);
+
+    // reads the data of the current member, returns non-zero if the archive is cut short
+    // or the member is larger than TAR_MAX_MEMBER_BYTES
+    int read(std::vector<unsigned char>& bytes);
+
+private:
+    int readBlock(unsigned char* block);
+    int skip(size_t bytes);
+    int readLongText(size_t size, std::string& text);
+    bool available(size_t bytes);
+
+    FILE* fp_;
+    bool ownsFile_;
+    size_t remaining_;      // data of the current member not read yet
+    size_t padding_;        // bytes after it up to the next block
+    bool ended_;
+    long long fileSize_;    // size of a regular file, -1 for a pipe
+};
+
+#endif
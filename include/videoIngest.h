@@ -0,0 +1,66 @@
+/**
+ * @file videoIngest.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for videoIngest.cpp, feature extraction of the frames of a video
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef VIDEOINGEST_H
+#define VIDEOINGEST_H
+
+#include <cstdio>
+#include <string>
+#include "faceDetect.h"
+#include "imageIO.h"
+
+// default: every frame is a candidate
+#define VIDEO_FRAME_STRIDE 1
+// default: a frame is indexed when 1 - (h2 intersection with the last indexed frame) is above this
+#define VIDEO_CHANGE_THRESHOLD 0.05
+// larger side of the frame the change probe's h2 histogram is computed on
+#define VIDEO_PROBE_DIMENSION 160
+
+// true if the input has a video extension (mp4, avi, mov, mkv, m4v, webm, mpg, mpeg)
+bool isVideoInput(const std::string& input);
+
+/*
+  Settings of the video extraction.
+
+  Every stride-th frame is a candidate. The others are only grabbed:
+  the codec still decodes them (with FFmpeg, grab() decodes every
+  packet), but their conversion to a BGR image, the change probe and
+  the extraction are skipped. A candidate is indexed only if its RG
+  chromaticity histogram (h2, on a VIDEO_PROBE_DIMENSION copy) moved more than
+  changeThreshold away from the one of the last indexed frame, so a
+  static shot gives one row and a slow pan a row every time it has
+  drifted far enough. changeThreshold 0 indexes every candidate.
+ */
+struct VideoOptions {
+    int stride;
+    double changeThreshold;
+    DecodePolicy decodePolicy;  // applied to the decoded frames
+};
+
+// VIDEO_FRAME_STRIDE, VIDEO_CHANGE_THRESHOLD, full size
+VideoOptions defaultVideoOptions();
+
+// Frame counts of a video extraction
+struct VideoStats {
+    size_t frames;      // frames in the video
+    size_t candidates;  // frames on the stride, retrieved as images
+    size_t indexed;     // rows written
+    size_t unchanged;   // candidates skipped by the change probe
+    size_t failed;      // candidates that could not be decoded or extracted
+};
+
+/*
+  Extracts the features of the frames of a video file into fp, one row
+  per indexed frame keyed <video file name>#<frame index>, frame indices
+  counted from 0 over all the frames of the video.
+  Returns non-zero if the video cannot be opened or a row cannot be written.
+ */
+int extractVideoFeatures(const std::string& method, const std::string& videoPath, FILE* fp,
+                         const VideoOptions& options, FaceDetector& faceDetector, VideoStats& stats);
+
+#endif
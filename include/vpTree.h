@@ -0,0 +1,97 @@
+/**
+ * @file vpTree.h
+ * @author Yuan Zhao zhao.yuan2@northeatern.edu
+ * @brief header file for vpTree.cpp, exact vantage-point tree index for the SSD methods
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#ifndef VPTREE_H
+#define VPTREE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "featureMatrix.h"
+
+// rows at or below this count are kept in a leaf and scanned
+#define VP_TREE_LEAF 8
+// seed for picking the vantage points, so the same database gives the same tree
+#define VP_TREE_SEED 20240225
+// first bytes of an index file
+#define VP_TREE_MAGIC "CBIRVPT1"
+
+// Distance evaluations of one query
+struct VpTreeStats {
+    size_t rows;        // rows of the database
+    size_t distances;   // rows whose distance to the target was computed
+    size_t pruned() const { return rows - distances; }
+};
+
+/*
+  Vantage-point tree over the rows of a feature database, for the
+  methods ranked by computeSSD (b, glcm, l, gabor).
+
+  The square root of an SSD is the Euclidean distance, a metric, so
+  the triangle inequality bounds the distance from the target to every
+  row under a node: a node splits its rows at the median distance mu
+  from its vantage row, the rows inside are at most mu from it and the
+  rows outside at least mu. A subtree is skipped when its bound is
+  already worse than the K-th best distance (top N) or the radius
+  (range). Both queries are exact, scores are the SSD of computeSSD and
+  ties go to the lower row, as in rankTopRows.
+
+  The tree only stores row numbers and radii, the features stay in the
+  FeatureMatrix it was built from, which must be passed to every query.
+ */
+class VpTree {
+public:
+    VpTree() : rows_(0), cols_(0), fingerprint_(0) {}
+
+    // returns non-zero if data is empty
+    int build(const FeatureMatrix& data);
+
+    // the k rows with the smallest SSD to target, smallest first
+    std::vector<std::pair<float, int>> topRows(const std::vector<float>& target, const FeatureMatrix& data, size_t k,
+                                               VpTreeStats* stats = nullptr) const;
+    // every row with SSD <= radius, smallest first
+    std::vector<std::pair<float, int>> rangeRows(const std::vector<float>& target, const FeatureMatrix& data,
+                                                 float radius, VpTreeStats* stats = nullptr) const;
+
+    /*
+      Index file, little endian:
+        "CBIRVPT1", uint32 rows, uint32 cols, uint32 nodes, uint64 fingerprint of the features
+        int32 items[rows], then per node int32 begin, end, inside, outside and float32 mu
+      read() refuses a file built from other features (rows, cols or fingerprint differ),
+      so a stale index is rebuilt instead of giving wrong answers.
+      Both return non-zero on failure.
+     */
+    int write(const std::string& path) const;
+    int read(const std::string& path, const FeatureMatrix& data);
+
+    bool empty() const { return nodes_.empty(); }
+    // bytes of the items and nodes
+    size_t bytes() const;
+
+private:
+    // items_[begin, end) are the rows under a node, the vantage row first;
+    // inside / outside are child nodes, -1 for a leaf whose rows are all scanned
+    struct Node {
+        int begin;
+        int end;
+        int inside;
+        int outside;
+        float mu;
+    };
+
+    template <class Collector>
+    void search(int index, const float* query, const FeatureMatrix& data, Collector& found, size_t& distances) const;
+
+    size_t rows_;
+    size_t cols_;
+    unsigned long long fingerprint_;
+    std::vector<int> items_;
+    std::vector<Node> nodes_;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file allpairs.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief k nearest neighbors of every image of a feature file, and near-duplicate pairs
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include "csv_util.h"
+#include "featureMatrix.h"
+#include "featureMethods.h"
+#include "knnGraph.h"
+#include "profiler.h"
+
+// neighbors kept per image
+#define ALLPAIRS_K 10
+
+
+void allpairsMenu() {
+    printf("Usage: ./allpairs <method> <feature csv> [options]\n");
+    printf("method: the method the feature file was extracted with (b, h2, h3, m, tc, glcm, l, gabor, custom_s, custom_m, custom_l) or dnn\n");
+    printf("options:\n");
+    printf("  --k <n>: neighbors per image (default %d)\n", ALLPAIRS_K);
+    printf("  --threads <n>: worker threads (default one per core)\n");
+    printf("  --out <file>: write the graph in the binary kNN graph format (see knnGraph.h)\n");
+    printf("  --threshold <t>: print every near-duplicate pair, similarity >= t, or distance <= t for SSD methods\n");
+}
+
+int main(int argc, char* argv[]) {
+    // Stage timers and counters, see profiler.h
+    profilerInitFromEnv();
+    PROFILE_SCOPE("allpairs.total");
+
+    if (argc < 3) {
+        allpairsMenu();
+        return EXIT_FAILURE;
+    }
+    std::string method = argv[1];
+    std::string csvFile = argv[2];
+    if (!isMatchingMethod(method)) {
+        std::cerr << "Error: invalid method" << std::endl;
+        allpairsMenu();
+        return EXIT_FAILURE;
+    }
+
+    int k = ALLPAIRS_K;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string outFile;
+    bool duplicates = false;
+    float threshold = 0.0f;
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--k" && i + 1 < argc) {
+            k = std::stoi(argv[++i]);
+        } else if (option == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else if (option == "--out" && i + 1 < argc) {
+            outFile = argv[++i];
+        } else if (option == "--threshold" && i + 1 < argc) {
+            duplicates = true;
+            threshold = std::stof(argv[++i]);
+        } else {
+            std::cerr << "Error: invalid option " << option << std::endl;
+            allpairsMenu();
+            return EXIT_FAILURE;
+        }
+    }
+    if (k < 1 || threads < 1) {
+        allpairsMenu();
+        return EXIT_FAILURE;
+    }
+
+    // Load the feature file once
+    FilenameArena filenames;
+    FeatureMatrix data;
+    if (read_image_data_csv(const_cast<char*>(csvFile.c_str()), filenames, data, false) != 0) {
+        std::cerr << "Error: cannot read " << csvFile << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (method == "dnn") {
+        data.normalizeRows();  // cosine becomes a dot product, the tiles become a matrix product
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    KnnGraph graph;
+    std::vector<KnnPair> pairs;
+    if (computeKnnGraph(method, data, k, threads, graph, duplicates ? &pairs : nullptr, threshold) != 0) {
+        std::cerr << "Error: cannot compute the graph" << std::endl;
+        return EXIT_FAILURE;
+    }
+    double graphMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%zu images, %d neighbors each, %d threads, %.1f ms\n", graph.rows, k, threads, graphMs);
+
+    if (!outFile.empty()) {
+        if (writeKnnGraph(outFile, graph, filenames) != 0) {
+            std::cerr << "Error: cannot write " << outFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        fprintf(stderr, "Graph written to %s\n", outFile.c_str());
+    }
+
+    // Near duplicates: every pair past the threshold, found while the tiles were scored
+    if (duplicates) {
+        for (const KnnPair& pair : pairs) {
+            printf("%s,%s,%.6f\n", filenames.name(pair.a), filenames.name(pair.b), pair.score);
+        }
+        fprintf(stderr, "%zu near-duplicate pairs\n", pairs.size());
+    }
+    return 0;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file binaryCodes.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief packed binary signatures and a Hamming top-K prefilter
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include "featureMethods.h"
+#include "binaryCodes.h"
+#include "profiler.h"
+
+
+BinaryCodeKind BinaryCodes::kindForMethod(const std::string& method) {
+    return isSimilarityMethod(method) && method != "dnn" ? BINARY_THRESHOLD : BINARY_SIMHASH;
+}
+
+int BinaryCodes::build(const FeatureMatrix& data, BinaryCodeKind kind, size_t bits) {
+    PROFILE_SCOPE("binary.build");
+    codes_.clear();
+    if (data.empty() || bits == 0) {
+        return -1;
+    }
+    kind_ = kind;
+    cols_ = data.cols();
+    rows_ = data.rows();
+    bits_ = kind == BINARY_THRESHOLD ? cols_ : bits;
+    words_ = (bits_ + 63) / 64;
+    fingerprint_ = data.fingerprint();
+
+    // column means in the original order
+    std::vector<double> sums(cols_, 0.0);
+    for (size_t r = 0; r < rows_; r++) {
+        std::vector<float> values = data.rowVector(r);
+        for (size_t c = 0; c < cols_; c++) sums[c] += values[c];
+    }
+    mean_.resize(cols_);
+    for (size_t c = 0; c < cols_; c++) {
+        mean_[c] = static_cast<float>(sums[c] / rows_);
+    }
+
+    planes_.clear();
+    if (kind == BINARY_SIMHASH) {
+        std::mt19937 rng(BINARY_CODE_SEED);
+        std::normal_distribution<float> gaussian(0.0f, 1.0f);
+        planes_.resize(bits_ * cols_);
+        for (float& v : planes_) v = gaussian(rng);
+    }
+
+    codes_.resize(rows_ * words_);
+    for (size_t r = 0; r < rows_; r++) {
+        std::vector<uint64_t> code = encode(data.rowVector(r));
+        std::copy(code.begin(), code.end(), codes_.begin() + r * words_);
+    }
+    return 0;
+}
+
+std::vector<uint64_t> BinaryCodes::encode(const std::vector<float>& values) const {
+    if (values.size() != cols_) {
+        throw std::runtime_error("Feature vectors must be of the same size");
+    }
+    std::vector<uint64_t> code(words_, 0);
+    for (size_t b = 0; b < bits_; b++) {
+        bool set;
+        if (kind_ == BINARY_THRESHOLD) {
+            set = values[b] > mean_[b];
+        } else {
+            const float* plane = &planes_[b * cols_];
+            float projection = 0.0f;
+            for (size_t c = 0; c < cols_; c++) {
+                projection += (values[c] - mean_[c]) * plane[c];
+            }
+            set = projection >= 0.0f;
+        }
+        if (set) {
+            code[b / 64] |= 1ULL << (b % 64);
+        }
+    }
+    return code;
+}
+
+// Hamming distance of two codes, four words per step so the popcounts are independent
+static inline int hammingDistance(const uint64_t* a, const uint64_t* b, size_t words) {
+    int d0 = 0, d1 = 0, d2 = 0, d3 = 0;
+    size_t w = 0;
+    for (; w + 4 <= words; w += 4) {
+        d0 += __builtin_popcountll(a[w] ^ b[w]);
+        d1 += __builtin_popcountll(a[w + 1] ^ b[w + 1]);
+        d2 += __builtin_popcountll(a[w + 2] ^ b[w + 2]);
+        d3 += __builtin_popcountll(a[w + 3] ^ b[w + 3]);
+    }
+    for (; w < words; w++) {
+        d0 += __builtin_popcountll(a[w] ^ b[w]);
+    }
+    return d0 + d1 + d2 + d3;
+}
+
+std::vector<std::pair<int, int>> BinaryCodes::hammingTopRows(const std::vector<uint64_t>& code, size_t k) const {
+    PROFILE_SCOPE("binary.hamming_scan");
+    std::vector<std::pair<int, int>> best;
+    if (code.size() != words_) {
+        throw std::runtime_error("Binary code of another length");
+    }
+    k = std::min(k, rows_);
+    if (k == 0) {
+        return best;
+    }
+    // max-heap on (distance, row): the farthest kept code is on top and is the bound
+    best.reserve(k);
+    const uint64_t* query = code.data();
+    for (size_t r = 0; r < rows_; r++) {
+        int distance = hammingDistance(query, &codes_[r * words_], words_);
+        if (best.size() < k) {
+            best.emplace_back(distance, static_cast<int>(r));
+            std::push_heap(best.begin(), best.end());
+        } else if (distance < best.front().first) {
+            std::pop_heap(best.begin(), best.end());
+            best.back() = std::make_pair(distance, static_cast<int>(r));
+            std::push_heap(best.begin(), best.end());
+        }
+    }
+    PROFILE_COUNT("binary.rows_scanned", rows_);
+    std::sort(best.begin(), best.end());
+    return best;
+}
+
+std::vector<int> BinaryCodes::candidateRows(const std::vector<float>& target, size_t k) const {
+    std::vector<std::pair<int, int>> nearest = hammingTopRows(encode(target), k);
+    std::vector<int> rows;
+    rows.reserve(nearest.size());
+    for (const std::pair<int, int>& n : nearest) {
+        rows.push_back(n.second);
+    }
+    return rows;
+}
+
+int BinaryCodes::write(const std::string& path) const {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return -1;
+    }
+    uint32_t header[4] = {
+        static_cast<uint32_t>(kind_), static_cast<uint32_t>(bits_), static_cast<uint32_t>(cols_), static_cast<uint32_t>(rows_)
+    };
+    uint64_t print = fingerprint_;
+    fwrite(BINARY_CODE_MAGIC, 1, 8, fp);
+    fwrite(header, sizeof(uint32_t), 4, fp);
+    fwrite(&print, sizeof(uint64_t), 1, fp);
+    fwrite(mean_.data(), sizeof(float), mean_.size(), fp);
+    fwrite(planes_.data(), sizeof(float), planes_.size(), fp);
+    fwrite(codes_.data(), sizeof(uint64_t), codes_.size(), fp);
+    int error = ferror(fp);
+    fclose(fp);
+    return error ? -1 : 0;
+}
+
+int BinaryCodes::read(const std::string& path, const FeatureMatrix& data) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+    char magic[8];
+    uint32_t header[4];
+    uint64_t print = 0;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, BINARY_CODE_MAGIC, 8) != 0
+        || fread(header, sizeof(uint32_t), 4, fp) != 4 || fread(&print, sizeof(uint64_t), 1, fp) != 1
+        || header[0] > BINARY_THRESHOLD || header[1] == 0 || header[2] != data.cols() || header[3] != data.rows()
+        || print != data.fingerprint()) {
+        fclose(fp);
+        return -1;
+    }
+    BinaryCodeKind kind = static_cast<BinaryCodeKind>(header[0]);
+    size_t bits = header[1];
+    size_t words = (bits + 63) / 64;
+    size_t cols = header[2];
+    size_t planeCount = kind == BINARY_SIMHASH ? bits * cols : 0;
+    // encode() reads mean[bit] of a threshold code, and the arrays must be exactly what is left of the file
+    // (bits are capped first so the sizes cannot overflow)
+    struct stat info;
+    long position = ftell(fp);
+    size_t expected = (cols + planeCount) * sizeof(float) + words * header[3] * sizeof(uint64_t);
+    if ((kind == BINARY_THRESHOLD && bits != cols) || bits > BINARY_CODE_MAX_BITS || position < 0 || fstat(fileno(fp), &info) != 0
+        || static_cast<unsigned long long>(info.st_size) != position + expected) {
+        fclose(fp);
+        return -1;
+    }
+    std::vector<float> mean(cols);
+    std::vector<float> planes(planeCount);
+    std::vector<uint64_t> codes(words * header[3]);
+    bool ok = fread(mean.data(), sizeof(float), mean.size(), fp) == mean.size()
+        && fread(planes.data(), sizeof(float), planes.size(), fp) == planes.size()
+        && fread(codes.data(), sizeof(uint64_t), codes.size(), fp) == codes.size();
+    fclose(fp);
+    if (!ok) {
+        return -1;
+    }
+
+    kind_ = kind;
+    bits_ = bits;
+    words_ = words;
+    cols_ = header[2];
+    rows_ = header[3];
+    fingerprint_ = print;
+    mean_.swap(mean);
+    planes_.swap(planes);
+    codes_.swap(codes);
+    return 0;
+}
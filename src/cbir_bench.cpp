@@ -0,0 +1,431 @@
+/**
+ * @file cbir_bench.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief microbenchmarks for the feature extractors, the distance kernels and the csv read/write paths
+ * @version 0.1
+ * @date 2024-02-22
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "matchings.h"
+#include "csv_util.h"
+#include "featureMethods.h"
+#include "extractScratch.h"
+#include "featureMatrix.h"
+#include "retrieval.h"
+#include "binaryCodes.h"
+
+// minimum time spent on each benchmark, in seconds
+#define BENCH_MIN_TIME 0.2
+// rows written and read by the csv benchmarks
+#define BENCH_CSV_ROWS 2000
+// rows of the database scanned by the scan benchmarks
+#define BENCH_SCAN_ROWS 20000
+
+
+/*
+  Allocation counter: every C++ heap allocation of the process goes
+  through these operators while the benchmark runs. cv::Mat buffers
+  come from cv::fastMalloc, but OpenCV's default allocator creates the
+  UMatData of each buffer with new, so every Mat allocation counts once.
+ */
+static std::atomic<long long> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) {
+    allocationCount++;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+
+// One measured benchmark
+struct BenchResult {
+    std::string group;
+    std::string name;
+    std::string param;
+    long long iterations;
+    double nsPerOp;
+    double mbPerSec;
+    double allocsPerOp;
+};
+
+// keeps the compiler from dropping the measured work
+static volatile float benchSink = 0;
+
+/*
+  Runs fn until at least minTime seconds have passed, doubling the
+  number of iterations per round. bytesPerOp is the input size of one
+  call, used for the MB/s column.
+ */
+template <typename F>
+BenchResult runBench(const std::string& group, const std::string& name, const std::string& param,
+                     double bytesPerOp, double minTime, F fn) {
+    // warm up caches and lazy initialization
+    benchSink = benchSink + fn();
+
+    long long iterations = 1;
+    double seconds = 0;
+    long long allocations = 0;
+    for (;;) {
+        long long allocStart = allocationCount.load();
+        auto start = std::chrono::steady_clock::now();
+        for (long long i = 0; i < iterations; i++) {
+            benchSink = benchSink + fn();
+        }
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        allocations = allocationCount.load() - allocStart;
+        if (seconds >= minTime || iterations >= (1LL << 30)) break;
+        iterations *= 2;
+    }
+
+    BenchResult result;
+    result.group = group;
+    result.name = name;
+    result.param = param;
+    result.iterations = iterations;
+    result.nsPerOp = seconds * 1e9 / iterations;
+    result.mbPerSec = seconds > 0 ? bytesPerOp * iterations / seconds / 1e6 : 0.0;
+    result.allocsPerOp = static_cast<double>(allocations) / iterations;
+    std::cerr << group << " " << name << " " << param << ": " << result.nsPerOp << " ns/op" << std::endl;
+    return result;
+}
+
+// Synthetic BGR image, smoothed noise so the texture features have something to measure
+static cv::Mat syntheticImage(int cols, int rows) {
+    cv::Mat image(rows, cols, CV_8UC3);
+    cv::randu(image, cv::Scalar(0, 0, 0), cv::Scalar(256, 256, 256));
+    cv::GaussianBlur(image, image, cv::Size(5, 5), 1.5);
+    return image;
+}
+
+// Random feature vector of a given size
+static std::vector<float> syntheticFeature(size_t dim, unsigned seed) {
+    std::vector<float> feature(dim);
+    for (size_t i = 0; i < dim; i++) {
+        seed = seed * 1103515245u + 12345u;
+        feature[i] = ((seed >> 8) & 0xFFFF) / 65536.0f;
+    }
+    return feature;
+}
+
+static void printCsv(FILE* out, const std::vector<BenchResult>& results) {
+    fprintf(out, "group,name,param,iterations,ns_per_op,mb_per_s,allocs_per_op\n");
+    for (const BenchResult& r : results) {
+        fprintf(out, "%s,%s,%s,%lld,%.1f,%.2f,%.2f\n", r.group.c_str(), r.name.c_str(), r.param.c_str(),
+                r.iterations, r.nsPerOp, r.mbPerSec, r.allocsPerOp);
+    }
+}
+
+static void printJson(FILE* out, const std::vector<BenchResult>& results) {
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(out, "    {\"group\": \"%s\", \"name\": \"%s\", \"param\": \"%s\", \"iterations\": %lld, "
+                     "\"ns_per_op\": %.1f, \"mb_per_s\": %.2f, \"allocs_per_op\": %.2f}%s\n",
+                r.group.c_str(), r.name.c_str(), r.param.c_str(), r.iterations, r.nsPerOp, r.mbPerSec,
+                r.allocsPerOp, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+void benchMenu() {
+    printf("Usage: ./cbir_bench [options]\n");
+    printf("options:\n");
+    printf("  --format <csv|json>: output format (default csv)\n");
+    printf("  --out <file>: write the results to a file instead of stdout\n");
+    printf("  --min-time <seconds>: minimum time per benchmark (default %.1f)\n", BENCH_MIN_TIME);
+    printf("  --quick: only the VGA image size\n");
+    printf("  --filter <text>: only run benchmarks whose group or name contains the text\n");
+    printf("  --check-allocations: fail if an extract_scratch benchmark of an allocation-free method allocates\n");
+}
+
+
+int main(int argc, char* argv[]) {
+    std::string format = "csv";
+    std::string outFile;
+    std::string filter;
+    double minTime = BENCH_MIN_TIME;
+    bool quick = false;
+    bool checkAllocations = false;
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--format" && i + 1 < argc) {
+            format = argv[++i];
+        } else if (option == "--out" && i + 1 < argc) {
+            outFile = argv[++i];
+        } else if (option == "--min-time" && i + 1 < argc) {
+            minTime = std::stod(argv[++i]);
+        } else if (option == "--quick") {
+            quick = true;
+        } else if (option == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (option == "--check-allocations") {
+            checkAllocations = true;
+        } else {
+            benchMenu();
+            return EXIT_FAILURE;
+        }
+    }
+    if (format != "csv" && format != "json") {
+        benchMenu();
+        return EXIT_FAILURE;
+    }
+
+    auto selected = [&filter](const std::string& group, const std::string& name) {
+        return filter.empty() || group.find(filter) != std::string::npos || name.find(filter) != std::string::npos;
+    };
+
+    std::vector<BenchResult> results;
+
+    // Extractors on VGA, 12 MP and 24 MP images, the face method needs a cascade file and is left out
+    struct ImageSize { const char* name; int cols; int rows; };
+    std::vector<ImageSize> sizes = {{"vga", 640, 480}, {"12mp", 4000, 3000}, {"24mp", 6000, 4000}};
+    if (quick) {
+        sizes.resize(1);
+    }
+    for (const ImageSize& size : sizes) {
+        cv::Mat image = syntheticImage(size.cols, size.rows);
+        double bytes = static_cast<double>(image.total() * image.elemSize());
+        for (const std::string& method : featureMethodNames()) {
+            if (method == "face" || !selected("extract", method)) continue;
+            results.push_back(runBench("extract", method, size.name, bytes, minTime, [&]() -> float {
+                std::vector<float> feature = extractFeatureByMethod(method, image);
+                return feature.empty() ? 0.0f : feature[0];
+            }));
+        }
+        // the same with one scratch kept over the calls, the steady state of an extraction worker
+        for (const std::string& method : featureMethodNames()) {
+            if (method == "face" || !selected("extract_scratch", method)) continue;
+            ExtractScratch scratch;
+            results.push_back(runBench("extract_scratch", method, size.name, bytes, minTime, [&]() -> float {
+                const std::vector<float>& feature = extractFeatureByMethod(method, image, nullptr, scratch);
+                return feature.empty() ? 0.0f : feature[0];
+            }));
+        }
+    }
+
+    // A catalog of mixed sizes and orientations: each op extracts a VGA landscape and then a 12 MP portrait
+    // image with one scratch. The warm-up op grows the buffers, the measured ones must reuse them
+    {
+        cv::Mat landscape = syntheticImage(640, 480);
+        cv::Mat portrait = syntheticImage(3000, 4000);
+        double bytes = static_cast<double>(landscape.total() * landscape.elemSize() + portrait.total() * portrait.elemSize());
+        for (const std::string& method : featureMethodNames()) {
+            if (method == "face" || !selected("extract_scratch", method)) continue;
+            ExtractScratch scratch;
+            results.push_back(runBench("extract_scratch", method, "mixed", bytes, minTime, [&]() -> float {
+                float first = extractFeatureByMethod(method, landscape, nullptr, scratch)[0];
+                return first + extractFeatureByMethod(method, portrait, nullptr, scratch)[0];
+            }));
+        }
+    }
+
+    // Distance kernels at the dimensions of the real features
+    struct Kernel { const char* name; size_t dim; };
+    std::vector<Kernel> kernels = {
+        {"ssd", 147},           // b
+        {"intersection", 256},  // h2
+        {"intersection", 512},  // h3
+        {"combined", 1024},     // m
+        {"ssd", 5},             // glcm
+        {"ssd", 25},            // l
+        {"ssd", 24},            // gabor
+        {"cosine", 512},        // ResNet18 embeddings
+    };
+    for (const Kernel& kernel : kernels) {
+        std::string name = kernel.name;
+        if (!selected("distance", name)) continue;
+        std::vector<float> a = syntheticFeature(kernel.dim, 1);
+        std::vector<float> b = syntheticFeature(kernel.dim, 2);
+        double bytes = 2.0 * kernel.dim * sizeof(float);
+        results.push_back(runBench("distance", name, std::to_string(kernel.dim), bytes, minTime, [&]() -> float {
+            if (name == "ssd") return computeSSD(a, b);
+            if (name == "intersection") return computeHistogramIntersection(a, b);
+            if (name == "combined") return combinedHistogramIntersection(a, b, kernel.dim / 2);
+            return calculateCosineSimilarity(a, b);
+        }));
+    }
+
+    // Full scan of a 512-d database, one heap block per row against the contiguous FeatureMatrix
+    if (selected("scan", "rows") || selected("scan", "matrix") || selected("scan", "cosine") || selected("scan", "gemv")
+        || selected("scan", "hamming")) {
+        std::vector<std::vector<float>> rows;
+        FeatureMatrix matrix;
+        for (int i = 0; i < BENCH_SCAN_ROWS; i++) {
+            rows.push_back(syntheticFeature(512, i + 1));
+            matrix.appendRow(rows.back());
+        }
+        std::vector<float> target = syntheticFeature(512, 0);
+        std::string param = std::to_string(BENCH_SCAN_ROWS) + "x512";
+        double bytes = static_cast<double>(BENCH_SCAN_ROWS) * 512 * sizeof(float);
+        if (selected("scan", "rows")) {
+            results.push_back(runBench("scan", "rows", param, bytes, minTime, [&]() -> float {
+                float best = 0;
+                for (size_t i = 0; i < rows.size(); i++) {
+                    best += computeSSD(target.data(), rows[i].data(), 512);
+                }
+                return best;
+            }));
+        }
+        if (selected("scan", "matrix")) {
+            results.push_back(runBench("scan", "matrix", param, bytes, minTime, [&]() -> float {
+                float best = 0;
+                for (size_t i = 0; i < matrix.rows(); i++) {
+                    best += computeSSD(target.data(), matrix.row(i), 512);
+                }
+                return best;
+            }));
+        }
+        // dnn_embedding scoring: cosine recomputing both norms per row, against unit rows and one GEMV
+        if (selected("scan", "cosine")) {
+            results.push_back(runBench("scan", "cosine", param, bytes, minTime, [&]() -> float {
+                float best = 0;
+                for (size_t i = 0; i < matrix.rows(); i++) {
+                    best += calculateCosineSimilarity(target.data(), matrix.row(i), 512);
+                }
+                return best;
+            }));
+        }
+        if (selected("scan", "gemv")) {
+            FeatureMatrix unit;
+            for (size_t i = 0; i < matrix.rows(); i++) {
+                unit.appendRow(matrix.row(i), matrix.cols());
+            }
+            unit.normalizeRows();
+            std::vector<float> scores(unit.rows());
+            results.push_back(runBench("scan", "gemv", param, bytes, minTime, [&]() -> float {
+                matrixVectorDot(unit, target.data(), scores.data());
+                return scores[0];
+            }));
+        }
+        // the same database as 256-bit SimHash signatures, a Hamming top 100 shortlist
+        if (selected("scan", "hamming")) {
+            BinaryCodes codes;
+            codes.build(matrix, BINARY_SIMHASH, BINARY_CODE_BITS);
+            std::vector<uint64_t> code = codes.encode(target);
+            double codeBytes = static_cast<double>(codes.bytes());
+            results.push_back(runBench("scan", "hamming", std::to_string(BENCH_SCAN_ROWS) + "x" + std::to_string(BINARY_CODE_BITS) + "b",
+                                       codeBytes, minTime, [&]() -> float {
+                return static_cast<float>(codes.hammingTopRows(code, 100)[0].first);
+            }));
+        }
+    }
+
+    // Top 4 of a 147-d baseline database: every SSD summed in full, then abandoned early, then on variance ordered columns
+    if (selected("scan", "ssd_full") || selected("scan", "ssd_abandon") || selected("scan", "ssd_variance")) {
+        FeatureMatrix baseline, ordered;
+        for (int i = 0; i < BENCH_SCAN_ROWS; i++) {
+            std::vector<float> row = syntheticFeature(147, i + 1);
+            baseline.appendRow(row);
+            ordered.appendRow(row);
+        }
+        ordered.orderColumnsByVariance();
+        std::vector<float> target = syntheticFeature(147, 0);
+        std::string param = std::to_string(BENCH_SCAN_ROWS) + "x147";
+        double bytes = static_cast<double>(BENCH_SCAN_ROWS) * 147 * sizeof(float);
+        if (selected("scan", "ssd_full")) {
+            results.push_back(runBench("scan", "ssd_full", param, bytes, minTime, [&]() -> float {
+                return rankRows("b", target, baseline)[0].first;
+            }));
+        }
+        if (selected("scan", "ssd_abandon")) {
+            results.push_back(runBench("scan", "ssd_abandon", param, bytes, minTime, [&]() -> float {
+                return rankTopRows("b", target, baseline, 4)[0].first;
+            }));
+        }
+        if (selected("scan", "ssd_variance")) {
+            results.push_back(runBench("scan", "ssd_variance", param, bytes, minTime, [&]() -> float {
+                return rankTopRows("b", target, ordered, 4)[0].first;
+            }));
+        }
+    }
+
+    // CSV write and read of a 512-d feature file
+    if (selected("csv", "write") || selected("csv", "read")) {
+        std::string csvPath = "cbir_bench_tmp.csv";
+        std::vector<std::vector<float>> rows;
+        for (int i = 0; i < BENCH_CSV_ROWS; i++) {
+            rows.push_back(syntheticFeature(512, i + 1));
+        }
+        auto writeFile = [&]() -> float {
+            FILE* fp = fopen(csvPath.c_str(), "w");
+            if (!fp) return 0.0f;
+            char name[64];
+            for (size_t i = 0; i < rows.size(); i++) {
+                snprintf(name, sizeof(name), "pic.%04zu.jpg", i);
+                write_image_data_csv_row(fp, name, rows[i]);
+            }
+            fclose(fp);
+            return 1.0f;
+        };
+        writeFile();
+        std::ifstream sizeProbe(csvPath, std::ios::binary | std::ios::ate);
+        double fileBytes = static_cast<double>(sizeProbe.tellg());
+        sizeProbe.close();
+
+        if (selected("csv", "write")) {
+            results.push_back(runBench("csv", "write", "2000x512", fileBytes, minTime, writeFile));
+        }
+        if (selected("csv", "read")) {
+            results.push_back(runBench("csv", "read", "2000x512", fileBytes, minTime, [&]() -> float {
+                FilenameArena filenames;
+                FeatureMatrix data;
+                read_image_data_csv(const_cast<char*>(csvPath.c_str()), filenames, data, false);
+                return data.empty() ? 0.0f : data.row(0)[0];
+            }));
+        }
+        std::remove(csvPath.c_str());
+    }
+
+    FILE* out = stdout;
+    if (!outFile.empty()) {
+        out = fopen(outFile.c_str(), "w");
+        if (!out) {
+            std::cerr << "Error: cannot open " << outFile << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (format == "json") {
+        printJson(out, results);
+    } else {
+        printCsv(out, results);
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (checkAllocations) {
+        int failures = 0;
+        for (const BenchResult& r : results) {
+            if (r.group == "extract_scratch" && extractsWithoutAllocation(r.name) && r.allocsPerOp > 0) {
+                std::cerr << "Error: " << r.name << " " << r.param << " allocates " << r.allocsPerOp
+                          << " times per image with a scratch" << std::endl;
+                failures++;
+            }
+        }
+        if (failures > 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,631 @@
+/**
+ * @file cbir_eval.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief retrieval quality vs. speed, compares engine configurations against exact brute-force retrieval
+ * @version 0.1
+ * @date 2024-02-23
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "csv_util.h"
+#include "featureMatrix.h"
+#include "featureMethods.h"
+#include "histogramPyramid.h"
+#include "imageIO.h"
+#include "retrieval.h"
+#include "vpTree.h"
+#include "binaryCodes.h"
+
+// queries drawn from the database
+#define EVAL_QUERIES 100
+// depth of the rankings compared against the ground truth
+#define EVAL_TOP_K 10
+
+
+void evalMenu() {
+    printf("Usage: ./cbir_eval <method|all> (--images <dir> | --csv <file>) [options]\n");
+    printf("method: a matching method (b, h2, h3, m, tc, glcm, l, gabor, custom_s, custom_m, custom_l) or dnn,\n");
+    printf("        all runs every matching method on --images\n");
+    printf("options:\n");
+    printf("  --images <dir>: extract the database from a directory of images, queries are extracted like matching\n");
+    printf("  --csv <file>: use an existing feature file (e.g. the ResNet18 embeddings), queries are looked up by row\n");
+    printf("  --engine <spec>: configuration compared against exact retrieval, can be repeated\n");
+    printf("                   decode:<full|auto|2|4|8|max:N>  reduced decode for the database and the query (--images)\n");
+    printf("                   quant8                          database stored as 8 bit codes, one scale per row\n");
+    printf("                   topk, topk:variance             top k scan, early-abandoned SSD, variance ordered dimensions\n");
+    printf("                   pyramid                         coarse-to-fine histogram intersection scan (h3, m, custom)\n");
+    printf("                   vptree                          vantage-point tree index, SSD methods (b, glcm, l, gabor)\n");
+    printf("                   binary:<M>                      Hamming shortlist of M binary signatures, exact rerank\n");
+    printf("  --queries <n>: number of queries (default %d)\n", EVAL_QUERIES);
+    printf("  --k <n>: ranking depth for recall and rank correlation (default %d)\n", EVAL_TOP_K);
+    printf("  --format <text|json>: report format (default text)\n");
+}
+
+static double elapsedMs(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The database every configuration is measured on
+struct EvalCorpus {
+    std::string method;
+    std::string imageDir;                        // empty when the corpus comes from a feature file
+    std::vector<std::string> names;
+    FeatureMatrix features;                      // exact features, the ground truth database
+};
+
+// The first k rows of a ranking, the query row itself left out
+static std::vector<int> topRows(const std::vector<std::pair<float, int>>& ranked, size_t queryRow, int k) {
+    std::vector<int> rows;
+    for (size_t i = 0; i < ranked.size() && static_cast<int>(rows.size()) < k; i++) {
+        if (ranked[i].second != static_cast<int>(queryRow)) {
+            rows.push_back(ranked[i].second);
+        }
+    }
+    return rows;
+}
+
+// Target feature of a query: extracted from its image like matching, or its own row like dnn_embedding
+static std::vector<float> queryFeature(const EvalCorpus& corpus, size_t row, const DecodePolicy& policy) {
+    if (corpus.imageDir.empty()) {
+        return corpus.features.rowVector(row);
+    }
+    cv::Mat image = readImage(corpus.imageDir + "/" + corpus.names[row], policy);
+    return extractFeatureByMethod(corpus.method, image);
+}
+
+/*
+  One retrieval configuration under test. build() prepares its own
+  database from the corpus, query() returns the best k rows for the
+  target feature of a query row, best first and without the query row
+  itself. The target is extracted with queryPolicy() before the timing
+  starts, so query() only ranks. New engines (indexes, pruned scans,
+  compressed stores) are added to makeEngine().
+ */
+class EvalEngine {
+public:
+    virtual ~EvalEngine() {}
+    virtual std::string name() const = 0;
+    // returns non-zero if the configuration cannot run on this corpus
+    virtual int build(const EvalCorpus& corpus) = 0;
+    virtual std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) = 0;
+    // decode the query images are extracted with
+    virtual DecodePolicy queryPolicy() const { return fullDecodePolicy(); }
+    // bytes held by the engine's database
+    virtual size_t databaseBytes(const EvalCorpus& corpus) const = 0;
+};
+
+// Brute-force scan of the exact features, the ground truth
+class ExactEngine : public EvalEngine {
+public:
+    std::string name() const { return "exact"; }
+    int build(const EvalCorpus&) { return 0; }
+    std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) {
+        return topRows(rankRows(corpus.method, target, corpus.features), row, k);
+    }
+    size_t databaseBytes(const EvalCorpus& corpus) const {
+        return corpus.features.rows() * corpus.features.cols() * sizeof(float);
+    }
+};
+
+// Database and queries extracted from reduced-resolution decodes
+class DecodeEngine : public EvalEngine {
+public:
+    explicit DecodeEngine(const std::string& spec) : spec_(spec) {}
+    std::string name() const { return "decode:" + spec_; }
+    int build(const EvalCorpus& corpus) {
+        if (corpus.imageDir.empty()) {
+            std::cerr << name() << " needs --images" << std::endl;
+            return -1;
+        }
+        if (parseDecodePolicy(spec_, corpus.method, policy_) != 0) {
+            std::cerr << "Invalid decode policy " << spec_ << std::endl;
+            return -1;
+        }
+        features_.clear();
+        for (size_t r = 0; r < corpus.names.size(); r++) {
+            if (features_.appendRow(queryFeature(corpus, r, policy_)) != 0) {
+                std::cerr << name() << " gave features of different lengths" << std::endl;
+                return -1;
+            }
+        }
+        return 0;
+    }
+    std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) {
+        return topRows(rankRows(corpus.method, target, features_), row, k);
+    }
+    DecodePolicy queryPolicy() const { return policy_; }
+    size_t databaseBytes(const EvalCorpus&) const {
+        return features_.rows() * features_.cols() * sizeof(float);
+    }
+
+private:
+    std::string spec_;
+    DecodePolicy policy_;
+    FeatureMatrix features_;
+};
+
+// Exact features stored as 8 bit codes with a per-row offset and scale, decoded during the scan
+class Quant8Engine : public EvalEngine {
+public:
+    Quant8Engine() : dim_(0) {}
+    std::string name() const { return "quant8"; }
+    int build(const EvalCorpus& corpus) {
+        dim_ = corpus.features.cols();
+        codes_.assign(corpus.features.rows() * dim_, 0);
+        offsets_.assign(corpus.features.rows(), 0.0f);
+        scales_.assign(corpus.features.rows(), 0.0f);
+        for (size_t r = 0; r < corpus.features.rows(); r++) {
+            const float* feature = corpus.features.row(r);
+            float lo = *std::min_element(feature, feature + dim_);
+            float hi = *std::max_element(feature, feature + dim_);
+            float scale = hi > lo ? (hi - lo) / 255.0f : 0.0f;
+            offsets_[r] = lo;
+            scales_[r] = scale;
+            for (size_t i = 0; i < dim_; i++) {
+                codes_[r * dim_ + i] = scale > 0 ? static_cast<uchar>(std::lround((feature[i] - lo) / scale)) : 0;
+            }
+        }
+        return 0;
+    }
+    std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) {
+        std::vector<float> decoded(dim_);
+        std::vector<std::pair<float, int>> ranked;
+        ranked.reserve(scales_.size());
+        for (size_t r = 0; r < scales_.size(); r++) {
+            const uchar* code = &codes_[r * dim_];
+            for (size_t i = 0; i < dim_; i++) {
+                decoded[i] = offsets_[r] + scales_[r] * code[i];
+            }
+            ranked.emplace_back(scoreByMethod(corpus.method, target, decoded), static_cast<int>(r));
+        }
+        if (isSimilarityMethod(corpus.method)) {
+            std::sort(ranked.begin(), ranked.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+                return a.first > b.first || (a.first == b.first && a.second < b.second);
+            });
+        } else {
+            std::sort(ranked.begin(), ranked.end());
+        }
+        return topRows(ranked, row, k);
+    }
+    size_t databaseBytes(const EvalCorpus&) const {
+        return codes_.size() + (offsets_.size() + scales_.size()) * sizeof(float);
+    }
+
+private:
+    size_t dim_;
+    std::vector<uchar> codes_;
+    std::vector<float> offsets_;
+    std::vector<float> scales_;
+};
+
+// Only the top k through rankTopRows, early-abandoned SSD, optionally on variance ordered columns
+class TopKEngine : public EvalEngine {
+public:
+    explicit TopKEngine(bool varianceOrder) : varianceOrder_(varianceOrder) {}
+    std::string name() const { return varianceOrder_ ? "topk:variance" : "topk"; }
+    int build(const EvalCorpus& corpus) {
+        features_.clear();
+        for (size_t r = 0; r < corpus.features.rows(); r++) {
+            features_.appendRow(corpus.features.rowVector(r));
+        }
+        if (corpus.features.unitRows()) {
+            features_.normalizeRows();
+        }
+        if (varianceOrder_ && isSSDMethod(corpus.method)) {
+            features_.orderColumnsByVariance();
+        }
+        return 0;
+    }
+    std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) {
+        return topRows(rankTopRows(corpus.method, target, features_, k + 1), row, k);
+    }
+    size_t databaseBytes(const EvalCorpus&) const {
+        return features_.rows() * features_.cols() * sizeof(float);
+    }
+
+private:
+    bool varianceOrder_;
+    FeatureMatrix features_;
+};
+
+// Exact top k of the intersection methods from the coarse histogram levels down
+class PyramidEngine : public EvalEngine {
+public:
+    std::string name() const { return "pyramid"; }
+    int build(const EvalCorpus& corpus) {
+        if (pyramid_.build(corpus.method, corpus.features) != 0) {
+            std::cerr << "pyramid needs h3, m or a custom method" << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) {
+        return topRows(pyramid_.topRows(target, corpus.features, k + 1), row, k);
+    }
+    size_t databaseBytes(const EvalCorpus& corpus) const {
+        return corpus.features.rows() * corpus.features.cols() * sizeof(float) + pyramid_.bytes();
+    }
+
+private:
+    HistogramPyramid pyramid_;
+};
+
+// Exact top k of the SSD methods from a vantage-point tree, reports the share of distances computed
+class VpTreeEngine : public EvalEngine {
+public:
+    VpTreeEngine() : rows_(0), distances_(0) {}
+    ~VpTreeEngine() {
+        if (rows_ > 0) {
+            fprintf(stderr, "vptree: %.1f%% of the distances computed\n", 100.0 * distances_ / rows_);
+        }
+    }
+    std::string name() const { return "vptree"; }
+    int build(const EvalCorpus& corpus) {
+        if (!isSSDMethod(corpus.method)) {
+            std::cerr << "vptree needs an SSD method" << std::endl;
+            return -1;
+        }
+        return tree_.build(corpus.features);
+    }
+    std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) {
+        VpTreeStats stats;
+        std::vector<int> result = topRows(tree_.topRows(target, corpus.features, k + 1, &stats), row, k);
+        rows_ += stats.rows;
+        distances_ += stats.distances;
+        return result;
+    }
+    size_t databaseBytes(const EvalCorpus& corpus) const {
+        return corpus.features.rows() * corpus.features.cols() * sizeof(float) + tree_.bytes();
+    }
+
+private:
+    VpTree tree_;
+    size_t rows_;
+    size_t distances_;
+};
+
+// Hamming shortlist of binary signatures, then the method's metric on the shortlist only
+class BinaryEngine : public EvalEngine {
+public:
+    explicit BinaryEngine(const std::string& spec) : spec_(spec), shortlist_(0) {}
+    std::string name() const { return "binary:" + spec_; }
+    int build(const EvalCorpus& corpus) {
+        shortlist_ = std::strtoul(spec_.c_str(), nullptr, 10);
+        if (shortlist_ == 0) {
+            std::cerr << "Invalid shortlist size " << spec_ << std::endl;
+            return -1;
+        }
+        return codes_.build(corpus.features, BinaryCodes::kindForMethod(corpus.method));
+    }
+    std::vector<int> query(const EvalCorpus& corpus, size_t row, const std::vector<float>& target, int k) {
+        std::vector<int> candidates = codes_.candidateRows(target, std::max<size_t>(shortlist_, k + 1));
+        return topRows(rankCandidateRows(corpus.method, target, corpus.features, candidates, k + 1), row, k);
+    }
+    // the rerank reads the float rows, so both stores count
+    size_t databaseBytes(const EvalCorpus& corpus) const {
+        return corpus.features.rows() * corpus.features.cols() * sizeof(float) + codes_.bytes();
+    }
+
+private:
+    std::string spec_;
+    size_t shortlist_;
+    BinaryCodes codes_;
+};
+
+// Engine for a --engine spec, nullptr if the spec is unknown
+static std::unique_ptr<EvalEngine> makeEngine(const std::string& spec) {
+    if (spec == "exact") {
+        return std::unique_ptr<EvalEngine>(new ExactEngine());
+    } else if (spec.compare(0, 7, "decode:") == 0) {
+        return std::unique_ptr<EvalEngine>(new DecodeEngine(spec.substr(7)));
+    } else if (spec == "topk") {
+        return std::unique_ptr<EvalEngine>(new TopKEngine(false));
+    } else if (spec == "topk:variance") {
+        return std::unique_ptr<EvalEngine>(new TopKEngine(true));
+    } else if (spec == "pyramid") {
+        return std::unique_ptr<EvalEngine>(new PyramidEngine());
+    } else if (spec.compare(0, 7, "binary:") == 0) {
+        return std::unique_ptr<EvalEngine>(new BinaryEngine(spec.substr(7)));
+    } else if (spec == "vptree") {
+        return std::unique_ptr<EvalEngine>(new VpTreeEngine());
+    } else if (spec == "quant8") {
+        return std::unique_ptr<EvalEngine>(new Quant8Engine());
+    }
+    return std::unique_ptr<EvalEngine>();
+}
+
+// Fraction of the true top k found in the engine's top k
+static double recallAtK(const std::vector<int>& truth, const std::vector<int>& result, size_t k) {
+    k = std::min(k, truth.size());
+    if (k == 0) return 1.0;
+    size_t found = 0;
+    for (size_t i = 0; i < k; i++) {
+        for (size_t j = 0; j < std::min(k, result.size()); j++) {
+            if (result[j] == truth[i]) {
+                found++;
+                break;
+            }
+        }
+    }
+    return static_cast<double>(found) / k;
+}
+
+/*
+  Spearman rank correlation between the true top k and the positions
+  the engine gives those rows. Rows the engine did not return share
+  the position just past its list.
+ */
+static double rankCorrelation(const std::vector<int>& truth, const std::vector<int>& result) {
+    size_t n = truth.size();
+    if (n < 2) return 1.0;
+    std::vector<double> position(n);
+    for (size_t i = 0; i < n; i++) {
+        position[i] = static_cast<double>(result.size());
+        for (size_t j = 0; j < result.size(); j++) {
+            if (result[j] == truth[i]) {
+                position[i] = static_cast<double>(j);
+                break;
+            }
+        }
+    }
+    // Pearson correlation of the true ranks 0..n-1 with the engine positions
+    double meanTruth = (n - 1) / 2.0, meanPosition = 0;
+    for (double p : position) meanPosition += p;
+    meanPosition /= n;
+    double cov = 0, varTruth = 0, varPosition = 0;
+    for (size_t i = 0; i < n; i++) {
+        double dt = i - meanTruth, dp = position[i] - meanPosition;
+        cov += dt * dp;
+        varTruth += dt * dt;
+        varPosition += dp * dp;
+    }
+    if (varPosition == 0) return 0.0;
+    return cov / std::sqrt(varTruth * varPosition);
+}
+
+// One row of the report
+struct EvalRow {
+    std::string method;
+    std::string engine;
+    double recall1;
+    double recallK;
+    double rankCorr;
+    double buildMs;
+    double extractMs;                            // query decode and extraction, not part of queryMs
+    double queryMs;
+    double speedup;
+    double databaseMb;
+};
+
+// Build, query and score every engine on one method, the exact engine first
+static int evaluateMethod(EvalCorpus& corpus, const std::vector<std::string>& engineSpecs, size_t queries, int k,
+                          double exactBuildMs, std::vector<EvalRow>& report) {
+    size_t rows = corpus.names.size();
+    queries = std::min(queries, rows);
+    std::vector<size_t> queryRows;
+    for (size_t q = 0; q < queries; q++) {
+        queryRows.push_back(q * rows / queries);
+    }
+
+    // query targets and their mean extraction time, once per decode policy
+    std::map<std::string, std::vector<std::vector<float>>> targets;
+    std::map<std::string, double> extractMs;
+
+    std::vector<std::vector<int>> truth;
+    double exactQueryMs = 0;
+    for (size_t e = 0; e < engineSpecs.size(); e++) {
+        std::unique_ptr<EvalEngine> engine = makeEngine(engineSpecs[e]);
+        auto start = std::chrono::steady_clock::now();
+        if (engine->build(corpus) != 0) {
+            continue;
+        }
+        double buildMs = e == 0 ? exactBuildMs : elapsedMs(start);
+
+        DecodePolicy policy = engine->queryPolicy();
+        std::string policyName = corpus.imageDir.empty() ? "rows" : describeDecodePolicy(policy);
+        if (targets.find(policyName) == targets.end()) {
+            std::vector<std::vector<float>>& policyTargets = targets[policyName];
+            start = std::chrono::steady_clock::now();
+            for (size_t q = 0; q < queryRows.size(); q++) {
+                policyTargets.push_back(queryFeature(corpus, queryRows[q], policy));
+            }
+            extractMs[policyName] = elapsedMs(start) / queryRows.size();
+        }
+        const std::vector<std::vector<float>>& queryTargets = targets[policyName];
+
+        EvalRow row;
+        row.method = corpus.method;
+        row.engine = engine->name();
+        row.buildMs = buildMs;
+        row.databaseMb = engine->databaseBytes(corpus) / (1024.0 * 1024.0);
+        row.recall1 = row.recallK = row.rankCorr = 0;
+        row.extractMs = extractMs[policyName];
+        double queryMs = 0;
+        for (size_t q = 0; q < queryRows.size(); q++) {
+            start = std::chrono::steady_clock::now();
+            std::vector<int> result = engine->query(corpus, queryRows[q], queryTargets[q], k);
+            queryMs += elapsedMs(start);
+            if (e == 0) {
+                truth.push_back(result);
+            }
+            row.recall1 += recallAtK(truth[q], result, 1);
+            row.recallK += recallAtK(truth[q], result, k);
+            row.rankCorr += rankCorrelation(truth[q], result);
+        }
+        row.recall1 /= queryRows.size();
+        row.recallK /= queryRows.size();
+        row.rankCorr /= queryRows.size();
+        row.queryMs = queryMs / queryRows.size();
+        if (e == 0) {
+            exactQueryMs = row.queryMs;
+        }
+        row.speedup = row.queryMs > 0 ? exactQueryMs / row.queryMs : 0.0;
+        report.push_back(row);
+    }
+    return 0;
+}
+
+// Exact features of every method for the images of a directory, each image decoded once
+static int buildImageCorpora(const std::string& imageDir, std::vector<EvalCorpus>& corpora, std::vector<double>& buildMs) {
+    std::vector<std::string> files;
+    if (listImageFiles(imageDir, files) != 0) {
+        std::cerr << "Error: cannot open directory " << imageDir << std::endl;
+        return -1;
+    }
+    buildMs.assign(corpora.size(), 0.0);
+    for (const std::string& file_name : files) {
+        auto start = std::chrono::steady_clock::now();
+        cv::Mat img = readImage(imageDir + "/" + file_name, fullDecodePolicy());
+        double decodeMs = elapsedMs(start);
+        if (img.empty()) continue;
+        for (size_t m = 0; m < corpora.size(); m++) {
+            start = std::chrono::steady_clock::now();
+            corpora[m].names.push_back(file_name);
+            if (corpora[m].features.appendRow(extractFeatureByMethod(corpora[m].method, img)) != 0) {
+                std::cerr << "Error: " << corpora[m].method << " gave features of different lengths" << std::endl;
+                return -1;
+            }
+            buildMs[m] += decodeMs + elapsedMs(start);
+        }
+    }
+    return 0;
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        evalMenu();
+        return EXIT_FAILURE;
+    }
+    std::string method = argv[1];
+    if (method != "all" && !isMatchingMethod(method)) {
+        std::cerr << "Error: invalid method" << std::endl;
+        evalMenu();
+        return EXIT_FAILURE;
+    }
+
+    std::string imageDir, csvInput, format = "text";
+    std::vector<std::string> engineSpecs(1, "exact");
+    size_t queries = EVAL_QUERIES;
+    int k = EVAL_TOP_K;
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--images" && i + 1 < argc) {
+            imageDir = argv[++i];
+        } else if (option == "--csv" && i + 1 < argc) {
+            csvInput = argv[++i];
+        } else if (option == "--engine" && i + 1 < argc) {
+            engineSpecs.push_back(argv[++i]);
+            if (!makeEngine(engineSpecs.back())) {
+                std::cerr << "Error: unknown engine " << engineSpecs.back() << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (option == "--queries" && i + 1 < argc) {
+            queries = std::stoul(argv[++i]);
+        } else if (option == "--k" && i + 1 < argc) {
+            k = std::stoi(argv[++i]);
+        } else if (option == "--format" && i + 1 < argc) {
+            format = argv[++i];
+        } else {
+            std::cerr << "Error: invalid option " << option << std::endl;
+            evalMenu();
+            return EXIT_FAILURE;
+        }
+    }
+    if (imageDir.empty() == csvInput.empty() || queries < 1 || k < 1 || (format != "text" && format != "json")) {
+        evalMenu();
+        return EXIT_FAILURE;
+    }
+    if (!imageDir.empty() && method == "dnn") {
+        std::cerr << "Error: dnn embeddings cannot be extracted from images, use --csv" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!csvInput.empty() && method == "all") {
+        std::cerr << "Error: a feature file holds one method, name it" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // without a configuration to compare, show what reduced decode and 8 bit storage cost
+    if (engineSpecs.size() == 1) {
+        if (!imageDir.empty()) {
+            engineSpecs.push_back("decode:2");
+            engineSpecs.push_back("decode:4");
+        }
+        engineSpecs.push_back("quant8");
+    }
+
+    // Ground truth databases
+    std::vector<EvalCorpus> corpora;
+    std::vector<double> buildMs;
+    if (!imageDir.empty()) {
+        for (const std::string& name : featureMethodNames()) {
+            if ((method == "all" && isMatchingMethod(name)) || name == method) {
+                EvalCorpus corpus;
+                corpus.method = name;
+                corpus.imageDir = imageDir;
+                corpora.push_back(std::move(corpus));
+            }
+        }
+        if (buildImageCorpora(imageDir, corpora, buildMs) != 0) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        EvalCorpus corpus;
+        corpus.method = method;
+        FilenameArena filenames;
+        auto start = std::chrono::steady_clock::now();
+        if (read_image_data_csv(const_cast<char*>(csvInput.c_str()), filenames, corpus.features, false) != 0) {
+            std::cerr << "Error: cannot read " << csvInput << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (method == "dnn") {
+            corpus.features.normalizeRows();  // like dnn_embedding, cosine is then a dot product
+        }
+        buildMs.push_back(elapsedMs(start));
+        for (size_t i = 0; i < filenames.size(); i++) {
+            corpus.names.push_back(filenames.str(i));
+        }
+        corpora.push_back(std::move(corpus));
+    }
+
+    std::vector<EvalRow> report;
+    for (size_t m = 0; m < corpora.size(); m++) {
+        if (corpora[m].names.size() < 2) {
+            std::cerr << "Error: not enough rows for " << corpora[m].method << std::endl;
+            return EXIT_FAILURE;
+        }
+        evaluateMethod(corpora[m], engineSpecs, queries, k, buildMs[m], report);
+    }
+
+    if (format == "json") {
+        printf("[\n");
+        for (size_t i = 0; i < report.size(); i++) {
+            const EvalRow& r = report[i];
+            printf("  {\"method\": \"%s\", \"engine\": \"%s\", \"recall_at_1\": %.4f, \"recall_at_%d\": %.4f, "
+                   "\"rank_corr\": %.4f, \"build_ms\": %.1f, \"extract_ms\": %.3f, \"query_ms\": %.3f, \"speedup\": %.2f, \"db_mb\": %.2f}%s\n",
+                   r.method.c_str(), r.engine.c_str(), r.recall1, k, r.recallK, r.rankCorr, r.buildMs, r.extractMs,
+                   r.queryMs, r.speedup, r.databaseMb, i + 1 < report.size() ? "," : "");
+        }
+        printf("]\n");
+    } else {
+        printf("%-10s %-14s %9s %9s %9s %11s %10s %10s %8s %8s\n", "method", "engine", "recall@1", "recall@k",
+               "rank corr", "build ms", "extract ms", "query ms", "speedup", "db MB");
+        for (const EvalRow& r : report) {
+            printf("%-10s %-14s %9.3f %9.3f %9.3f %11.1f %10.3f %10.3f %7.2fx %8.2f\n", r.method.c_str(),
+                   r.engine.c_str(), r.recall1, r.recallK, r.rankCorr, r.buildMs, r.extractMs, r.queryMs, r.speedup,
+                   r.databaseMb);
+        }
+        printf("k = %d, %zu queries per method, ground truth is the exact engine, query ms is the ranking alone\n", k,
+               std::min(queries, corpora[0].names.size()));
+    }
+    return 0;
+}
@@ -13,14 +13,26 @@
 #include <dirent.h>
 #include <algorithm>
 #include <fstream>
+#include <functional>
+#include <sstream>
 #include <opencv2/opencv.hpp>
 #include "matchings.h"
 #include "csv_util.h"
+#include "featureMethods.h"
+#include "retrieval.h"
+#include "histogramPyramid.h"
+#include "vpTree.h"
+#include "filenameIndex.h"
+#include "binaryCodes.h"
+#include "shardedStore.h"
+#include "queryCache.h"
+#include <thread>
+#include "profiler.h"
 
 
 // matchingMenu for the user
 void matchingMenu(){
-    printf("Usage: ./matching <method> <path/target_image_name> <Top N>\n");
+    printf("Usage: ./matching <method> <path/target_image_name> <Top N> [options]\n");
     printf("method:\n");
     printf("  b: use the Baseline method to matching\n");
     printf("  h2: use the RG 2D Histogram method to matching\n");
@@ -33,10 +45,190 @@ void matchingMenu(){
     printf("  custom_s: use the custom_s method to matching the small object\n");
     printf("  custom_m: use the custom_m method to matching the medium object\n");
     printf("  custom_l: use the custom_l method to matching the large object\n");
+    printf("options:\n");
+    printf("  --variance-order: SSD methods sum the high variance dimensions first, so more rows are abandoned early\n");
+    printf("  --pyramid: h3, m and custom methods score coarse histograms first and only refine the rows that can still make the Top N,\n");
+    printf("             the coarse levels are saved to <csv file>.pyramid and reused while the CSV is unchanged\n");
+    printf("  --vptree <index file>: SSD methods search a vantage-point tree, loaded from the file or built and saved there\n");
+    printf("  --range <d>: with --vptree, print every image with SSD <= d instead of the Top N\n");
+    printf("  --cascade <method>:<M>: shortlist the M best images with a cheaper method first, can be repeated,\n");
+    printf("                          each stage reranks the previous shortlist, <method> reranks the last one\n");
+    printf("                          e.g. ./matching tc target.jpg 5 --cascade h2:200\n");
+    printf("  --fuse <method>:<weight>: add another method's features to the score, can be repeated, <method> has weight 1\n");
+    printf("                          dnn looks the target up by file name in the ResNet18 CSV\n");
+    printf("                          e.g. ./matching h3 target.jpg 5 --fuse l:0.5 --fuse dnn:2\n");
+    printf("  --binary <M>: shortlist the M nearest binary signatures by Hamming distance, then rank them exactly\n");
+    printf("  --codes <file>: with --binary, load the signatures from the file, or build them and save them there\n");
+    printf("  --shards <K>: query the K shards of the CSV (made with ./shard) in parallel threads and merge their Top N\n");
+    printf("  --cache <dir>: reuse the target's features and the matches of an identical earlier query, kept in <dir>\n");
+}
+
+// Features of the target for a method, returns non-zero if the target cannot be read
+typedef std::function<int(const std::string&, std::vector<float>&)> TargetExtractor;
+
+// Prints the matches of a query, the header line first
+static void printMatches(const CachedResults& results) {
+    std::cout << results.header << std::endl;
+    for (const std::pair<std::string, float>& match : results.matches) {
+        std::cout << match.first << " with similarity: " << match.second << std::endl;
+    }
+}
+
+// One shortlist stage of a cascade query
+struct CascadeStage {
+    std::string method;
+    size_t keep;
+};
+
+// Feature CSV written by extractFeature for a method, the ResNet18 embeddings for dnn
+static std::string featureCsvPath(const std::string& method) {
+    if (method == "dnn") {
+        return "/Users/jeff/Desktop/Project2_YZ/olympus/ResNet18_olym.csv";
+    }
+    return "/Users/jeff/Desktop/Project2_YZ/bin/image_features_" + methodCsvName(method) + ".csv";
+}
+
+// One extra store of a fusion query
+struct FusionStage {
+    std::string method;
+    float weight;
+};
+
+/*
+  Fusion query: the stores of the extra methods are loaded and aligned
+  with the query's CSV by filename, then every image is ranked by the
+  weighted sum of the normalized scores of all the methods in one pass
+  (see fuseTopRows). The target is extracted with each method, or for
+  dnn looked up by its file name in the embeddings.
+  Returns non-zero if a store cannot be read or does not have the target.
+ */
+static int fusedTopRows(const std::vector<FusionStage>& stages, const TargetExtractor& extractTarget, const std::string& target_image_path,
+                        const std::string& method, const std::vector<float>& target_features, const FilenameArena& filenames,
+                        const FeatureMatrix& data, size_t k, std::vector<std::pair<float, int>>& similarities) {
+    PROFILE_SCOPE("matching.fuse");
+    std::vector<FusionSource> sources(stages.size() + 1);
+    sources[0].method = method;
+    sources[0].data = &data;
+    sources[0].target = target_features;
+    sources[0].weight = 1.0f;
+    sources[0].rows.resize(data.rows());
+    for (size_t r = 0; r < data.rows(); r++) {
+        sources[0].rows[r] = static_cast<int>(r);
+    }
+
+    // the stores must not move once the sources point at them
+    std::vector<FeatureMatrix> stores(stages.size());
+    std::cout << "Fusion: " << method << " x1";
+    for (size_t s = 0; s < stages.size(); s++) {
+        const FusionStage& stage = stages[s];
+        std::string csvFile = featureCsvPath(stage.method);
+        FilenameArena stageNames;
+        if (read_image_data_csv(const_cast<char*>(csvFile.c_str()), stageNames, stores[s], false) != 0) {
+            std::cerr << std::endl << "Failed to read image data from " << csvFile << std::endl;
+            return -1;
+        }
+        FilenameIndex index;
+        index.build(stageNames);
+        FusionSource& source = sources[s + 1];
+        source.method = stage.method;
+        source.data = &stores[s];
+        source.weight = stage.weight;
+        if (stage.method == "dnn") {
+            stores[s].normalizeRows();
+            std::string targetName = target_image_path.substr(target_image_path.find_last_of('/') + 1);
+            int targetRow = index.find(targetName);
+            if (targetRow < 0) {
+                std::cerr << std::endl << "Target image not found in " << csvFile << ": " << targetName << std::endl;
+                return -1;
+            }
+            source.target = stores[s].rowVector(targetRow);
+        } else if (extractTarget(stage.method, source.target) != 0) {
+            return -1;
+        }
+        source.rows.resize(data.rows());
+        for (size_t r = 0; r < data.rows(); r++) {
+            source.rows[r] = index.find(filenames.name(r), filenames.length(r));
+        }
+        std::cout << " + " << stage.method << " x" << stage.weight;
+    }
+    std::cout << std::endl;
+
+    similarities = fuseTopRows(sources, data.rows(), k);
+    return 0;
+}
+
+// Rows of data named like the candidate rows of the previous stage, names missing from data are dropped
+static std::vector<int> matchCandidates(const FilenameArena& previousNames, const std::vector<std::pair<float, int>>& previous,
+                                        const FilenameArena& names) {
+    FilenameIndex index;
+    index.build(names);
+    std::vector<int> rows;
+    rows.reserve(previous.size());
+    for (const std::pair<float, int>& candidate : previous) {
+        int row = index.find(previousNames.name(candidate.second), previousNames.length(candidate.second));
+        if (row >= 0) {
+            rows.push_back(row);
+        }
+    }
+    return rows;
+}
+
+/*
+  Cascade query: every stage loads its method's CSV, extracts the target
+  with that method and keeps the M best images, the first stage of the
+  whole CSV and the others of the previous shortlist only. The method of
+  the query then ranks the last shortlist from its own CSV, so the
+  expensive features are scored M times instead of once per image.
+  Each stage is printed, returns non-zero if a stage CSV cannot be read.
+ */
+static int cascadeTopRows(const std::vector<CascadeStage>& stages, const TargetExtractor& extractTarget, const std::string& method,
+                          const std::vector<float>& target_features, const FilenameArena& filenames,
+                          const FeatureMatrix& data, size_t k, std::vector<std::pair<float, int>>& similarities) {
+    PROFILE_SCOPE("matching.cascade");
+    FilenameArena previousNames;
+    std::vector<std::pair<float, int>> previous;
+    for (size_t s = 0; s < stages.size(); s++) {
+        const CascadeStage& stage = stages[s];
+        std::string csvFile = featureCsvPath(stage.method);
+        FilenameArena stageNames;
+        FeatureMatrix stageData;
+        if (read_image_data_csv(const_cast<char*>(csvFile.c_str()), stageNames, stageData, false) != 0) {
+            std::cerr << "Failed to read image data from " << csvFile << std::endl;
+            return -1;
+        }
+        std::vector<float> stageTarget;
+        if (extractTarget(stage.method, stageTarget) != 0) {
+            return -1;
+        }
+        size_t scored;
+        std::vector<std::pair<float, int>> kept;
+        if (s == 0) {
+            scored = stageData.rows();
+            kept = rankTopRows(stage.method, stageTarget, stageData, stage.keep);
+        } else {
+            std::vector<int> rows = matchCandidates(previousNames, previous, stageNames);
+            scored = rows.size();
+            kept = rankCandidateRows(stage.method, stageTarget, stageData, rows, stage.keep);
+        }
+        std::cout << "Cascade stage " << s + 1 << ": " << stage.method << " kept " << kept.size() << " of " << scored
+                  << " images" << std::endl;
+        previousNames.chars.swap(stageNames.chars);
+        previousNames.offsets.swap(stageNames.offsets);
+        previous.swap(kept);
+    }
+
+    std::vector<int> rows = matchCandidates(previousNames, previous, filenames);
+    similarities = rankCandidateRows(method, target_features, data, rows, k);
+    std::cout << "Cascade rerank: " << method << " scored " << rows.size() << " of " << data.rows() << " images" << std::endl;
+    return 0;
 }
 
 
 int main(int argc, char* argv[]) {
+    // Stage timers and counters, see profiler.h
+    profilerInitFromEnv();
+    PROFILE_SCOPE("matching.total");
+
     if (argc < 3) {
         matchingMenu();
         return EXIT_FAILURE;
@@ -44,18 +236,7 @@ int main(int argc, char* argv[]) {
 
     std::string method = argv[1];
     // Check if the method is valid
-    if (method != "b" 
-    && method != "h2" 
-    && method != "h3" 
-    && method != "m" 
-    && method != "tc" 
-    && method != "glcm"
-    && method != "l"
-    && method != "gabor"
-    && method != "custom_s"
-    && method != "custom_m"
-    && method != "custom_l"
-    && method != "face") {
+    if (!isMatchingMethod(method) || method == "dnn") {
         std::cerr << "Error: invalid method" << std::endl;
         matchingMenu();
         return EXIT_FAILURE;
@@ -66,9 +247,101 @@ int main(int argc, char* argv[]) {
 
     // Set the value for N
     int N = 3;  // Default value for N
-    if (argc == 4) {
+    if (argc >= 4) {
         N = std::stoi(argv[3]);
     }
+    bool varianceOrder = false;
+    bool pyramid = false;
+    std::string vpTreeFile;
+    bool range = false;
+    float radius = 0.0f;
+    std::vector<CascadeStage> cascade;
+    std::vector<FusionStage> fusion;
+    size_t binaryShortlist = 0;
+    std::string codesFile;
+    size_t shards = 0;
+    std::string cacheDir;
+    // everything after the target that changes the answer, part of the result cache key
+    std::string parameters = std::to_string(N);
+    for (int i = 4; i < argc; i++) {
+        int start = i;
+        std::string option = argv[i];
+        if (option == "--variance-order") {
+            varianceOrder = true;
+        } else if (option == "--pyramid") {
+            pyramid = true;
+        } else if (option == "--vptree" && i + 1 < argc) {
+            vpTreeFile = argv[++i];
+        } else if (option == "--range" && i + 1 < argc) {
+            range = true;
+            radius = std::stof(argv[++i]);
+        } else if (option == "--cascade" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t colon = spec.find(':');
+            CascadeStage stage;
+            stage.method = spec.substr(0, colon);
+            stage.keep = colon == std::string::npos ? 0 : std::stoul(spec.substr(colon + 1));
+            if (!isMatchingMethod(stage.method) || stage.method == "dnn" || stage.keep == 0) {
+                std::cerr << "Error: invalid cascade stage " << spec << ", expected <method>:<M>" << std::endl;
+                matchingMenu();
+                return EXIT_FAILURE;
+            }
+            cascade.push_back(stage);
+        } else if (option == "--fuse" && i + 1 < argc) {
+            std::string spec = argv[++i];
+            size_t colon = spec.find(':');
+            FusionStage stage;
+            stage.method = spec.substr(0, colon);
+            stage.weight = colon == std::string::npos ? 1.0f : std::stof(spec.substr(colon + 1));
+            if (!isMatchingMethod(stage.method)) {
+                std::cerr << "Error: invalid fusion method " << spec << ", expected <method>:<weight>" << std::endl;
+                matchingMenu();
+                return EXIT_FAILURE;
+            }
+            fusion.push_back(stage);
+        } else if (option == "--binary" && i + 1 < argc) {
+            binaryShortlist = std::stoul(argv[++i]);
+        } else if (option == "--codes" && i + 1 < argc) {
+            codesFile = argv[++i];
+        } else if (option == "--shards" && i + 1 < argc) {
+            shards = std::stoul(argv[++i]);
+        } else if (option == "--cache" && i + 1 < argc) {
+            cacheDir = argv[++i];
+            continue;
+        } else {
+            std::cerr << "Error: invalid option " << option << std::endl;
+            matchingMenu();
+            return EXIT_FAILURE;
+        }
+        for (int j = start; j <= i; j++) {
+            parameters += std::string(" ") + argv[j];
+        }
+    }
+    if (!cascade.empty() && (pyramid || varianceOrder || !vpTreeFile.empty())) {
+        std::cerr << "Error: --cascade scores shortlists, it cannot be combined with the full scan options" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!fusion.empty() && (!cascade.empty() || pyramid || varianceOrder || !vpTreeFile.empty())) {
+        std::cerr << "Error: --fuse ranks by a combined score, it cannot be combined with --cascade or the scan options" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (binaryShortlist > 0 && (!fusion.empty() || !cascade.empty() || pyramid || varianceOrder || !vpTreeFile.empty())) {
+        std::cerr << "Error: --binary is a prefilter of its own, it cannot be combined with the other query options" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (shards > 0 && (binaryShortlist > 0 || !fusion.empty() || !cascade.empty() || pyramid || varianceOrder
+                       || !vpTreeFile.empty())) {
+        std::cerr << "Error: --shards scans every shard, it cannot be combined with the other query options" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (!codesFile.empty() && binaryShortlist == 0) {
+        std::cerr << "Error: --codes needs --binary" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (range && vpTreeFile.empty()) {
+        std::cerr << "Error: --range needs --vptree" << std::endl;
+        return EXIT_FAILURE;
+    }
     if (N < 1) {
         std::cerr << "Error: invalid N" << std::endl;
         return EXIT_FAILURE;
@@ -77,175 +350,196 @@ int main(int argc, char* argv[]) {
     std::cout << "N is set to " << N << std::endl;
 
     // Construct the full name of the method
-    std::string methodFullname;
-    std::string embeddingCvsFile;
-    if (method == "b") {
-        methodFullname = "baseline";
-    } else if (method == "h2") {
-        methodFullname = "2D_histogram";
-    } else if (method == "h3") {
-        methodFullname = "3D_histogram";
-    } else if (method == "m") {
-        methodFullname = "multi_histogram";
-    } else if (method == "tc") {
-        methodFullname = "texturecolor";
-    } else if (method == "glcm") {
-        methodFullname = "glcm";
-    } else if (method == "l"){
-        methodFullname = "laws";
-    } else if (method == "gabor"){
-        methodFullname = "gabor";
-    } else if (method == "custom_s") {
-        methodFullname = "custom_s";
-    } else if (method == "custom_m") {
-        methodFullname = "custom_m";
-    } else if (method == "custom_l") {
-        methodFullname = "custom_l";
-    } else {
-        std::cerr << "Error: invalid method" << std::endl;
-        return EXIT_FAILURE;
-    }
+    std::string methodFullname = methodCsvName(method);
     // Print the method
     std::cout << "Method is set to " << methodFullname << std::endl;
 
     // Construct the CSV file path based on the method
-    std::string csvFile = "/Users/jeff/Desktop/Project2_YZ/bin/image_features_" + methodFullname + ".csv";
+    std::string csvFile = featureCsvPath(method);
     std::cout << "CSV file is set to " << csvFile << std::endl;
 
 
-    // Read the target image and extract its feature vector
-    cv::Mat target_image = cv::imread(target_image_path, cv::IMREAD_COLOR);
-    // if target image is not exist
-    if (target_image.empty()) {
-        std::cerr << "Could not read the target image: " << target_image_path << std::endl;
-        return EXIT_FAILURE;
+    // Feature stores the answer depends on, a cached answer is only reused while they are unchanged
+    std::vector<std::string> stores;
+    if (shards > 0) {
+        for (size_t i = 0; i < shards; i++) {
+            stores.push_back(shardCsvPath(csvFile, i, shards));
+        }
+    } else {
+        stores.push_back(csvFile);
+    }
+    for (const CascadeStage& stage : cascade) {
+        stores.push_back(featureCsvPath(stage.method));
+    }
+    for (const FusionStage& stage : fusion) {
+        stores.push_back(featureCsvPath(stage.method));
+    }
+
+    // Repeated targets: the cache is keyed by the bytes of the target file, see queryCache.h
+    QueryCache cache(cacheDir);
+    unsigned long long targetHash = 0;
+    bool cacheable = !cacheDir.empty() && contentHash(target_image_path, targetHash) == 0;
+    std::string storeVersion;
+    std::string resultKey;
+    if (cacheable) {
+        storeVersion = featureStoreVersion(stores);
+        resultKey = QueryCache::resultKey(targetHash, method, parameters);
+        CachedResults cached;
+        if (cache.findResults(resultKey, storeVersion, cached)) {
+            cached.header += " (cached)";
+            printMatches(cached);
+            cache.report(stderr);
+            return 0;
+        }
     }
 
+    // The target image is only decoded if a method's features are not in the cache
+    cv::Mat target_image;
+    TargetExtractor extractTarget = [&](const std::string& targetMethod, std::vector<float>& features) -> int {
+        std::string key = QueryCache::featureKey(targetHash, targetMethod);
+        if (cacheable && cache.findFeatures(key, features)) {
+            return 0;
+        }
+        if (target_image.empty()) {
+            PROFILE_SCOPE("matching.decode_target");
+            target_image = cv::imread(target_image_path, cv::IMREAD_COLOR);
+            // if target image is not exist
+            if (target_image.empty()) {
+                std::cerr << "Could not read the target image: " << target_image_path << std::endl;
+                return -1;
+            }
+        }
+        PROFILE_SCOPE("matching.extract_target");
+        features = extractFeatureByMethod(targetMethod, target_image);
+        if (cacheable) {
+            cache.storeFeatures(key, features);
+        }
+        return 0;
+    };
+
     // Extract the target features, csv files and compare them
     std::vector<float> target_features;
-    std::vector<char*> filenames;
-    std::vector<std::vector<float>> data;
-
-    // Use the existing read_image_data_csv function to read the CSV file
-    if (read_image_data_csv(const_cast<char*>(csvFile.c_str()), filenames, data, false) != 0) {
-        std::cerr << "Failed to read image data from CSV" << std::endl;
+    FilenameArena filenames;
+    FeatureMatrix data;
+    CachedResults results;
+    if (extractTarget(method, target_features) != 0) {
         return EXIT_FAILURE;
     }
 
-    // Extract the target features based on the method
-    if (method == "b"){
-        target_features = extract7x7FeatureVector(target_image);
-    } else if (method == "h2"){
-        target_features = calculateRG_2DChromaHistogram(target_image, BINS_2D);
-    } else if (method == "h3"){
-        target_features = calculateRGB_3DChromaHistogram(target_image, BINS_3D);
-    } else if (method == "m") {
-        target_features = calculateMultiPartRGBHistogram(target_image, BINS_3D); // Multi-histogram method
-    } else if (method == "tc"){
-        target_features = calculateColorTextureFeatureVector(target_image, COLOR_BINS, TEXTURE_BINS);
-    } else if (method == "glcm"){
-        target_features = calculateGLCMFeatures(target_image, GLCM_DISTANCE, GLCM_ANGLE, GLCM_LEVELS);
-    } else if (method == "l"){
-        target_features = calculateLawsTextureFeatures(target_image);
-    } else if (method == "gabor"){
-        target_features = computeGaborFeatures(target_image);
-    } else if (method == "custom_s") {
-        target_features = calculateCustomFeature(target_image, BINS_3D, WEIGHT_CONFIG_S);
-    } else if (method == "custom_m") {
-        target_features = calculateCustomFeature(target_image, BINS_3D, WEIGHT_CONFIG_M);
-    } else if (method == "custom_l") {
-        target_features = calculateCustomFeature(target_image, BINS_3D, WEIGHT_CONFIG_L);
+    // Sharded CSV: the shards are loaded and ranked by their own threads, only their Top N + 1 lists are merged
+    if (shards > 0) {
+        std::vector<ShardMatch> matches;
+        int threads = std::max(1u, std::thread::hardware_concurrency());
+        if (scatterGatherTopRows(method, target_features, csvFile, shards, N + 1, threads, matches) != 0) {
+            std::cerr << "Failed to read the shards of " << csvFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        results.header = "Top " + std::to_string(N) + " Matches from " + std::to_string(shards) + " shards: ";
+        // Start loop from 1 to skip the target image, assuming it's the first match
+        for (size_t i = 1; i < matches.size(); i++) {
+            results.matches.push_back(std::make_pair(matches[i].name, matches[i].score));
+        }
     } else {
-        std::cerr << "Error: invalid method" << std::endl;
-        return EXIT_FAILURE;
-    }
+        // Use the existing read_image_data_csv function to read the CSV file
+        if (read_image_data_csv(const_cast<char*>(csvFile.c_str()), filenames, data, false) != 0) {
+            std::cerr << "Failed to read image data from CSV" << std::endl;
+            return EXIT_FAILURE;
+        }
 
-    // Compute similarities between target image and each image in the CSV
-    std::vector<std::pair<float, std::string>> similarities;
-    if (method == "b"){
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeSSD(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "h2"){
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeHistogramIntersection(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "h3"){
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeHistogramIntersection(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "m"){
-        // Compute similarities using combined histogram intersection
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = combinedHistogramIntersection(target_features, data[i], SPLIT_POINT);
-            // Store the inverted distance for consistency with other methods
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "tc"){
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = combinedHistogramIntersection(target_features, data[i], SPLIT_POINT);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "glcm"){
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeSSD(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "l"){
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeSSD(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "gabor"){
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeSSD(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "custom_s") {
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeHistogramIntersection(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "custom_m") {
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeHistogramIntersection(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "custom_l") {
-        for (size_t i = 0; i < data.size(); i++) {
-            float distance = computeHistogramIntersection(target_features, data[i]);
-            similarities.emplace_back(distance, std::string(filenames[i]));
-        }
-    } else if (method == "face"){
-        printf("face detect done.\n");
-    } else {
-        std::cerr << "Error: invalid method" << std::endl;
-        return EXIT_FAILURE;
-    }
+        if (varianceOrder && isSSDMethod(method)) {
+            data.orderColumnsByVariance();
+        }
 
-    // Clean up dynamically allocated filenames
-    for (char* fname : filenames) {
-        delete[] fname;
-    }
-    // by using histogram intersection, the higher the value, the more similar the images are
-    if (method == "h2" || method == "h3" || method == "m" || method == "tc" || method == "custom_s" || method == "custom_m" || method == "custom_l") {
-        // Sort in descending order for histogram intersection
-        std::sort(similarities.begin(), similarities.end(), [](const std::pair<float, std::string>& a, const std::pair<float, std::string>& b) {
-            return a.first > b.first; // For higher intersection values
-        });
-    } else {
-        // Sort in ascending order for SSD, the lower, the more similar
-        std::sort(similarities.begin(), similarities.end());
+        // The N + 1 best rows of the CSV, best match first, SSD rows are abandoned once they cannot make it
+        std::vector<std::pair<float, int>> similarities;
+        HistogramPyramid histogramPyramid;
+        VpTree vpTree;
+        bool pyramidReady = false;
+        if (pyramid && HistogramPyramid::supports(method)) {
+            // the coarse levels are kept next to the CSV and only rebuilt when the CSV changed
+            std::string pyramidFile = csvFile + ".pyramid";
+            if (histogramPyramid.read(pyramidFile, method, data) == 0) {
+                pyramidReady = true;
+            } else if (histogramPyramid.build(method, data) == 0) {
+                pyramidReady = true;
+                if (histogramPyramid.write(pyramidFile) != 0) {
+                    std::cerr << "Warning: cannot write " << pyramidFile << std::endl;
+                }
+            }
+        }
+        if (binaryShortlist > 0) {
+            // signatures of the same CSV are reused, otherwise rebuilt
+            BinaryCodes codes;
+            if (codesFile.empty() || codes.read(codesFile, data) != 0) {
+                codes.build(data, BinaryCodes::kindForMethod(method));
+                if (!codesFile.empty() && codes.write(codesFile) != 0) {
+                    std::cerr << "Warning: cannot write " << codesFile << std::endl;
+                }
+            }
+            std::vector<int> candidates = codes.candidateRows(target_features, binaryShortlist);
+            similarities = rankCandidateRows(method, target_features, data, candidates, N + 1);
+            std::cout << "Binary prefilter: " << codes.bits() << "-bit " << (codes.kind() == BINARY_SIMHASH ? "SimHash" : "threshold")
+                      << " codes, " << candidates.size() << " of " << data.rows() << " images reranked" << std::endl;
+        } else if (!fusion.empty()) {
+            if (fusedTopRows(fusion, extractTarget, target_image_path, method, target_features, filenames, data, N + 1,
+                             similarities) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else if (!cascade.empty()) {
+            if (cascadeTopRows(cascade, extractTarget, method, target_features, filenames, data, N + 1, similarities) != 0) {
+                return EXIT_FAILURE;
+            }
+        } else if (!vpTreeFile.empty() && isSSDMethod(method)) {
+            // a saved tree is only used if it was built from this CSV
+            if (vpTree.read(vpTreeFile, data) != 0) {
+                if (vpTree.build(data) != 0) {
+                    std::cerr << "Error: cannot build a VP-tree, " << csvFile << " has no rows" << std::endl;
+                    return EXIT_FAILURE;
+                }
+                if (vpTree.write(vpTreeFile) != 0) {
+                    std::cerr << "Warning: cannot write " << vpTreeFile << std::endl;
+                }
+            }
+            VpTreeStats stats;
+            if (range) {
+                similarities = vpTree.rangeRows(target_features, data, radius, &stats);
+            } else {
+                similarities = vpTree.topRows(target_features, data, N + 1, &stats);
+            }
+            fprintf(stderr, "VP-tree: %zu of %zu distances computed, %zu pruned\n", stats.distances, stats.rows, stats.pruned());
+        } else if (pyramidReady) {
+            // same rows as rankTopRows, most rows are only scored on the coarse levels
+            similarities = histogramPyramid.topRows(target_features, data, N + 1);
+        } else {
+            if (!vpTreeFile.empty()) {
+                std::cerr << "Warning: the VP-tree only indexes SSD methods, scanning every row" << std::endl;
+            }
+            if (pyramid) {
+                std::cerr << "Warning: no histogram pyramid for method " << method << ", scanning every row" << std::endl;
+            }
+            similarities = rankTopRows(method, target_features, data, N + 1);
+        }
+
+        int matchesToShow = N + 1; // Increase by one to account for skipping the target image
+        if (range) {
+            std::ostringstream header;
+            header << "Matches within " << radius << ": ";
+            results.header = header.str();
+            matchesToShow = similarities.size();
+        } else {
+            results.header = "Top " + std::to_string(N) + " Matches: ";
+        }
+        // Start loop from 1 to skip the target image, assuming it's the first match
+        for (int i = 1; i < matchesToShow && i < similarities.size(); i++) {
+            results.matches.push_back(std::make_pair(std::string(filenames.name(similarities[i].second)), similarities[i].first));
+        }
     }
 
-    std::cout << "Top " << N << " Matches: " << std::endl;
-    // Start loop from 1 to skip the target image, assuming it's the first match
-    int matchesToShow = N + 1; // Increase by one to account for skipping the target image
-    for (int i = 1; i < matchesToShow && i < similarities.size(); i++) {
-        std::cout << similarities[i].second << " with similarity: " << similarities[i].first << std::endl;
+    PROFILE_SCOPE("matching.print");
+    printMatches(results);
+    if (cacheable) {
+        cache.storeResults(resultKey, storeVersion, results);
+        cache.report(stderr);
     }
 
     return 0;
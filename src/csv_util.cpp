@@ -12,18 +12,22 @@ The function returns a std::vector of char* for the filenames and a 2D std::vect
 */
 
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <vector>
 #include "csv_util.h"
+#include "profiler.h"
 
 
 /*
-  reads a string from a CSV file. the 0-terminated string is returned in the char array os.
+  reads a string from a CSV file. the 0-terminated string is returned in the char array os,
+  which holds size chars.
 
   The function returns false if it is successfully read. It returns true if it reaches the end of the line or the file.
+  It returns -1 if the string does not fit in os.
  */
-int getstring( FILE *fp, char os[] ) {
-  int p = 0;
+int getstring( FILE *fp, char os[], size_t size ) {
+  size_t p = 0;
   int eol = 0;
   
   for(;;) {
@@ -35,6 +39,10 @@ int getstring( FILE *fp, char os[] ) {
       eol = 1;
       break;
     }
+    if( p + 1 >= size ) {
+      os[p] = '\0';
+      return(-1);
+    }
     // printf("%c", ch ); // uncomment for debugging
     os[p] = ch;
     p++;
@@ -45,6 +53,10 @@ int getstring( FILE *fp, char os[] ) {
   return(eol); // return true if eol
 }
 
+bool isCsvFilename(const std::string& name) {
+  return name.size() < CSV_MAX_FILENAME && name.find_first_of(",\n\r") == std::string::npos;
+}
+
 int getint(FILE *fp, int *v) {
   char s[256];
   int p = 0;
@@ -112,8 +124,7 @@ int getfloat(FILE *fp, float *v) {
 
   The function returns a non-zero value in case of an error.
  */
-int append_image_data_csv( char *filename, char *image_filename, std::vector<float> &image_data, int reset_file ) {
-  char buffer[256];
+int append_image_data_csv( char *filename, char *image_filename, const std::vector<float> &image_data, int reset_file ) {
   char mode[8];
   FILE *fp;
 
@@ -130,39 +141,47 @@ int append_image_data_csv( char *filename, char *image_filename, std::vector<flo
   }
 
   // write the filename and the feature vector to the CSV file
-  strcpy(buffer, image_filename);
-  std::fwrite(buffer, sizeof(char), strlen(buffer), fp );
+  write_image_data_csv_row( fp, image_filename, image_data );
+
+  fclose(fp);
+  
+  return(0);
+}
+
+/*
+  Writes one line of data to a CSV file that is already open for
+  writing, in the same format as append_image_data_csv.
+
+  The function returns a non-zero value in case of an error.
+ */
+int write_image_data_csv_row( FILE *fp, const char *image_filename, const std::vector<float> &image_data ) {
+  PROFILE_SCOPE("csv.write_row");
+  PROFILE_COUNT("csv.rows_written", 1);
+  std::fwrite(image_filename, sizeof(char), strlen(image_filename), fp );
   for(int i=0;i<image_data.size();i++) {
     char tmp[256];
     snprintf(tmp, sizeof(tmp), ",%.4f", image_data[i]); // change sprintf -> snprintf
     std::fwrite(tmp, sizeof(char), strlen(tmp), fp );
   }
-      
+
   std::fwrite("\n", sizeof(char), 1, fp); // EOL
 
-  fclose(fp);
-  
-  return(0);
+  return( ferror(fp) ? -1 : 0 );
 }
 
 /*
-  Given a file with the format of a string as the first column and
-  floating point numbers as the remaining columns, this function
-  returns the filenames as a std::vector of character arrays, and the
-  remaining data as a 2D std::vector<float>.
+  Reads every row of a feature file: the filename goes to the arena and
+  the features are handed to add_row, which returns non-zero to stop.
 
-  filenames will contain all of the image file names.
-  data will contain the features calculated from each image.
-
-  If echo_file is true, it prints out the contents of the file as read
-  into memory.
-
-  The function returns a non-zero value if something goes wrong.
+  The function returns the number of rows read, or -1 if something goes wrong.
  */
-int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file ) {
+template <typename AddRow>
+static long read_csv_rows( char *filename, FilenameArena &filenames, AddRow add_row ) {
   FILE *fp;
   float fval;
-  char img_file[256];
+  char img_file[CSV_MAX_FILENAME];
+  std::vector<float> dvec; // one row, reused
+  long rows = 0;
 
   fp = fopen(filename, "r");
   if( !fp ) {
@@ -170,16 +189,20 @@ int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::ve
     return(-1);
   }
 
-  printf("Reading %s\n", filename);
+  fprintf(stderr, "Reading %s\n", filename); // progress goes to stderr, stdout is left to the results
   for(;;) {
-    std::vector<float> dvec;
+    dvec.clear();
     
-    
-    // read the filename
-    if( getstring( fp, img_file ) ) {
+    // read the filename, a name too long for the buffer is a damaged file
+    int status = getstring( fp, img_file, sizeof(img_file) );
+    if( status < 0 ) {
+      printf("Row %ld of %s has a filename of %zu bytes or more\n", rows, filename, sizeof(img_file));
+      fclose(fp);
+      return(-1);
+    }
+    if( status ) {
       break;
     }
-    // printf("Evaluting %s\n", filename);
 
     // read the whole feature file into memory
     for(;;) {
@@ -188,16 +211,48 @@ int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::ve
       dvec.push_back( fval );
       if( eol ) break;
     }
-    // printf("read %lu features\n", dvec.size() );
 
-    data.push_back(dvec);
-
-    char *fname = new char[strlen(img_file)+1];
-    strcpy(fname, img_file);
-    filenames.push_back( fname );
+    if( add_row( dvec ) ) {
+      printf("Row %ld of %s has %zu features, not like the rows before\n", rows, filename, dvec.size());
+      fclose(fp);
+      return(-1);
+    }
+    filenames.add( img_file, strlen(img_file) );
+    rows++;
   }
+  PROFILE_COUNT("csv.bytes_read", ftell(fp));
+  PROFILE_COUNT("csv.rows_read", rows);
   fclose(fp);
-  printf("Finished reading CSV file\n");
+  fprintf(stderr, "Finished reading CSV file\n");
+
+  return(rows);
+}
+
+/*
+  Given a file with the format of a string as the first column and
+  floating point numbers as the remaining columns, this function
+  returns the filenames in a FilenameArena, one buffer for all the
+  names, and the remaining data as a 2D std::vector<float>.
+
+  filenames will contain all of the image file names.
+  data will contain the features calculated from each image.
+
+  If echo_file is true, it prints out the contents of the file as read
+  into memory.
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_data_csv( char *filename, FilenameArena &filenames, std::vector<std::vector<float>> &data, int echo_file ) {
+  PROFILE_SCOPE("csv.read");
+  long rows = read_csv_rows( filename, filenames, [&data](const std::vector<float> &dvec) -> int {
+    data.push_back( dvec );
+    return 0;
+  });
+  if( rows < 0 ) {
+    return(-1);
+  }
+  // one feature vector copied out per row, the names share the arena
+  PROFILE_COUNT("csv.rows_materialized", rows);
 
   if(echo_file) {
     for(int i=0;i<data.size();i++) {
@@ -211,3 +266,54 @@ int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::ve
 
   return(0);
 }
+
+/*
+  Same as above, but the features go into the rows of a FeatureMatrix,
+  one contiguous block, nothing is allocated per row.
+
+  The function returns a non-zero value if something goes wrong,
+  including rows of different lengths.
+ */
+int read_image_data_csv( char *filename, FilenameArena &filenames, FeatureMatrix &data, int echo_file ) {
+  PROFILE_SCOPE("csv.read");
+  long rows = read_csv_rows( filename, filenames, [&data](const std::vector<float> &dvec) -> int {
+    return data.appendRow( dvec );
+  });
+  if( rows < 0 ) {
+    return(-1);
+  }
+
+  if(echo_file) {
+    for(size_t i=0;i<data.rows();i++) {
+      for(size_t j=0;j<data.cols();j++) {
+	printf("%.4f  ", data.row(i)[j] );
+      }
+      printf("\n");
+    }
+    printf("\n");
+  }
+
+  return(0);
+}
+
+/*
+  Same reader, the filenames are returned as separately allocated
+  character arrays that the caller has to delete[].
+
+  The function returns a non-zero value if something goes wrong.
+ */
+int read_image_data_csv( char *filename, std::vector<char *> &filenames, std::vector<std::vector<float>> &data, int echo_file ) {
+  FilenameArena arena;
+  if( read_image_data_csv( filename, arena, data, echo_file ) ) {
+    return(-1);
+  }
+
+  PROFILE_COUNT("csv.names_materialized", arena.size());
+  for(size_t i=0;i<arena.size();i++) {
+    char *fname = new char[arena.length(i)+1];
+    strcpy(fname, arena.name(i));
+    filenames.push_back( fname );
+  }
+
+  return(0);
+}
@@ -15,72 +15,94 @@
 #include <algorithm>
 #include "csv_util.h"
 #include "matchings.h"
+#include "retrieval.h"
+#include "filenameIndex.h"
+#include "profiler.h"
 
 
 
+// Print the top N matches of one target row, the target itself (first match) is skipped
+static void printTopMatches(const std::string& targetImageName, int targetRow, int N,
+                            const FilenameArena& filenames, const FeatureMatrix& data) {
+    // Calculate cosine similarity against every row, higher first.
+    std::vector<std::pair<float, int>> similarityScores = rankTopRows("dnn", data.rowVector(targetRow), data, N + 1);
+
+    std::cout << "Top " << N << " similar images to " << targetImageName << ":" << std::endl;
+    for (int i = 1; i < (N + 1) && i < similarityScores.size(); i++) {
+        std::cout << i << ": " << filenames.name(similarityScores[i].second) << " (Similarity: " << similarityScores[i].first << ")" << std::endl;
+    }
+}
+
+// Read one image name per line
+static int readNameList(const std::string& path, std::vector<std::string>& names) {
+    std::ifstream file(path);
+    if (!file) {
+        return -1;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) names.push_back(line);
+    }
+    return 0;
+}
+
 // Main entry
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << "<target_image_name> <Top N>" << std::endl;
+    // Stage timers and counters, see profiler.h
+    profilerInitFromEnv();
+    PROFILE_SCOPE("dnn_embedding.total");
+
+    if (argc < 2 || (std::string(argv[1]) == "--batch" && argc < 3)) {
+        std::cerr << "Usage: " << argv[0] << " <target_image_name> <Top N>" << std::endl;
+        std::cerr << "       " << argv[0] << " --batch <file of image names, one per line> <Top N>" << std::endl;
         return EXIT_FAILURE;
     }
 
     // Path to the CSV file containing the feature vectors.
     std::string csvFilePath = "/Users/jeff/Desktop/Project2_YZ/olympus/ResNet18_olym.csv";
 
-    // Name of the target image.
-    std::string targetImageName = argv[1];
+    // Name of the target images, a single one or a list file in batch mode.
+    std::vector<std::string> targetImageNames;
+    int nArg = 2;
+    if (std::string(argv[1]) == "--batch") {
+        if (readNameList(argv[2], targetImageNames) != 0) {
+            std::cerr << "Cannot read the name list " << argv[2] << std::endl;
+            return EXIT_FAILURE;
+        }
+        nArg = 3;
+    } else {
+        targetImageNames.push_back(argv[1]);
+    }
     int N = 3;
-    if (argc == 3) {
-        N = std::stoi(argv[2]);
+    if (argc > nArg) {
+        N = std::stoi(argv[nArg]);
     }
 
     // Load the CSV file into memory.
-    std::vector<char*> filenames;
-    std::vector<std::vector<float>> data;
+    FilenameArena filenames;
+    FeatureMatrix data;
     if (read_image_data_csv(const_cast<char*>(csvFilePath.c_str()), filenames, data, false) != 0) {
         std::cerr << "Error reading CSV file" << std::endl;
         return EXIT_FAILURE;
     }
+    // Unit length rows, each query is then a single dot product per row.
+    data.normalizeRows();
 
-    // Find the feature vector for the target image.
-    std::vector<float> targetFeatureVector;
-    bool found = false;
-    for (size_t i = 0; i < filenames.size(); ++i) {
-        if (std::string(filenames[i]) == targetImageName) {
-            targetFeatureVector = data[i];
-            found = true;
-            break;
-        }
-    }
-
-    if (!found) {
-        std::cerr << "Target image not found in CSV" << std::endl;
-        return EXIT_FAILURE;
-    }
-
-    // Calculate similarity and store results.
-    std::vector<std::pair<float, std::string>> similarityScores;
-    for (size_t i = 0; i < data.size(); ++i) {
-        float similarity = calculateCosineSimilarity(targetFeatureVector, data[i]);
-        similarityScores.emplace_back(similarity, std::string(filenames[i]));
-    }
+    // Index the filenames once, every target is then found without scanning the rows.
+    FilenameIndex index;
+    index.build(filenames);
+    std::vector<int> targetRows = index.findAll(targetImageNames);
 
-    // Sort based on similarity (higher first).
-    std::sort(similarityScores.begin(), similarityScores.end(), [](const std::pair<float, std::string>& a, const std::pair<float, std::string>& b) {
-        return a.first > b.first;
-    });
-
-    // Print top N similar images.
-    std::cout << "Top " << N << " similar images:" << std::endl;
-    for (int i = 1; i < (N + 1) && i < similarityScores.size(); i++) {
-        std::cout << i << ": " << similarityScores[i].second << " (Similarity: " << similarityScores[i].first << ")" << std::endl;
-    }
-
-    // Cleanup.
-    for (auto& fname : filenames) {
-        delete[] fname;
+    int missing = 0;
+    for (size_t t = 0; t < targetImageNames.size(); t++) {
+        if (targetRows[t] < 0) {
+            std::cerr << "Target image not found in CSV: " << targetImageNames[t] << std::endl;
+            missing++;
+            continue;
+        }
+        printTopMatches(targetImageNames[t], targetRows[t], N, filenames, data);
     }
 
-    return 0;
+    return missing == static_cast<int>(targetImageNames.size()) ? EXIT_FAILURE : 0;
 }
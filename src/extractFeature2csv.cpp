@@ -9,17 +9,36 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <dirent.h>
+#include <chrono>
 #include <algorithm>
 #include <opencv2/opencv.hpp>
 #include "matchings.h"
 #include "csv_util.h"
 #include "faceDetect.h"
+#include "featureMethods.h"
+#include "extractScratch.h"
+#include "imageIO.h"
+#include "extractPipeline.h"
+#include "tarReader.h"
+#include "videoIngest.h"
+#include "featureMatrix.h"
+#include "retrieval.h"
+#include "profiler.h"
+
+// number of query images used by --measure-decode
+#define MEASURE_QUERIES 100
+// number of top matches compared by --measure-decode
+#define MEASURE_TOP_K 10
 
 
 // Menu for the user
 void extractMenu(){
-    printf("Usage: ./extractFeature <method> <directory_of_images>\n");
+    printf("Usage: ./extractFeature <method> <directory_of_images> [options]\n");
+    printf("       ./extractFeature <method> <archive.tar | -> [options]\n");
+    printf("  a tar archive, or a tar stream on stdin for -, is read member by member and decoded from memory,\n");
+    printf("  the rows are keyed by the member path\n");
+    printf("       ./extractFeature <method> <video.mp4|avi|mov|mkv|...> [options]\n");
+    printf("  the frames of a video are extracted, the rows are keyed <video>#<frame>\n");
     printf("method:\n");
     printf("  b: use the Baseline method to extract the feature\n");
     printf("  h2: use the RG 2D Histogram method to extract the feature\n");
@@ -33,10 +52,131 @@ void extractMenu(){
     printf("  custom_m: use the custom method to extract the feature for medium object\n");
     printf("  custom_l: use the custom method to extract the feature for large object\n");
     printf("  face: use the face detection method to extract the feature\n");
+    printf("options:\n");
+    printf("  --cascade <file>: Haar cascade file for the face method\n");
+    printf("  --face-scale <factor>: scale step of the face detector, larger is faster (default %.1f)\n", FACE_SCALE_FACTOR);
+    printf("  --face-min-size <pixels>: smallest face to look for, larger is faster (default %d)\n", FACE_MIN_SIZE);
+    printf("  --decode <full|auto|2|4|8|max:N>: decode images at full size (default), the method's reduced size,\n");
+    printf("                                    1/2, 1/4 or 1/8 size, or with the larger side limited to N pixels\n");
+    printf("  --measure-decode: compare retrieval with the --decode policy against full size decoding, no csv is written\n");
+    printf("  --pipeline: read, decode, extract and write in parallel stages, prints how busy each stage was\n");
+    printf("  --threads <n>: decode and extract threads of the pipeline (default: number of cores)\n");
+    printf("  --io-threads <n>: file reading threads of the pipeline (default %d)\n", PIPELINE_IO_THREADS);
+    printf("  --queue-depth <n>: images buffered between pipeline stages (default %d)\n", PIPELINE_QUEUE_DEPTH);
+    printf("  --stride <n>: video only, look at every n-th frame (default %d)\n", VIDEO_FRAME_STRIDE);
+    printf("  --change <t>: video only, skip a frame unless 1 - its h2 intersection with the last indexed frame\n");
+    printf("                is above t, 0 indexes every frame on the stride (default %.2f)\n", VIDEO_CHANGE_THRESHOLD);
+}
+
+
+// Elapsed milliseconds since start
+static double elapsedMs(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Indices of all the other images, best match first, for one query
+static std::vector<size_t> rankAgainst(const std::string& method, const FeatureMatrix& features, size_t query) {
+    std::vector<std::pair<float, int>> scores = rankRows(method, features.rowVector(query), features);
+
+    std::vector<size_t> ranking;
+    ranking.reserve(scores.size());
+    for (const auto& score : scores) {
+        if (score.second != static_cast<int>(query)) {
+            ranking.push_back(score.second);
+        }
+    }
+    return ranking;
+}
+
+// Measure how much a reduced decode changes the retrieval results against full size decoding
+int measureDecodePolicy(const std::string& method, const std::string& directory_of_images,
+                        const std::vector<std::string>& file_names, const DecodePolicy& policy, FaceDetector& faceDetector) {
+    if (!isMatchingMethod(method)) {
+        std::cerr << "Error: --measure-decode needs a method with a matching metric" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    FeatureMatrix fullFeatures, reducedFeatures;
+    double fullDecodeMs = 0, fullExtractMs = 0, reducedDecodeMs = 0, reducedExtractMs = 0;
+
+    for (const std::string& file_name : file_names) {
+        std::string full_file_path = directory_of_images + "/" + file_name;
+
+        auto start = std::chrono::steady_clock::now();
+        cv::Mat fullImage = readImage(full_file_path, fullDecodePolicy());
+        fullDecodeMs += elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        cv::Mat reducedImage = readImage(full_file_path, policy);
+        reducedDecodeMs += elapsedMs(start);
+
+        if (fullImage.empty() || reducedImage.empty()) {
+            std::cerr << "Could not read the image: " << full_file_path << std::endl;
+            continue;
+        }
+
+        start = std::chrono::steady_clock::now();
+        std::vector<float> fullFeature = extractFeatureByMethod(method, fullImage, &faceDetector);
+        fullExtractMs += elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        std::vector<float> reducedFeature = extractFeatureByMethod(method, reducedImage, &faceDetector);
+        reducedExtractMs += elapsedMs(start);
+
+        if (fullFeatures.appendRow(fullFeature) != 0 || reducedFeatures.appendRow(reducedFeature) != 0) {
+            std::cerr << "Error: features of different lengths for " << full_file_path << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (fullFeatures.rows() < 2) {
+        std::cerr << "Error: need at least two images to measure" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Compare the top K of the full size ranking with the reduced ranking, for evenly spread queries
+    size_t queries = std::min<size_t>(MEASURE_QUERIES, fullFeatures.rows());
+    size_t topK = std::min<size_t>(MEASURE_TOP_K, fullFeatures.rows() - 1);
+    double overlapSum = 0, top1Sum = 0, rankShiftSum = 0;
+    for (size_t q = 0; q < queries; q++) {
+        size_t query = q * fullFeatures.rows() / queries;
+        std::vector<size_t> fullRanking = rankAgainst(method, fullFeatures, query);
+        std::vector<size_t> reducedRanking = rankAgainst(method, reducedFeatures, query);
+
+        // position of every image in the reduced ranking
+        std::vector<size_t> reducedPosition(fullFeatures.rows(), 0);
+        for (size_t r = 0; r < reducedRanking.size(); r++) {
+            reducedPosition[reducedRanking[r]] = r;
+        }
+
+        size_t overlap = 0;
+        for (size_t r = 0; r < topK; r++) {
+            size_t position = reducedPosition[fullRanking[r]];
+            if (position < topK) overlap++;
+            rankShiftSum += position > r ? position - r : r - position;
+        }
+        overlapSum += static_cast<double>(overlap) / topK;
+        top1Sum += fullRanking[0] == reducedRanking[0] ? 1.0 : 0.0;
+    }
+
+    printf("Decode policy %s against full size, method %s, %zu images, %zu queries\n",
+           describeDecodePolicy(policy).c_str(), method.c_str(), fullFeatures.rows(), queries);
+    printf("  decode:  full %10.1f ms  reduced %10.1f ms  speedup %.2fx\n",
+           fullDecodeMs, reducedDecodeMs, reducedDecodeMs > 0 ? fullDecodeMs / reducedDecodeMs : 0.0);
+    printf("  extract: full %10.1f ms  reduced %10.1f ms  speedup %.2fx\n",
+           fullExtractMs, reducedExtractMs, reducedExtractMs > 0 ? fullExtractMs / reducedExtractMs : 0.0);
+    printf("  top %zu overlap: %.3f\n", topK, overlapSum / queries);
+    printf("  top 1 agreement: %.3f\n", top1Sum / queries);
+    printf("  mean rank shift of the full size top %zu: %.2f\n", topK, rankShiftSum / (queries * topK));
+    return 0;
 }
 
 
 int main(int argc, char* argv[]){
+    // Stage timers and counters, see profiler.h
+    profilerInitFromEnv();
+    PROFILE_SCOPE("extractFeature.total");
+
     // Check the number of arguments
     if (argc < 3) {
         extractMenu();
@@ -44,18 +184,7 @@ int main(int argc, char* argv[]){
     }
     // method is the first argument
     std::string method = argv[1];
-    if (method != "b" 
-    && method != "h2" 
-    && method!= "h3" 
-    && method != "m" 
-    && method != "tc" 
-    && method != "glcm"
-    && method != "l"
-    && method != "gabor"
-    && method != "custom_s"
-    && method != "custom_m"
-    && method != "custom_l"
-    && method != "face") {
+    if (!isFeatureMethod(method)) {
         std::cerr << "Error: invalid method" << std::endl;
         extractMenu();
         return EXIT_FAILURE;
@@ -64,186 +193,219 @@ int main(int argc, char* argv[]){
     // Set the directory path from the command line, 2nd argument
     std::string directory_of_images = argv[2];
 
+    // Optional settings after the directory
+    std::string cascadeFile = FACE_CASCADE_FILE;
+    double faceScaleFactor = FACE_SCALE_FACTOR;
+    int faceMinSize = FACE_MIN_SIZE;
+    DecodePolicy decodePolicy = fullDecodePolicy();
+    bool measureDecode = false;
+    bool pipeline = false;
+    PipelineOptions pipelineOptions = defaultPipelineOptions();
+    VideoOptions videoOptions = defaultVideoOptions();
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--cascade" && i + 1 < argc) {
+            cascadeFile = argv[++i];
+        } else if (option == "--face-scale" && i + 1 < argc) {
+            faceScaleFactor = std::stod(argv[++i]);
+        } else if (option == "--face-min-size" && i + 1 < argc) {
+            faceMinSize = std::stoi(argv[++i]);
+        } else if (option == "--decode" && i + 1 < argc) {
+            if (parseDecodePolicy(argv[++i], method, decodePolicy) != 0) {
+                std::cerr << "Error: invalid decode policy " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (option == "--measure-decode") {
+            measureDecode = true;
+        } else if (option == "--pipeline") {
+            pipeline = true;
+        } else if (option == "--threads" && i + 1 < argc) {
+            pipelineOptions.decodeThreads = pipelineOptions.extractThreads = std::stoi(argv[++i]);
+        } else if (option == "--io-threads" && i + 1 < argc) {
+            pipelineOptions.ioThreads = std::stoi(argv[++i]);
+        } else if (option == "--queue-depth" && i + 1 < argc) {
+            pipelineOptions.queueDepth = std::stoi(argv[++i]);
+        } else if (option == "--stride" && i + 1 < argc) {
+            videoOptions.stride = std::stoi(argv[++i]);
+        } else if (option == "--change" && i + 1 < argc) {
+            videoOptions.changeThreshold = std::stod(argv[++i]);
+        } else {
+            std::cerr << "Error: invalid option " << option << std::endl;
+            extractMenu();
+            return EXIT_FAILURE;
+        }
+    }
+    if (faceScaleFactor <= 1.0 || faceMinSize < 0) {
+        std::cerr << "Error: invalid face detector settings" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Face detector shared by all images, load the cascade before touching any file
+    FaceDetector faceDetector(cascadeFile, faceScaleFactor, FACE_MIN_NEIGHBORS, faceMinSize);
+    if (method == "face" && faceDetector.load() != 0) {
+        std::cerr << "Error: cannot load the face cascade file " << cascadeFile << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (pipelineOptions.decodeThreads < 1 || pipelineOptions.ioThreads < 1 || pipelineOptions.queueDepth < 1) {
+        std::cerr << "Error: invalid pipeline settings" << std::endl;
+        return EXIT_FAILURE;
+    }
+
     // Set the csv file name
-    std::string csvFile = "image_features_";
-    if (method == "b") {
-        csvFile += "baseline.csv";
-    } else if (method == "h2") {
-        csvFile += "2D_histogram.csv";
-    } else if (method == "h3") {
-        csvFile += "3D_histogram.csv";
-    } else if (method == "m") {
-        csvFile += "multi_histogram.csv";
-    } else if (method == "tc") {
-        csvFile += "texturecolor.csv";
-    } else if (method == "glcm") {
-        csvFile += "glcm.csv";
-    } else if (method == "l") {
-        csvFile += "laws.csv";
-    } else if (method == "gabor"){
-        csvFile += "gabor.csv";
-    } else if (method == "custom_s") {
-        csvFile += "custom_s.csv";
-    } else if (method == "custom_m") {
-        csvFile += "custom_m.csv";
-    } else if (method == "custom_l") {
-        csvFile += "custom_l.csv";
-    } else if (method == "face") {
-        csvFile += "face.csv";
-    } else {
-        std::cerr << "Error: invalid method" << std::endl;
+    std::string csvFile = "image_features_" + methodCsvName(method) + ".csv";
+
+    if (videoOptions.stride < 1 || videoOptions.changeThreshold < 0) {
+        std::cerr << "Error: invalid video settings" << std::endl;
         return EXIT_FAILURE;
     }
 
-    // delete the existing csv file
-    if (std::remove(csvFile.c_str()) == 0) {
-        std::cout << "Existing CSV file deleted successfully." << std::endl;
-    } else {
-        // if the file does not exist
-        std::cout << "No existing CSV file to delete or deletion failed." << std::endl;
+    if (isVideoInput(directory_of_images)) {
+        if (pipeline || measureDecode) {
+            std::cerr << "Error: --pipeline and --measure-decode need a directory of images" << std::endl;
+            return EXIT_FAILURE;
+        }
+        FILE* fp = fopen(csvFile.c_str(), "w");
+        if (!fp) {
+            std::cerr << "Error: cannot open the csv file " << csvFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        videoOptions.decodePolicy = decodePolicy;
+        VideoStats stats;
+        int error = extractVideoFeatures(method, directory_of_images, fp, videoOptions, faceDetector, stats);
+        if (fclose(fp) != 0 || error != 0) {
+            return EXIT_FAILURE;
+        }
+        printf("Video: %zu frames, %zu on the stride, %zu indexed, %zu skipped as unchanged, %zu failed\n",
+               stats.frames, stats.candidates, stats.indexed, stats.unchanged, stats.failed);
+        std::cout << "Feature extraction is written to " << csvFile << std::endl;
+        return 0;
     }
-    
-    // Read the images from the directory
-    std::vector<std::pair<std::string, float>> image_distance_pairs;
-    DIR *dir;
-    struct dirent* ent;
 
-    if ((dir = opendir(directory_of_images.c_str())) != NULL) {
-        while ((ent = readdir(dir)) != NULL) {
-            std::string file_name = ent->d_name;
-            // Skip current directory and parent directory entries
-            if (file_name == "." || file_name == "..") continue;
+    bool tarInput = isTarInput(directory_of_images);
+    if (tarInput && measureDecode) {
+        std::cerr << "Error: --measure-decode needs a directory of images" << std::endl;
+        return EXIT_FAILURE;
+    }
 
-            std::string full_file_path = directory_of_images + "/" + file_name;
-            std::string extension = file_name.substr(file_name.find_last_of(".") + 1);
+    if (pipeline && !measureDecode) {
+        // the pipeline lists the directory itself and rewrites the csv file
+        pipelineOptions.decodePolicy = decodePolicy;
+        int error = tarInput ? runTarExtractPipeline(method, directory_of_images, csvFile, pipelineOptions, faceDetector)
+                             : runExtractPipeline(method, directory_of_images, csvFile, pipelineOptions, faceDetector);
+        if (error != 0) {
+            return EXIT_FAILURE;
+        }
+        std::cout << "Feature extraction is written to " << csvFile << std::endl;
+        return 0;
+    }
+
+    // buffers of the extractors, reused from one image to the next
+    ExtractScratch scratch;
 
-            // Skip files that are not images
-            if (extension != "jpg" && extension != "jpeg" && extension != "png" && extension != "tif") {
-                std::cerr << "Skipping non-image file: " << full_file_path << std::endl;
+    if (tarInput) {
+        // one member at a time, straight from the archive into the decoder
+        TarReader reader;
+        if (reader.open(directory_of_images) != 0) {
+            std::cerr << "Error: cannot open the archive " << directory_of_images << std::endl;
+            return EXIT_FAILURE;
+        }
+        FILE* fp = fopen(csvFile.c_str(), "w");
+        if (!fp) {
+            std::cerr << "Error: cannot open the csv file " << csvFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (!isFullDecode(decodePolicy)) {
+            std::cout << "Decoding images at " << describeDecodePolicy(decodePolicy) << std::endl;
+        }
+        TarMember member;
+        std::vector<uchar> bytes;
+        int status;
+        while ((status = reader.next(member)) > 0) {
+            if (!isImageFileName(member.path)) {
+                std::cerr << "Skipping non-image file: " << member.path << std::endl;
                 continue;
             }
-
-            cv::Mat img = cv::imread(full_file_path, cv::IMREAD_COLOR);
+            // the path is the row key, it must read back as one CSV column
+            if (!isCsvFilename(member.path)) {
+                std::cerr << "Skipping a member whose path is too long or has a comma or line break: "
+                          << member.path.substr(0, 80) << std::endl;
+                continue;
+            }
+            if (reader.read(bytes) != 0) {
+                status = -1;
+                break;
+            }
+            cv::Mat img = decodeImage(bytes, decodePolicy);
             if (img.empty()) {
-                std::cerr << "Could not read the image: " << full_file_path << std::endl;
+                std::cerr << "Could not read the image: " << member.path << std::endl;
                 continue;
             }
-
-            // Extract the feature vector from the image from specified method
-            if (method == "b") {
-                // extract the feature vector from the all the images
-                std::vector<float> feature = extract7x7FeatureVector(img);
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "h2") {
-                // Extract RG Chroma Histogram features
-                std::vector<float> feature = calculateRG_2DChromaHistogram(img, BINS_2D); // 16 bins per channel as an example
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "h3") {
-                // Extract RGB 3D Color Histogram features
-                std::vector<float> feature = calculateRGB_3DChromaHistogram(img, BINS_3D); // 8 bins per channel as an example
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "m") {
-                // Extract Multi-RG Chroma Histogram features
-                std::vector<float> feature = calculateMultiPartRGBHistogram(img, BINS_3D); // 8 bins per channel as an example
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "tc") {
-                // Extract Texture features
-                std::vector<float> feature = calculateColorTextureFeatureVector(img, COLOR_BINS, TEXTURE_BINS);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "glcm") {
-                // Extract Color features
-                std::vector<float> feature = calculateGLCMFeatures(img, GLCM_DISTANCE, GLCM_ANGLE, GLCM_LEVELS);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "l") {
-                // Extract Color features
-                std::vector<float> feature = calculateLawsTextureFeatures(img);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "gabor") {
-                std::vector<float> feature = computeGaborFeatures(img);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "custom_s") {
-                std::vector<float> feature = calculateCustomFeature(img, BINS_3D, WEIGHT_CONFIG_S);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "custom_m") {
-                std::vector<float> feature = calculateCustomFeature(img, BINS_3D, WEIGHT_CONFIG_M);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "custom_l") {
-                std::vector<float> feature = calculateCustomFeature(img, BINS_3D, WEIGHT_CONFIG_L);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else if (method == "face") {
-                std::vector<float> feature = extractFaceFeatures(img);
-                // Write the features to the CSV file
-                int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
-                if (error) {
-                    std::cerr << "Error: cannot append to the csv file" << std::endl;
-                    return EXIT_FAILURE;
-                }
-            } else {
-                std::cerr << "Error: invalid method" << std::endl;
+            const std::vector<float>& feature = extractFeatureByMethod(method, img, &faceDetector, scratch);
+            PROFILE_SCOPE("extractFeature.append_row");
+            if (write_image_data_csv_row(fp, member.path.c_str(), feature) != 0) {
+                std::cerr << "Error: cannot append to the csv file" << std::endl;
+                fclose(fp);
                 return EXIT_FAILURE;
-            } 
+            }
         }
-        closedir(dir);
-    } else {
+        if (fclose(fp) != 0) {
+            std::cerr << "Error: cannot write the csv file " << csvFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        if (status < 0) {
+            std::cerr << "Error: damaged or truncated archive " << directory_of_images << ", the rows before it are written" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Feature extraction is written to " << csvFile << std::endl;
+        return 0;
+    }
+
+    // Read the image names from the directory
+    std::vector<std::string> file_names;
+    if (listImageFiles(directory_of_images, file_names) != 0) {
         std::cerr << "Error: cannot open directory " << directory_of_images << std::endl;
         return EXIT_FAILURE;
     }
 
+    if (measureDecode) {
+        return measureDecodePolicy(method, directory_of_images, file_names, decodePolicy, faceDetector);
+    }
+
+    // delete the existing csv file
+    if (std::remove(csvFile.c_str()) == 0) {
+        std::cout << "Existing CSV file deleted successfully." << std::endl;
+    } else {
+        // if the file does not exist
+        std::cout << "No existing CSV file to delete or deletion failed." << std::endl;
+    }
+
+    if (!isFullDecode(decodePolicy)) {
+        std::cout << "Decoding images at " << describeDecodePolicy(decodePolicy) << std::endl;
+    }
+
+    for (const std::string& file_name : file_names) {
+        std::string full_file_path = directory_of_images + "/" + file_name;
+
+        cv::Mat img = readImage(full_file_path, decodePolicy);
+        if (img.empty()) {
+            std::cerr << "Could not read the image: " << full_file_path << std::endl;
+            continue;
+        }
+
+        // Extract the feature vector from the image from specified method
+        const std::vector<float>& feature = extractFeatureByMethod(method, img, &faceDetector, scratch);
+
+        // Write the features to the CSV file
+        PROFILE_SCOPE("extractFeature.append_row");
+        int error = append_image_data_csv(const_cast<char*>(csvFile.c_str()), const_cast<char*>(file_name.c_str()), feature, false);
+        if (error) {
+            std::cerr << "Error: cannot append to the csv file" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
     std::cout << "Feature extraction is written to " << csvFile << std::endl;
     return 0;
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,335 @@
+/**
+ * @file extractPipeline.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief list, read, decode, extract and write stages running at the same time over bounded queues
+ * @version 0.1
+ * @date 2024-02-21
+*/
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <algorithm>
+#include <dirent.h>
+#include <opencv2/opencv.hpp>
+#include "boundedQueue.h"
+#include "csv_util.h"
+#include "featureMethods.h"
+#include "extractScratch.h"
+#include "imageIO.h"
+#include "tarReader.h"
+#include "extractPipeline.h"
+
+
+// One image on its way through the stages
+struct PipelineItem {
+    size_t sequence;
+    std::string file_name;
+    std::vector<uchar> bytes;
+    cv::Mat image;
+    std::vector<float> feature;
+    bool ok;
+};
+
+// Time and item counters of one stage, summed over its threads
+struct StageStats {
+    const char* name;
+    int threads;
+    std::atomic<long long> items;
+    std::atomic<long long> busyNs;
+    std::atomic<long long> waitNs;
+};
+
+typedef BoundedQueue<PipelineItem> PipelineQueue;
+typedef std::chrono::steady_clock PipelineClock;
+
+static long long elapsedNs(const PipelineClock::time_point& start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(PipelineClock::now() - start).count();
+}
+
+// Pop from a queue, counting the time spent waiting for the upstream stage
+static bool timedPop(PipelineQueue& queue, PipelineItem& item, StageStats& stats) {
+    PipelineClock::time_point start = PipelineClock::now();
+    bool ok = queue.pop(item);
+    stats.waitNs += elapsedNs(start);
+    return ok;
+}
+
+// Push to a queue, counting the time spent waiting for the downstream stage
+static bool timedPush(PipelineQueue& queue, PipelineItem item, StageStats& stats) {
+    PipelineClock::time_point start = PipelineClock::now();
+    bool ok = queue.push(std::move(item));
+    stats.waitNs += elapsedNs(start);
+    return ok;
+}
+
+/*
+  Runs a stage on its own threads: pop an item, work on it, push it on.
+  The last thread of the stage to finish closes the output queue.
+ */
+static void runStage(std::vector<std::thread>& threads, StageStats& stats, PipelineQueue& input, PipelineQueue& output,
+                     std::atomic<int>& running, std::function<void(PipelineItem&)> work) {
+    running = stats.threads;
+    for (int t = 0; t < stats.threads; t++) {
+        threads.emplace_back([&stats, &input, &output, &running, work]() {
+            PipelineItem item;
+            while (timedPop(input, item, stats)) {
+                PipelineClock::time_point start = PipelineClock::now();
+                if (item.ok) {
+                    work(item);
+                }
+                stats.busyNs += elapsedNs(start);
+                stats.items++;
+                if (!timedPush(output, std::move(item), stats)) break;
+            }
+            if (--running == 0) {
+                output.close();
+            }
+        });
+    }
+}
+
+// defaults: PIPELINE_IO_THREADS readers, one decoder and one extractor per core, full decode
+PipelineOptions defaultPipelineOptions() {
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    PipelineOptions options;
+    options.ioThreads = PIPELINE_IO_THREADS;
+    options.decodeThreads = cores;
+    options.extractThreads = cores;
+    options.queueDepth = PIPELINE_QUEUE_DEPTH;
+    options.decodePolicy = fullDecodePolicy();
+    return options;
+}
+
+// Print how busy each stage was, the busiest stage is the one that sets the pace
+static void printStageStats(StageStats* stages, int count, double wallMs, size_t written) {
+    printf("%-8s %7s %8s %11s %11s %12s\n", "stage", "threads", "items", "busy ms", "wait ms", "utilization");
+    for (int i = 0; i < count; i++) {
+        StageStats& s = stages[i];
+        double busyMs = s.busyNs / 1e6;
+        double waitMs = s.waitNs / 1e6;
+        double utilization = wallMs > 0 ? busyMs / (wallMs * s.threads) : 0.0;
+        printf("%-8s %7d %8lld %11.1f %11.1f %11.1f%%\n", s.name, s.threads, s.items.load(), busyMs, waitMs, 100.0 * utilization);
+    }
+    printf("Pipeline wrote %zu rows in %.1f ms\n", written, wallMs);
+}
+
+/*
+  Next image of the input for the list stage, in input order: fills
+  file_name, and bytes when the input hands them out itself.
+  Returns 1 with an item, 0 at the end of the input, -1 if the input is damaged.
+ */
+typedef std::function<int(PipelineItem&)> PipelineSource;
+
+/*
+  Runs the stages from a source. listName names the first stage in the
+  report, location is put in front of the file names in messages, and
+  load fills in the bytes in the read stage.
+ */
+static int runPipeline(const std::string& method, const char* listName, PipelineSource source, const std::string& location,
+                       std::function<void(PipelineItem&)> load, const std::string& csvFile,
+                       const PipelineOptions& options, FaceDetector& faceDetector) {
+    FILE *fp = fopen(csvFile.c_str(), "w");
+    if (!fp) {
+        std::cerr << "Error: cannot open the csv file " << csvFile << std::endl;
+        return -1;
+    }
+
+    size_t depth = static_cast<size_t>(std::max(1, options.queueDepth));
+    PipelineQueue named(depth), loaded(depth), decoded(depth), extracted(depth);
+    StageStats stages[5] = {
+        {listName, 1, {0}, {0}, {0}},
+        {"read", std::max(1, options.ioThreads), {0}, {0}, {0}},
+        {"decode", std::max(1, options.decodeThreads), {0}, {0}, {0}},
+        {"extract", std::max(1, options.extractThreads), {0}, {0}, {0}},
+        {"write", 1, {0}, {0}, {0}},
+    };
+    PipelineClock::time_point pipelineStart = PipelineClock::now();
+    std::vector<std::thread> threads;
+
+    // list: hand out the images in input order
+    std::atomic<int> sourceError(0);
+    threads.emplace_back([&]() {
+        StageStats& stats = stages[0];
+        size_t sequence = 0;
+        PipelineClock::time_point start = PipelineClock::now();
+        for (;;) {
+            PipelineItem item;
+            int status = source(item);
+            if (status <= 0) {
+                sourceError = status;
+                break;
+            }
+            item.sequence = sequence++;
+            item.ok = true;
+            stats.busyNs += elapsedNs(start);
+            stats.items++;
+            if (!timedPush(named, std::move(item), stats)) break;
+            start = PipelineClock::now();
+        }
+        named.close();
+    });
+
+    // read: the bytes the source did not hand out
+    std::atomic<int> reading(0), decoding(0), extracting(0);
+    runStage(threads, stages[1], named, loaded, reading, load);
+
+    // decode: from memory, with the decode policy
+    runStage(threads, stages[2], loaded, decoded, decoding, [&](PipelineItem& item) {
+        item.image = decodeImage(item.bytes, options.decodePolicy);
+        std::vector<uchar>().swap(item.bytes);
+        if (item.image.empty()) {
+            std::cerr << "Could not read the image: " << location + item.file_name << std::endl;
+            item.ok = false;
+        }
+    });
+
+    // extract: the extractors do not share state, the face detector lends each thread its own classifier
+    // and every extract thread keeps its own scratch, so only the row travelling to the writer is allocated
+    runStage(threads, stages[3], decoded, extracted, extracting, [&](PipelineItem& item) {
+        static thread_local ExtractScratch scratch;
+        try {
+            const std::vector<float>& feature = extractFeatureByMethod(method, item.image, &faceDetector, scratch);
+            item.feature.assign(feature.begin(), feature.end());
+        } catch (const std::exception& e) {
+            std::cerr << "Could not extract " << item.file_name << ": " << e.what() << std::endl;
+            item.ok = false;
+        }
+        item.image.release();
+    });
+
+    // write: rows go out in input order, early arrivals wait in a reorder buffer
+    size_t written = 0;
+    int writeError = 0;
+    {
+        StageStats& stats = stages[4];
+        std::map<size_t, PipelineItem> pending;
+        size_t next = 0;
+        PipelineItem item;
+        while (timedPop(extracted, item, stats)) {
+            PipelineClock::time_point start = PipelineClock::now();
+            pending[item.sequence] = std::move(item);
+            for (auto it = pending.find(next); it != pending.end(); it = pending.find(next)) {
+                PipelineItem& ready = it->second;
+                if (ready.ok && !writeError) {
+                    if (write_image_data_csv_row(fp, ready.file_name.c_str(), ready.feature) != 0) {
+                        std::cerr << "Error: cannot append to the csv file" << std::endl;
+                        writeError = -1;
+                        // unblock the upstream stages, they stop at their next push
+                        named.close();
+                        loaded.close();
+                        decoded.close();
+                    } else {
+                        written++;
+                    }
+                }
+                pending.erase(it);
+                next++;
+                stats.items++;
+            }
+            stats.busyNs += elapsedNs(start);
+        }
+    }
+
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    if (fclose(fp) != 0) {
+        writeError = -1;
+    }
+    if (sourceError != 0) {
+        std::cerr << "Error: the input ends in a damaged entry, the rows before it are written" << std::endl;
+        writeError = -1;
+    }
+
+    printStageStats(stages, 5, elapsedNs(pipelineStart) / 1e6, written);
+    return writeError;
+}
+
+// extract the features of every image of a directory into csvFile
+int runExtractPipeline(const std::string& method, const std::string& directory_of_images, const std::string& csvFile,
+                       const PipelineOptions& options, FaceDetector& faceDetector) {
+    DIR *dir = opendir(directory_of_images.c_str());
+    if (dir == NULL) {
+        std::cerr << "Error: cannot open directory " << directory_of_images << std::endl;
+        return -1;
+    }
+    std::string location = directory_of_images + "/";
+
+    // the names in directory order, the read stage loads the files. Each file is prefetched as it is listed,
+    // up to a queue depth ahead of the readers, so its pages are on the way before a reader blocks on it
+    PipelineSource source = [&](PipelineItem& item) -> int {
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != NULL) {
+            std::string file_name = ent->d_name;
+            if (file_name == "." || file_name == "..") continue;
+            if (!isImageFileName(file_name)) {
+                std::cerr << "Skipping non-image file: " << location + file_name << std::endl;
+                continue;
+            }
+            item.file_name = file_name;
+            prefetchFile(location + file_name);
+            return 1;
+        }
+        return 0;
+    };
+    // whole files into memory, usually already in the page cache from the prefetch
+    auto load = [&](PipelineItem& item) {
+        if (readFileBytes(location + item.file_name, item.bytes) != 0) {
+            std::cerr << "Could not read the image: " << location + item.file_name << std::endl;
+            item.ok = false;
+        }
+    };
+
+    int result = runPipeline(method, "list", source, location, load, csvFile, options, faceDetector);
+    closedir(dir);
+    return result;
+}
+
+// extract the features of every image member of a tar archive into csvFile
+int runTarExtractPipeline(const std::string& method, const std::string& archive, const std::string& csvFile,
+                          const PipelineOptions& options, FaceDetector& faceDetector) {
+    TarReader reader;
+    if (reader.open(archive) != 0) {
+        std::cerr << "Error: cannot open the archive " << archive << std::endl;
+        return -1;
+    }
+    std::string location = (archive == "-" ? std::string("stdin") : archive) + ":";
+
+    // the archive is a stream, one thread unpacks the members with their bytes and the read stage has nothing left to do
+    PipelineSource source = [&](PipelineItem& item) -> int {
+        TarMember member;
+        int status;
+        while ((status = reader.next(member)) > 0) {
+            if (!isImageFileName(member.path)) {
+                std::cerr << "Skipping non-image file: " << location + member.path << std::endl;
+                continue;
+            }
+            // the path is the row key, it must read back as one CSV column
+            if (!isCsvFilename(member.path)) {
+                std::cerr << "Skipping a member whose path is too long or has a comma or line break: "
+                          << member.path.substr(0, 80) << std::endl;
+                continue;
+            }
+            item.file_name = member.path;
+            if (reader.read(item.bytes) != 0) {
+                return -1;
+            }
+            return 1;
+        }
+        if (status < 0) {
+            std::cerr << "Error: damaged or truncated archive " << archive << std::endl;
+        }
+        return status;
+    };
+    PipelineOptions tarOptions = options;
+    tarOptions.ioThreads = 1;
+
+    return runPipeline(method, "unpack", source, location, [](PipelineItem&) {}, csvFile, tarOptions, faceDetector);
+}
@@ -0,0 +1,49 @@
+/**
+ * @file extractScratch.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief reusable buffers of the feature extractors, one scratch per extraction thread
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "extractScratch.h"
+
+
+ExtractScratch::ExtractScratch(size_t outputCapacity) {
+    output_.reserve(outputCapacity);
+}
+
+cv::Mat& ExtractScratch::mat(ScratchMat slot, int rows, int cols, int type) {
+    size_t needed = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+    cv::Mat& buffer = buffers_[slot];
+    if (buffer.total() < needed) {
+        buffer.create(1, static_cast<int>(needed), CV_8UC1);
+    }
+    // a header over external data has no reference count, assigning it allocates nothing
+    views_[slot] = cv::Mat(rows, cols, type, buffer.data);
+    return views_[slot];
+}
+
+float* ExtractScratch::rows(ScratchRows slot, size_t n) {
+    std::vector<float>& buffer = rows_[slot];
+    if (buffer.size() < n) {
+        buffer.resize(n);
+    }
+    return buffer.data();
+}
+
+size_t ExtractScratch::bytes() const {
+    size_t total = output_.capacity() * sizeof(float) + rgbIntegral_.bytes() + gradientIntegral_.bytes();
+    for (const cv::Mat& m : buffers_) {
+        total += m.total();
+    }
+    for (const std::vector<float>& r : rows_) {
+        total += r.capacity() * sizeof(float);
+    }
+    for (const cv::Mat& k : kernels_) {
+        total += k.total() * k.elemSize();
+    }
+    return total;
+}
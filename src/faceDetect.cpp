@@ -5,7 +5,8 @@
 
   Functions for finding faces and drawing boxes around them
 
-  The path to the Haar cascade file is define in faceDetect.h
+  The default path to the Haar cascade file is defined in faceDetect.h,
+  a FaceDetector can be given any other cascade file
 */
 #include <cmath>
 #include <cstdio>
@@ -14,41 +15,85 @@
 #include "faceDetect.h"
 #include "csv_util.h"
 
+FaceDetector::FaceDetector(const std::string& cascadeFile, double scaleFactor, int minNeighbors, int minSize)
+  : cascadeFile_(cascadeFile), scaleFactor_(scaleFactor), minNeighbors_(minNeighbors), minSize_(minSize) {
+}
+
+/*
+  Loads the cascade into a first worker so a bad path is reported
+  before any image is processed.
+
+  Returns 0 on success, -1 if the cascade file cannot be loaded.
+ */
+int FaceDetector::load() {
+  Worker *worker = acquire();
+  if( !worker ) {
+    return(-1);
+  }
+  release( worker );
+  return(0);
+}
+
+FaceDetector::Worker *FaceDetector::acquire() {
+  {
+    std::lock_guard<std::mutex> lock( mutex_ );
+    if( !idle_.empty() ) {
+      Worker *worker = idle_.back();
+      idle_.pop_back();
+      return(worker);
+    }
+  }
+
+  // load outside the lock, other threads keep detecting meanwhile
+  std::unique_ptr<Worker> worker( new Worker() );
+  if( !worker->cascade.load( cascadeFile_ ) ) {
+    printf("Unable to load face cascade file %s\n", cascadeFile_.c_str() );
+    return(nullptr);
+  }
+
+  std::lock_guard<std::mutex> lock( mutex_ );
+  workers_.push_back( std::move(worker) );
+  return(workers_.back().get());
+}
+
+void FaceDetector::release( Worker *worker ) {
+  std::lock_guard<std::mutex> lock( mutex_ );
+  idle_.push_back( worker );
+}
+
+size_t FaceDetector::poolSize() {
+  std::lock_guard<std::mutex> lock( mutex_ );
+  return(workers_.size());
+}
+
 /*
   Arguments:
   cv::Mat grey  - a greyscale source image in which to detect faces
   std::vector<cv::Rect> &faces - a standard vector of cv::Rect rectangles indicating where faces were found
      if the length of the vector is zero, no faces were found
- */
-int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces ) {
-  // a static variable to hold a half-size image
-  static cv::Mat half;
-  
-  // a static variable to hold the classifier
-  static cv::CascadeClassifier face_cascade;
-
-  // the path to the haar cascade file
-  static cv::String face_cascade_file(FACE_CASCADE_FILE);
-
-  if( face_cascade.empty() ) {
-    if( !face_cascade.load( face_cascade_file ) ) {
-      printf("Unable to load face cascade file\n");
-      printf("Terminating\n");
-      exit(-1);
-    }
-  }
 
+  Returns 0 on success, -1 if the cascade file cannot be loaded.
+ */
+int FaceDetector::detect( const cv::Mat &grey, std::vector<cv::Rect> &faces ) {
   // clear the vector of faces
   faces.clear();
-  
+
+  Worker *worker = acquire();
+  if( !worker ) {
+    return(-1);
+  }
+
   // cut the image size in half to reduce processing time
-  cv::resize( grey, half, cv::Size(grey.cols/2, grey.rows/2) );
+  cv::resize( grey, worker->half, cv::Size(grey.cols/2, grey.rows/2) );
 
   // equalize the image
-  cv::equalizeHist( half, half );
+  cv::equalizeHist( worker->half, worker->equalized );
+
+  // apply the Haar cascade detector, the minimum size is given for the full size image
+  worker->cascade.detectMultiScale( worker->equalized, faces, scaleFactor_, minNeighbors_, 0,
+                                    cv::Size(minSize_/2, minSize_/2) );
 
-  // apply the Haar cascade detector
-  face_cascade.detectMultiScale( half, faces );
+  release( worker );
 
   // adjust the rectangle sizes back to the full size image
   for(int i=0;i<faces.size();i++) {
@@ -61,6 +106,25 @@ int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces ) {
   return(0);
 }
 
+FaceDetector &defaultFaceDetector() {
+  // initialized once, thread safe since C++11
+  static FaceDetector detector;
+  return(detector);
+}
+
+/*
+  Arguments:
+  cv::Mat grey  - a greyscale source image in which to detect faces
+  std::vector<cv::Rect> &faces - a standard vector of cv::Rect rectangles indicating where faces were found
+     if the length of the vector is zero, no faces were found
+
+  Uses the default detector on FACE_CASCADE_FILE.
+  Returns 0 on success, -1 if the cascade file cannot be loaded.
+ */
+int detectFaces( cv::Mat &grey, std::vector<cv::Rect> &faces ) {
+  return(defaultFaceDetector().detect( grey, faces ));
+}
+
 /* Draws rectangles into frame given a vector of rectangles
    
    Arguments:
@@ -91,6 +155,11 @@ int drawBoxes( cv::Mat &frame, std::vector<cv::Rect> &faces, int minWidth, float
 // EXTENSION: face detection and feature extraction
 // Define a function to extract face features
 std::vector<float> extractFaceFeatures(cv::Mat& img) {
+    return extractFaceFeatures(img, defaultFaceDetector());
+}
+
+// Extract face features with a given detector, safe to call from several threads
+std::vector<float> extractFaceFeatures(const cv::Mat& img, FaceDetector& detector) {
     cv::Mat gray;
     std::vector<cv::Rect> faces;
     std::vector<float> features;
@@ -103,7 +172,9 @@ std::vector<float> extractFaceFeatures(cv::Mat& img) {
     }
 
     // Detect faces
-    detectFaces(gray, faces);
+    if (detector.detect(gray, faces) != 0) {
+        throw std::runtime_error("Unable to load face cascade file " + detector.cascadeFile());
+    }
 
     // For simplicity, use face rectangle (x, y, width, height) as features
     for (auto& face : faces) {
@@ -115,5 +186,3 @@ std::vector<float> extractFaceFeatures(cv::Mat& img) {
 
     return features;
 }
-
-
@@ -0,0 +1,244 @@
+/**
+ * @file featureMatrix.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief feature database stored as one contiguous row-major block with aligned, padded rows
+ * @version 0.1
+ * @date 2024-02-24
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include "featureMatrix.h"
+
+
+size_t featureMatrixStride(size_t cols) {
+    const size_t floatsPerLine = FEATURE_MATRIX_ALIGN / sizeof(float);
+    return (cols + floatsPerLine - 1) / floatsPerLine * floatsPerLine;
+}
+
+FeatureMatrix::FeatureMatrix()
+    : data_(nullptr), rows_(0), cols_(0), stride_(0), capacity_(0), hugePages_(false), unitRows_(false) {}
+
+FeatureMatrix::~FeatureMatrix() {
+    free(data_);
+}
+
+FeatureMatrix::FeatureMatrix(FeatureMatrix&& other) noexcept
+    : data_(other.data_), rows_(other.rows_), cols_(other.cols_), stride_(other.stride_),
+      capacity_(other.capacity_), hugePages_(other.hugePages_), unitRows_(other.unitRows_),
+      columnOrder_(std::move(other.columnOrder_)) {
+    other.data_ = nullptr;
+    other.rows_ = other.cols_ = other.stride_ = other.capacity_ = 0;
+}
+
+FeatureMatrix& FeatureMatrix::operator=(FeatureMatrix&& other) noexcept {
+    if (this != &other) {
+        free(data_);
+        data_ = other.data_;
+        rows_ = other.rows_;
+        cols_ = other.cols_;
+        stride_ = other.stride_;
+        capacity_ = other.capacity_;
+        hugePages_ = other.hugePages_;
+        unitRows_ = other.unitRows_;
+        columnOrder_ = std::move(other.columnOrder_);
+        other.data_ = nullptr;
+        other.rows_ = other.cols_ = other.stride_ = other.capacity_ = 0;
+    }
+    return *this;
+}
+
+// Move the rows to a block with room for the given number of rows
+int FeatureMatrix::grow(size_t rows) {
+    size_t bytes = rows * stride_ * sizeof(float);
+    size_t alignment = hugePages_ ? FEATURE_MATRIX_HUGE_PAGE : FEATURE_MATRIX_ALIGN;
+    if (hugePages_) {
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+    }
+    void* block = nullptr;
+    if (posix_memalign(&block, alignment, bytes) != 0) {
+        return -1;
+    }
+#ifdef MADV_HUGEPAGE
+    if (hugePages_) {
+        madvise(block, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    // zero the padding, and the unused rows so they never hold garbage
+    memset(block, 0, bytes);
+    if (data_) {
+        memcpy(block, data_, rows_ * stride_ * sizeof(float));
+        free(data_);
+    }
+    data_ = static_cast<float*>(block);
+    capacity_ = bytes / (stride_ * sizeof(float));
+    return 0;
+}
+
+int FeatureMatrix::reserve(size_t rows, size_t cols) {
+    if (cols == 0 || (cols_ != 0 && cols != cols_)) {
+        return -1;
+    }
+    cols_ = cols;
+    stride_ = featureMatrixStride(cols);
+    return rows > capacity_ ? grow(rows) : 0;
+}
+
+int FeatureMatrix::appendRow(const float* values, size_t count) {
+    if (cols_ == 0) {
+        if (reserve(64, count) != 0) {
+            return -1;
+        }
+    } else if (count != cols_) {
+        return -1;
+    }
+    // double the block when it is full, so loading n rows copies O(n) floats; a reserve(0, cols) leaves no block
+    if (rows_ == capacity_ && grow(std::max<size_t>(capacity_ * 2, 64)) != 0) {
+        return -1;
+    }
+    if (columnOrder_.empty()) {
+        memcpy(row(rows_), values, count * sizeof(float));
+    } else {
+        float* out = row(rows_);
+        for (size_t i = 0; i < count; i++) {
+            out[i] = values[columnOrder_[i]];
+        }
+    }
+    rows_++;
+    unitRows_ = false;
+    return 0;
+}
+
+void FeatureMatrix::clear() {
+    free(data_);
+    data_ = nullptr;
+    rows_ = cols_ = stride_ = capacity_ = 0;
+    unitRows_ = false;
+    columnOrder_.clear();
+}
+
+std::vector<float> FeatureMatrix::rowVector(size_t r) const {
+    const float* values = row(r);
+    if (columnOrder_.empty()) {
+        return std::vector<float>(values, values + cols_);
+    }
+    std::vector<float> original(cols_);
+    for (size_t i = 0; i < cols_; i++) {
+        original[columnOrder_[i]] = values[i];
+    }
+    return original;
+}
+
+std::vector<float> FeatureMatrix::toColumnOrder(const std::vector<float>& values) const {
+    if (columnOrder_.empty()) {
+        return values;
+    }
+    std::vector<float> ordered(cols_);
+    for (size_t i = 0; i < cols_; i++) {
+        ordered[i] = values[columnOrder_[i]];
+    }
+    return ordered;
+}
+
+void FeatureMatrix::orderColumnsByVariance() {
+    if (rows_ == 0) {
+        return;
+    }
+    // variance of each stored column
+    std::vector<double> sum(cols_, 0.0), sumSquares(cols_, 0.0);
+    for (size_t r = 0; r < rows_; r++) {
+        const float* values = row(r);
+        for (size_t i = 0; i < cols_; i++) {
+            sum[i] += values[i];
+            sumSquares[i] += static_cast<double>(values[i]) * values[i];
+        }
+    }
+    std::vector<std::pair<double, int>> variance(cols_);
+    for (size_t i = 0; i < cols_; i++) {
+        double mean = sum[i] / rows_;
+        variance[i] = std::make_pair(sumSquares[i] / rows_ - mean * mean, static_cast<int>(i));
+    }
+    std::stable_sort(variance.begin(), variance.end(), [](const std::pair<double, int>& a, const std::pair<double, int>& b) {
+        return a.first > b.first;
+    });
+
+    // move the values of every row, and compose with an earlier order
+    std::vector<float> buffer(cols_);
+    for (size_t r = 0; r < rows_; r++) {
+        float* values = row(r);
+        for (size_t i = 0; i < cols_; i++) {
+            buffer[i] = values[variance[i].second];
+        }
+        memcpy(values, buffer.data(), cols_ * sizeof(float));
+    }
+    std::vector<int> order(cols_);
+    for (size_t i = 0; i < cols_; i++) {
+        order[i] = columnOrder_.empty() ? variance[i].second : columnOrder_[variance[i].second];
+    }
+    columnOrder_.swap(order);
+}
+
+unsigned long long FeatureMatrix::fingerprint() const {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t r = 0; r < rows_; r++) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(row(r));
+        for (size_t i = 0; i < cols_ * sizeof(float); i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+void FeatureMatrix::normalizeRows() {
+    for (size_t r = 0; r < rows_; r++) {
+        float* values = row(r);
+        double sum = 0;
+        for (size_t i = 0; i < cols_; i++) {
+            sum += static_cast<double>(values[i]) * values[i];
+        }
+        if (sum > 0) {
+            float scale = static_cast<float>(1.0 / std::sqrt(sum));
+            for (size_t i = 0; i < cols_; i++) {
+                values[i] *= scale;
+            }
+        }
+    }
+    unitRows_ = true;
+}
+
+void matrixVectorDot(const FeatureMatrix& matrix, const float* query, float* scores) {
+    size_t n = matrix.cols();
+    size_t r = 0;
+    for (; r + 4 <= matrix.rows(); r += 4) {
+        const float* a0 = matrix.row(r);
+        const float* a1 = matrix.row(r + 1);
+        const float* a2 = matrix.row(r + 2);
+        const float* a3 = matrix.row(r + 3);
+        float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (size_t i = 0; i < n; i++) {
+            float q = query[i];
+            s0 += a0[i] * q;
+            s1 += a1[i] * q;
+            s2 += a2[i] * q;
+            s3 += a3[i] * q;
+        }
+        scores[r] = s0;
+        scores[r + 1] = s1;
+        scores[r + 2] = s2;
+        scores[r + 3] = s3;
+    }
+    for (; r < matrix.rows(); r++) {
+        const float* a = matrix.row(r);
+        float s = 0;
+        for (size_t i = 0; i < n; i++) {
+            s += a[i] * query[i];
+        }
+        scores[r] = s;
+    }
+}
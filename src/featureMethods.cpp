@@ -0,0 +1,154 @@
+/**
+ * @file featureMethods.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief maps a method name to its feature extractor, feature file and matching metric
+ * @version 0.1
+ * @date 2024-02-20
+*/
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <opencv2/opencv.hpp>
+#include "matchings.h"
+#include "faceDetect.h"
+#include "extractScratch.h"
+#include "featureMethods.h"
+#include "profiler.h"
+
+
+// all the methods accepted by extractFeature, in menu order
+const std::vector<std::string>& featureMethodNames() {
+    static const std::vector<std::string> names = {
+        "b", "h2", "h3", "m", "tc", "glcm", "l", "gabor", "custom_s", "custom_m", "custom_l", "face"
+    };
+    return names;
+}
+
+bool isFeatureMethod(const std::string& method) {
+    const std::vector<std::string>& names = featureMethodNames();
+    return std::find(names.begin(), names.end(), method) != names.end();
+}
+
+// name used in the feature file, image_features_<name>.csv
+std::string methodCsvName(const std::string& method) {
+    if (method == "b") {
+        return "baseline";
+    } else if (method == "h2") {
+        return "2D_histogram";
+    } else if (method == "h3") {
+        return "3D_histogram";
+    } else if (method == "m") {
+        return "multi_histogram";
+    } else if (method == "tc") {
+        return "texturecolor";
+    } else if (method == "glcm") {
+        return "glcm";
+    } else if (method == "l") {
+        return "laws";
+    } else if (method == "gabor") {
+        return "gabor";
+    } else if (method == "custom_s" || method == "custom_m" || method == "custom_l" || method == "face") {
+        return method;
+    }
+    throw std::runtime_error("Invalid method: " + method);
+}
+
+// extract the feature vector of an image with the method
+std::vector<float> extractFeatureByMethod(const std::string& method, const cv::Mat& image, FaceDetector* faceDetector) {
+    ExtractScratch scratch(0);
+    return extractFeatureByMethod(method, image, faceDetector, scratch);
+}
+
+// the same into the scratch's output, with the scratch's buffers
+const std::vector<float>& extractFeatureByMethod(const std::string& method, const cv::Mat& image, FaceDetector* faceDetector,
+                                                 ExtractScratch& scratch) {
+    PROFILE_SCOPE("extract.feature");
+    PROFILE_COUNT("extract.images", 1);
+    std::vector<float>& feature = scratch.output();
+    if (method == "b") {
+        extract7x7FeatureVector(image, feature);
+    } else if (method == "h2") {
+        calculateRG_2DChromaHistogram(image, BINS_2D, feature);
+    } else if (method == "h3") {
+        calculateRGB_3DChromaHistogram(image, BINS_3D, feature);
+    } else if (method == "m") {
+        calculateMultiPartRGBHistogram(image, BINS_3D, scratch, feature);
+    } else if (method == "tc") {
+        calculateColorTextureFeatureVector(image, COLOR_BINS, TEXTURE_BINS, scratch, feature);
+    } else if (method == "glcm") {
+        calculateGLCMFeatures(image, GLCM_DISTANCE, GLCM_ANGLE, GLCM_LEVELS, scratch, feature);
+    } else if (method == "l") {
+        calculateLawsTextureFeatures(image, scratch, feature);
+    } else if (method == "gabor") {
+        computeGaborFeatures(image, scratch, feature);
+    } else if (method == "custom_s") {
+        calculateCustomFeature(image, BINS_3D, WEIGHT_CONFIG_S, scratch, feature);
+    } else if (method == "custom_m") {
+        calculateCustomFeature(image, BINS_3D, WEIGHT_CONFIG_M, scratch, feature);
+    } else if (method == "custom_l") {
+        calculateCustomFeature(image, BINS_3D, WEIGHT_CONFIG_L, scratch, feature);
+    } else if (method == "face") {
+        feature = extractFaceFeatures(image, faceDetector ? *faceDetector : defaultFaceDetector());
+    } else {
+        throw std::runtime_error("Invalid method: " + method);
+    }
+    return feature;
+}
+
+// gabor (cv::filter2D) and face (the cascade classifier) allocate inside OpenCV
+bool extractsWithoutAllocation(const std::string& method) {
+    return isFeatureMethod(method) && method != "gabor" && method != "face";
+}
+
+// score a target feature vector against a database row with the method's metric
+float scoreByMethod(const std::string& method, const std::vector<float>& target, const std::vector<float>& row) {
+    if (method == "b" || method == "glcm" || method == "l" || method == "gabor") {
+        return computeSSD(target, row);
+    } else if (method == "h2" || method == "h3" || method == "custom_s" || method == "custom_m" || method == "custom_l") {
+        return computeHistogramIntersection(target, row);
+    } else if (method == "m" || method == "tc") {
+        return combinedHistogramIntersection(target, row, SPLIT_POINT);
+    } else if (method == "dnn") {
+        return calculateCosineSimilarity(target, row);
+    }
+    throw std::runtime_error("Method has no matching metric: " + method);
+}
+
+// the m and tc features are two histograms back to back
+static float splitHistogramIntersection(const float* target, const float* row, size_t n) {
+    return combinedHistogramIntersection(target, row, n, SPLIT_POINT);
+}
+
+// the method's metric on raw rows
+FeatureMetric metricForMethod(const std::string& method) {
+    if (isSSDMethod(method)) {
+        return computeSSD;
+    } else if (method == "h2" || method == "h3" || method == "custom_s" || method == "custom_m" || method == "custom_l") {
+        return computeHistogramIntersection;
+    } else if (method == "m" || method == "tc") {
+        return splitHistogramIntersection;
+    } else if (method == "dnn") {
+        return calculateCosineSimilarity;
+    }
+    throw std::runtime_error("Method has no matching metric: " + method);
+}
+
+bool isSSDMethod(const std::string& method) {
+    return method == "b" || method == "glcm" || method == "l" || method == "gabor";
+}
+
+bool metricIgnoresColumnOrder(const std::string& method) {
+    return method != "m" && method != "tc";
+}
+
+// true if a higher score means more similar
+bool isSimilarityMethod(const std::string& method) {
+    return method == "h2" || method == "h3" || method == "m" || method == "tc"
+        || method == "custom_s" || method == "custom_m" || method == "custom_l" || method == "dnn";
+}
+
+bool isMatchingMethod(const std::string& method) {
+    return (isFeatureMethod(method) && method != "face") || method == "dnn";
+}
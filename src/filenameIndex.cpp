@@ -0,0 +1,82 @@
+/**
+ * @file filenameIndex.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief filename to row lookup for a loaded feature file
+ * @version 0.1
+ * @date 2024-02-24
+*/
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "filenameIndex.h"
+#include "profiler.h"
+
+
+// FNV-1a over the bytes of the name
+static size_t hashName(const char* name, size_t length) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= static_cast<unsigned char>(name[i]);
+        h *= 1099511628211ULL;
+    }
+    return static_cast<size_t>(h);
+}
+
+// index the filenames, the first row of a repeated name is kept
+void FilenameIndex::build(const FilenameArena& filenames) {
+    PROFILE_SCOPE("index.build");
+    names_ = &filenames;
+
+    // at most half full
+    size_t capacity = 16;
+    while (capacity < 2 * filenames.size()) {
+        capacity *= 2;
+    }
+    slots_.assign(capacity, -1);
+    mask_ = capacity - 1;
+
+    for (size_t row = 0; row < filenames.size(); row++) {
+        const char* name = filenames.name(row);
+        size_t length = filenames.length(row);
+        size_t slot = hashName(name, length) & mask_;
+        for (;;) {
+            int existing = slots_[slot];
+            if (existing < 0) {
+                slots_[slot] = static_cast<int>(row);
+                break;
+            }
+            if (filenames.length(existing) == length && memcmp(filenames.name(existing), name, length) == 0) {
+                break;
+            }
+            slot = (slot + 1) & mask_;
+        }
+    }
+}
+
+int FilenameIndex::find(const char* name, size_t length) const {
+    if (slots_.empty()) {
+        return -1;
+    }
+    size_t slot = hashName(name, length) & mask_;
+    for (;;) {
+        int row = slots_[slot];
+        if (row < 0) {
+            return -1;
+        }
+        if (names_->length(row) == length && memcmp(names_->name(row), name, length) == 0) {
+            return row;
+        }
+        slot = (slot + 1) & mask_;
+    }
+}
+
+std::vector<int> FilenameIndex::findAll(const std::vector<std::string>& names) const {
+    PROFILE_SCOPE("index.find_batch");
+    std::vector<int> rows;
+    rows.reserve(names.size());
+    for (const std::string& name : names) {
+        rows.push_back(find(name));
+    }
+    return rows;
+}
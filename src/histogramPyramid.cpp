@@ -0,0 +1,287 @@
+/**
+ * @file histogramPyramid.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief coarse-to-fine exact top-K for histogram intersection
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "matchings.h"
+#include "featureMethods.h"
+#include "histogramPyramid.h"
+#include "profiler.h"
+
+// bounds are raised by this much so float rounding of the coarse sums cannot prune a row that belongs
+#define PYRAMID_SLACK 1e-5f
+
+
+bool HistogramPyramid::supports(const std::string& method) {
+    return method == "h3" || method == "m" || method == "custom_s" || method == "custom_m" || method == "custom_l";
+}
+
+// coarse bins of a bins^3 RGB cube with every channel merged by factor, numbered from next
+static void addCubeGroups(int bins, int factor, int& next, std::vector<int>& groups) {
+    int coarse = bins / factor;
+    for (int r = 0; r < bins; r++) {
+        for (int g = 0; g < bins; g++) {
+            for (int b = 0; b < bins; b++) {
+                groups.push_back(next + (r / factor) * coarse * coarse + (g / factor) * coarse + b / factor);
+            }
+        }
+    }
+    next += coarse * coarse * coarse;
+}
+
+// coarse bins of a 1D histogram merged by factor
+static void addLineGroups(int bins, int factor, int& next, std::vector<int>& groups) {
+    for (int i = 0; i < bins; i++) {
+        groups.push_back(next + i / factor);
+    }
+    next += bins / factor;
+}
+
+int HistogramPyramid::layout(const std::string& method, size_t cols) {
+    groups_.clear();
+    levelBins_.clear();
+    if (!supports(method)) {
+        return -1;
+    }
+    method_ = method;
+    scale_ = method == "m" ? 0.5f : 1.0f;
+
+    // every level halves the bins per side of the level below
+    size_t below = cols;
+    for (int level = 0; level < PYRAMID_LEVELS; level++) {
+        int bins = BINS_3D >> level;
+        std::vector<int> groups;
+        int next = 0;
+        if (method == "h3") {
+            addCubeGroups(bins, 2, next, groups);
+        } else if (method == "m") {
+            addCubeGroups(bins, 2, next, groups);
+            addCubeGroups(bins, 2, next, groups);
+        } else {
+            // custom: four scales of RGB cube + gradient magnitude histogram
+            for (int s = 0; s < 4; s++) {
+                addCubeGroups(bins, 2, next, groups);
+                addLineGroups(bins, 2, next, groups);
+            }
+        }
+        if (groups.size() != below) {
+            groups_.clear();
+            levelBins_.clear();
+            return -1;
+        }
+        groups_.push_back(groups);
+        levelBins_.push_back(next);
+        below = next;
+    }
+    return 0;
+}
+
+int HistogramPyramid::build(const std::string& method, const FeatureMatrix& data) {
+    PROFILE_SCOPE("pyramid.build");
+    levels_.clear();
+    if (!data.columnOrder().empty() || layout(method, data.cols()) != 0) {
+        return -1;
+    }
+    cols_ = data.cols();
+    rows_ = data.rows();
+    fingerprint_ = data.fingerprint();
+
+    // one row buffer per level, reused for every row
+    std::vector<std::vector<float>> coarse(PYRAMID_LEVELS);
+    levels_.resize(PYRAMID_LEVELS);
+    for (size_t level = 0; level < levels_.size(); level++) {
+        coarse[level].resize(levelBins_[level]);
+        levels_[level].reserve(data.rows(), levelBins_[level]);
+    }
+    for (size_t r = 0; r < data.rows(); r++) {
+        const float* finer = data.row(r);
+        for (size_t level = 0; level < levels_.size(); level++) {
+            coarsen(finer, level, coarse[level].data());
+            levels_[level].appendRow(coarse[level]);
+            finer = coarse[level].data();
+        }
+    }
+    return 0;
+}
+
+void HistogramPyramid::coarsen(const float* finer, size_t level, float* coarse) const {
+    std::fill(coarse, coarse + levelBins_[level], 0.0f);
+    const std::vector<int>& groups = groups_[level];
+    for (size_t i = 0; i < groups.size(); i++) {
+        coarse[groups[i]] += finer[i];
+    }
+}
+
+int HistogramPyramid::write(const std::string& path) const {
+    if (levels_.empty()) {
+        return -1;
+    }
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return -1;
+    }
+    char method[PYRAMID_METHOD_BYTES] = {0};
+    strncpy(method, method_.c_str(), PYRAMID_METHOD_BYTES - 1);
+    uint32_t header[3] = {
+        static_cast<uint32_t>(levels_.size()), static_cast<uint32_t>(cols_), static_cast<uint32_t>(rows_)
+    };
+    uint64_t print = fingerprint_;
+    fwrite(PYRAMID_MAGIC, 1, 8, fp);
+    fwrite(method, 1, PYRAMID_METHOD_BYTES, fp);
+    fwrite(header, sizeof(uint32_t), 3, fp);
+    fwrite(&print, sizeof(uint64_t), 1, fp);
+    for (size_t level = 0; level < levels_.size(); level++) {
+        uint32_t bins = static_cast<uint32_t>(levelBins_[level]);
+        fwrite(&bins, sizeof(uint32_t), 1, fp);
+        for (size_t r = 0; r < rows_; r++) {
+            fwrite(levels_[level].row(r), sizeof(float), bins, fp);
+        }
+    }
+    int error = ferror(fp);
+    fclose(fp);
+    return error ? -1 : 0;
+}
+
+int HistogramPyramid::read(const std::string& path, const std::string& method, const FeatureMatrix& data) {
+    levels_.clear();
+    if (!data.columnOrder().empty() || layout(method, data.cols()) != 0) {
+        return -1;
+    }
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+    char magic[8];
+    char storedMethod[PYRAMID_METHOD_BYTES];
+    uint32_t header[3];
+    uint64_t print = 0;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, PYRAMID_MAGIC, 8) != 0
+        || fread(storedMethod, 1, PYRAMID_METHOD_BYTES, fp) != PYRAMID_METHOD_BYTES
+        || fread(header, sizeof(uint32_t), 3, fp) != 3 || fread(&print, sizeof(uint64_t), 1, fp) != 1
+        || method != std::string(storedMethod, strnlen(storedMethod, PYRAMID_METHOD_BYTES))
+        || header[0] != PYRAMID_LEVELS || header[1] != data.cols() || header[2] != data.rows()
+        || print != data.fingerprint()) {
+        fclose(fp);
+        return -1;
+    }
+
+    std::vector<FeatureMatrix> levels(PYRAMID_LEVELS);
+    std::vector<float> row;
+    bool ok = true;
+    for (size_t level = 0; level < levels.size() && ok; level++) {
+        uint32_t bins = 0;
+        ok = fread(&bins, sizeof(uint32_t), 1, fp) == 1 && bins == levelBins_[level]
+            && levels[level].reserve(data.rows(), bins) == 0;
+        row.resize(bins);
+        for (size_t r = 0; r < data.rows() && ok; r++) {
+            ok = fread(row.data(), sizeof(float), bins, fp) == bins && levels[level].appendRow(row) == 0;
+        }
+    }
+    fclose(fp);
+    if (!ok) {
+        groups_.clear();
+        levelBins_.clear();
+        return -1;
+    }
+
+    cols_ = data.cols();
+    rows_ = data.rows();
+    fingerprint_ = print;
+    levels_.swap(levels);
+    return 0;
+}
+
+size_t HistogramPyramid::bytes() const {
+    size_t total = 0;
+    for (const FeatureMatrix& level : levels_) {
+        total += level.rows() * level.stride() * sizeof(float);
+    }
+    return total;
+}
+
+std::vector<std::pair<float, int>> HistogramPyramid::topRows(const std::vector<float>& target, const FeatureMatrix& data,
+                                                             size_t k) const {
+    PROFILE_SCOPE("pyramid.top_rows");
+    std::vector<std::pair<float, int>> best;
+    if (levels_.empty() || data.empty() || k == 0) {
+        return best;
+    }
+    if (target.size() != data.cols()) {
+        throw std::runtime_error("Feature vectors must be of the same size");
+    }
+    k = std::min(k, data.rows());
+    FeatureMetric metric = metricForMethod(method_);
+
+    // the target at every level
+    std::vector<std::vector<float>> targetLevels(levels_.size());
+    const float* finer = target.data();
+    for (size_t level = 0; level < levels_.size(); level++) {
+        targetLevels[level].resize(levelBins_[level]);
+        coarsen(finer, level, targetLevels[level].data());
+        finer = targetLevels[level].data();
+    }
+
+    // bound of every row from the coarsest level, visited from the highest bound down
+    size_t coarsest = levels_.size() - 1;
+    const FeatureMatrix& top = levels_[coarsest];
+    std::vector<std::pair<float, int>> order(data.rows());
+    for (size_t r = 0; r < data.rows(); r++) {
+        float bound = scale_ * computeHistogramIntersection(targetLevels[coarsest].data(), top.row(r), levelBins_[coarsest]);
+        order[r] = std::make_pair(bound * (1.0f + PYRAMID_SLACK) + PYRAMID_SLACK, static_cast<int>(r));
+    }
+    std::sort(order.begin(), order.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+
+    // k best exact scores in a min-heap, the worst kept on top
+    auto better = [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    };
+    long long refined = 0, exact = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        int r = order[i].second;
+        // a row can tie the K-th best and still win on its row index, so only a strictly lower bound prunes
+        if (best.size() == k && order[i].first < best.front().first) {
+            break;
+        }
+        bool pruned = false;
+        for (size_t level = coarsest; level-- > 0;) {
+            refined++;
+            float bound = scale_ * computeHistogramIntersection(targetLevels[level].data(), levels_[level].row(r),
+                                                                levelBins_[level]);
+            if (best.size() == k && bound * (1.0f + PYRAMID_SLACK) + PYRAMID_SLACK < best.front().first) {
+                pruned = true;
+                break;
+            }
+        }
+        if (pruned) {
+            continue;
+        }
+        exact++;
+        std::pair<float, int> scored(metric(target.data(), data.row(r), data.cols()), r);
+        if (best.size() < k) {
+            best.push_back(scored);
+            std::push_heap(best.begin(), best.end(), better);
+        } else if (better(scored, best.front())) {
+            std::pop_heap(best.begin(), best.end(), better);
+            best.back() = scored;
+            std::push_heap(best.begin(), best.end(), better);
+        }
+    }
+    PROFILE_COUNT("pyramid.rows", data.rows());
+    PROFILE_COUNT("pyramid.rows_refined", refined);
+    PROFILE_COUNT("pyramid.rows_exact", exact);
+
+    std::sort(best.begin(), best.end(), better);
+    return best;
+}
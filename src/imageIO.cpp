@@ -0,0 +1,212 @@
+/**
+ * @file imageIO.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief listing the images of a directory and decoding them with a decode policy
+ * @version 0.1
+ * @date 2024-02-20
+*/
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "imageIO.h"
+#include "profiler.h"
+
+
+// full resolution, what cv::imread(path, IMREAD_COLOR) gives
+DecodePolicy fullDecodePolicy() {
+    DecodePolicy policy;
+    policy.reduction = 1;
+    policy.maxDimension = 0;
+    return policy;
+}
+
+// Histogram features are normalized distributions and barely change on a 1/4 size image,
+// the other methods look at pixel positions or fine texture and need the full image
+DecodePolicy decodePolicyForMethod(const std::string& method) {
+    DecodePolicy policy = fullDecodePolicy();
+    if (method == "h2" || method == "h3" || method == "m"
+        || method == "custom_s" || method == "custom_m" || method == "custom_l") {
+        policy.reduction = 4;
+    }
+    return policy;
+}
+
+// parse full, auto, 2, 4, 8 or max:<pixels>
+int parseDecodePolicy(const std::string& text, const std::string& method, DecodePolicy& policy) {
+    policy = fullDecodePolicy();
+    if (text == "full") {
+        return 0;
+    } else if (text == "auto") {
+        policy = decodePolicyForMethod(method);
+        return 0;
+    } else if (text == "2" || text == "4" || text == "8") {
+        policy.reduction = std::stoi(text);
+        return 0;
+    } else if (text.compare(0, 4, "max:") == 0) {
+        int maxDimension = std::atoi(text.c_str() + 4);
+        if (maxDimension <= 0) {
+            return -1;
+        }
+        policy.maxDimension = maxDimension;
+        return 0;
+    }
+    return -1;
+}
+
+std::string describeDecodePolicy(const DecodePolicy& policy) {
+    std::string text = policy.reduction > 1 ? "1/" + std::to_string(policy.reduction) : "full";
+    if (policy.maxDimension > 0) {
+        text += ", max " + std::to_string(policy.maxDimension);
+    }
+    return text;
+}
+
+bool isFullDecode(const DecodePolicy& policy) {
+    return policy.reduction <= 1 && policy.maxDimension <= 0;
+}
+
+// cv::imread flags for the policy
+int decodeFlags(const DecodePolicy& policy) {
+    switch (policy.reduction) {
+        case 2: return cv::IMREAD_REDUCED_COLOR_2;
+        case 4: return cv::IMREAD_REDUCED_COLOR_4;
+        case 8: return cv::IMREAD_REDUCED_COLOR_8;
+        default: return cv::IMREAD_COLOR;
+    }
+}
+
+// Shrink a decoded image so that its larger side fits the policy's maximum
+static cv::Mat limitDimension(const cv::Mat& image, const DecodePolicy& policy) {
+    int largest = std::max(image.cols, image.rows);
+    if (image.empty() || policy.maxDimension <= 0 || largest <= policy.maxDimension) {
+        return image;
+    }
+    double scale = static_cast<double>(policy.maxDimension) / largest;
+    cv::Mat resized;
+    cv::resize(image, resized, cv::Size(), scale, scale, cv::INTER_AREA);
+    return resized;
+}
+
+// shrink an image that is already decoded (a video frame) as the policy would have decoded it
+cv::Mat applyDecodePolicy(const cv::Mat& image, const DecodePolicy& policy) {
+    cv::Mat reduced = image;
+    if (!image.empty() && policy.reduction > 1) {
+        double scale = 1.0 / policy.reduction;
+        cv::resize(image, reduced, cv::Size(), scale, scale, cv::INTER_AREA);
+    }
+    return limitDimension(reduced, policy);
+}
+
+// read and decode an image file with the policy
+cv::Mat readImage(const std::string& path, const DecodePolicy& policy) {
+    PROFILE_SCOPE("image.read_decode");
+    return limitDimension(cv::imread(path, decodeFlags(policy)), policy);
+}
+
+// decode an encoded image held in memory with the policy
+cv::Mat decodeImage(const std::vector<uchar>& bytes, const DecodePolicy& policy) {
+    PROFILE_SCOPE("image.decode");
+    if (bytes.empty()) {
+        return cv::Mat();
+    }
+    return limitDimension(cv::imdecode(bytes, decodeFlags(policy)), policy);
+}
+
+// ask the kernel to start reading a file into the page cache, returns at once
+void prefetchFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+#if defined(__linux__)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        struct radvisory advice;
+        advice.ra_offset = 0;
+        advice.ra_count = static_cast<int>(std::min<off_t>(info.st_size, INT_MAX));
+        fcntl(fd, F_RDADVISE, &advice);
+    }
+#endif
+    // the pages being read stay in the cache after the descriptor is closed
+    close(fd);
+}
+
+// read a whole file into memory, with sequential read-ahead
+int readFileBytes(const std::string& path, std::vector<uchar>& bytes) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+
+#if defined(__linux__)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(F_RDAHEAD)
+    fcntl(fd, F_RDAHEAD, 1);
+#endif
+
+    PROFILE_SCOPE("image.read_file");
+    bytes.resize(static_cast<size_t>(info.st_size));
+    size_t done = 0;
+    while (done < bytes.size()) {
+        ssize_t n = read(fd, bytes.data() + done, bytes.size() - done);
+        if (n <= 0) {
+            break;
+        }
+        done += static_cast<size_t>(n);
+    }
+    close(fd);
+    PROFILE_COUNT("image.bytes_read", done);
+
+    if (done != bytes.size()) {
+        bytes.clear();
+        return -1;
+    }
+    return 0;
+}
+
+// true if the file name has an image extension
+bool isImageFileName(const std::string& file_name) {
+    std::string extension = file_name.substr(file_name.find_last_of(".") + 1);
+    return extension == "jpg" || extension == "jpeg" || extension == "png" || extension == "tif";
+}
+
+// list the image files of a directory in directory order
+int listImageFiles(const std::string& directory, std::vector<std::string>& file_names) {
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) {
+        return -1;
+    }
+
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        std::string file_name = ent->d_name;
+        // Skip current directory and parent directory entries
+        if (file_name == "." || file_name == "..") continue;
+
+        // Skip files that are not images
+        if (!isImageFileName(file_name)) {
+            std::cerr << "Skipping non-image file: " << directory + "/" + file_name << std::endl;
+            continue;
+        }
+        file_names.push_back(file_name);
+    }
+    closedir(dir);
+    return 0;
+}
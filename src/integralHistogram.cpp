@@ -0,0 +1,230 @@
+/**
+ * @file integralHistogram.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief integral histogram over a per-pixel bin map, exact region histograms in O(bins)
+ * @version 0.1
+ * @date 2024-02-20
+*/
+
+#include <cmath>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#include "integralHistogram.h"
+
+
+IntegralHistogram::IntegralHistogram()
+    : bins_(0), cellSize_(INTEGRAL_HIST_MIN_CELL), gridCols_(0), gridRows_(0) {
+}
+
+IntegralHistogram::IntegralHistogram(const cv::Mat& binMap, int bins)
+    : bins_(0), cellSize_(INTEGRAL_HIST_MIN_CELL), gridCols_(0), gridRows_(0) {
+    if (build(binMap, bins) != 0) {
+        throw std::runtime_error("Bin map must be a non-empty CV_16UC1 image");
+    }
+}
+
+// smallest cell side that keeps the grid within INTEGRAL_HIST_MAX_CELLS cells
+static int minimumCellSize(const cv::Mat& binMap) {
+    double pixelsPerCell = static_cast<double>(binMap.rows) * binMap.cols / INTEGRAL_HIST_MAX_CELLS;
+    return std::max(INTEGRAL_HIST_MIN_CELL, static_cast<int>(std::ceil(std::sqrt(pixelsPerCell))));
+}
+
+// Build the cell grid and its per-bin summed-area tables in one pass over the bin map
+int IntegralHistogram::build(const cv::Mat& binMap, int bins) {
+    if (binMap.empty() || binMap.type() != CV_16UC1 || bins <= 0 || bins >= INTEGRAL_HIST_SKIP) {
+        return -1;
+    }
+
+    binMap_ = binMap;
+    bins_ = bins;
+
+    // pick the cell size so the table stays bounded for large images
+    buildGrid(minimumCellSize(binMap));
+    return 0;
+}
+
+/*
+  Build for known regions, with a cost in pixel visits:
+    direct scans  the area of the regions
+    grid          one counting pass over the image, about two visits
+                  per table entry (zeroing, prefix sum), and border
+                  strips half a cell wide on average along each region
+  The grid cost is lowest at cell = cbrt(8 * bins * pixels / perimeter).
+ */
+int IntegralHistogram::build(const cv::Mat& binMap, int bins, const cv::Rect* regions, size_t count) {
+    if (binMap.empty() || binMap.type() != CV_16UC1 || bins <= 0 || bins >= INTEGRAL_HIST_SKIP) {
+        return -1;
+    }
+
+    binMap_ = binMap;
+    bins_ = bins;
+
+    double pixels = static_cast<double>(binMap.rows) * binMap.cols;
+    double area = 0, perimeter = 0;
+    for (size_t i = 0; i < count; i++) {
+        cv::Rect r = regions[i] & cv::Rect(0, 0, binMap.cols, binMap.rows);
+        area += r.area();
+        perimeter += 2.0 * (r.width + r.height);
+    }
+    int cellSize = minimumCellSize(binMap);
+    if (perimeter > 0) {
+        cellSize = std::max(cellSize, static_cast<int>(std::lround(std::cbrt(8.0 * bins * pixels / perimeter))));
+    }
+    double gridCost = pixels + 2.0 * bins * pixels / (static_cast<double>(cellSize) * cellSize)
+        + perimeter * cellSize / 2;
+    if (area <= gridCost) {
+        cellSize_ = 0;
+        gridCols_ = gridRows_ = 0;
+        table_.clear();   // keeps the capacity for the next image that wants a grid
+        scanTotals_.resize(bins_);
+        return 0;
+    }
+    buildGrid(cellSize);
+    return 0;
+}
+
+void IntegralHistogram::buildGrid(int cellSize) {
+    cellSize_ = cellSize;
+    gridCols_ = (binMap_.cols + cellSize_ - 1) / cellSize_;
+    gridRows_ = (binMap_.rows + cellSize_ - 1) / cellSize_;
+
+    const size_t stride = static_cast<size_t>(gridCols_ + 1) * bins_;
+    table_.assign(stride * (gridRows_ + 1), 0);
+
+    // count every pixel into its cell, cell (gx, gy) lives at table entry (gx + 1, gy + 1),
+    // one run of pixels per cell so there is no division per pixel
+    for (int y = 0; y < binMap_.rows; y++) {
+        const ushort* row = binMap_.ptr<ushort>(y);
+        int* cell = &table_[(y / cellSize_ + 1) * stride + bins_];
+        for (int x0 = 0; x0 < binMap_.cols; x0 += cellSize_, cell += bins_) {
+            int x1 = std::min(x0 + cellSize_, binMap_.cols);
+            for (int x = x0; x < x1; x++) {
+                ushort bin = row[x];
+                if (bin < bins_) {
+                    cell[bin] += 1;
+                }
+            }
+        }
+    }
+
+    // turn the cell counts into cumulative counts, row by row
+    for (int gy = 1; gy <= gridRows_; gy++) {
+        int* cur = &table_[gy * stride];
+        const int* prev = &table_[(gy - 1) * stride];
+        for (int gx = 1; gx <= gridCols_; gx++) {
+            int* cell = cur + gx * bins_;
+            const int* left = cur + (gx - 1) * bins_;
+            const int* up = prev + gx * bins_;
+            const int* upLeft = prev + (gx - 1) * bins_;
+            for (int b = 0; b < bins_; b++) {
+                cell[b] += left[b] + up[b] - upLeft[b];
+            }
+        }
+    }
+}
+
+// Count the pixels of [x0, x1) x [y0, y1) directly from the bin map
+void IntegralHistogram::scanCounts(int x0, int y0, int x1, int y1, float* counts) const {
+    for (int y = y0; y < y1; y++) {
+        const ushort* row = binMap_.ptr<ushort>(y);
+        for (int x = x0; x < x1; x++) {
+            ushort bin = row[x];
+            if (bin < bins_) {
+                counts[bin] += 1;
+            }
+        }
+    }
+}
+
+// Add the raw counts of a region, table lookups for the aligned interior, scans for the border strips
+void IntegralHistogram::regionCounts(const cv::Rect& region, std::vector<float>& counts) const {
+    if (counts.size() != static_cast<size_t>(bins_)) {
+        counts.assign(bins_, 0.0f);
+    }
+    regionCounts(region, counts.data());
+}
+
+void IntegralHistogram::regionCounts(const cv::Rect& region, float* counts) const {
+    cv::Rect r = region & cv::Rect(0, 0, binMap_.cols, binMap_.rows);
+    if (r.width <= 0 || r.height <= 0) {
+        return;
+    }
+    int x0 = r.x, y0 = r.y, x1 = r.x + r.width, y1 = r.y + r.height;
+    if (direct()) {
+        std::fill(scanTotals_.begin(), scanTotals_.end(), 0);
+        for (int y = y0; y < y1; y++) {
+            const ushort* row = binMap_.ptr<ushort>(y);
+            for (int x = x0; x < x1; x++) {
+                ushort bin = row[x];
+                if (bin < bins_) {
+                    scanTotals_[bin] += 1;
+                }
+            }
+        }
+        for (int i = 0; i < bins_; i++) {
+            counts[i] += static_cast<float>(scanTotals_[i]);
+        }
+        return;
+    }
+
+    // grid lines inside the region, the partial last cell counts as aligned at the image edge
+    int gx0 = (x0 + cellSize_ - 1) / cellSize_;
+    int gy0 = (y0 + cellSize_ - 1) / cellSize_;
+    int gx1 = (x1 == binMap_.cols) ? gridCols_ : x1 / cellSize_;
+    int gy1 = (y1 == binMap_.rows) ? gridRows_ : y1 / cellSize_;
+
+    if (gx0 >= gx1 || gy0 >= gy1) {
+        // region smaller than a cell, nothing to gain from the table
+        scanCounts(x0, y0, x1, y1, counts);
+        return;
+    }
+
+    // aligned interior from the four corners of the summed-area table
+    const size_t stride = static_cast<size_t>(gridCols_ + 1) * bins_;
+    const int* a = &table_[gy1 * stride + gx1 * bins_];
+    const int* b = &table_[gy0 * stride + gx1 * bins_];
+    const int* c = &table_[gy1 * stride + gx0 * bins_];
+    const int* d = &table_[gy0 * stride + gx0 * bins_];
+    for (int i = 0; i < bins_; i++) {
+        counts[i] += static_cast<float>(a[i] - b[i] - c[i] + d[i]);
+    }
+
+    // border strips: top, bottom, then left and right between them
+    int ix0 = gridX(gx0), ix1 = gridX(gx1);
+    int iy0 = gridY(gy0), iy1 = gridY(gy1);
+    scanCounts(x0, y0, x1, iy0, counts);
+    scanCounts(x0, iy1, x1, y1, counts);
+    scanCounts(x0, iy0, ix0, iy1, counts);
+    scanCounts(ix1, iy0, x1, iy1, counts);
+}
+
+// Histogram of a region normalized so that the bins sum to 1
+std::vector<float> IntegralHistogram::regionHistogram(const cv::Rect& region) const {
+    std::vector<float> histogram(bins_, 0.0f);
+    regionCounts(region, histogram);
+    normalizeHistogram(histogram);
+    return histogram;
+}
+
+void IntegralHistogram::regionHistogram(const cv::Rect& region, float* histogram) const {
+    std::fill(histogram, histogram + bins_, 0.0f);
+    regionCounts(region, histogram);
+    normalizeHistogram(histogram, bins_);
+}
+
+// Normalize a count histogram in place so that the bins sum to 1
+void normalizeHistogram(std::vector<float>& histogram) {
+    normalizeHistogram(histogram.data(), histogram.size());
+}
+
+void normalizeHistogram(float* histogram, size_t n) {
+    float total = std::accumulate(histogram, histogram + n, 0.0f);
+    if (total <= 0.0f) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        histogram[i] /= total;
+    }
+}
@@ -0,0 +1,236 @@
+/**
+ * @file knnGraph.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief k nearest neighbor graph of a whole feature database, tiled and multithreaded
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "featureMethods.h"
+#include "knnGraph.h"
+#include "profiler.h"
+
+
+// How a tile is scored
+enum KnnKernel {
+    KNN_DOT,        // cosine of unit rows
+    KNN_SSD,        // |a|^2 + |b|^2 - 2 a.b
+    KNN_METRIC      // the method's metric per pair
+};
+
+/*
+  Keeps the k best (score, row) pairs of one row. The worst kept pair
+  sits on top of a heap so a new pair is compared against it first.
+ */
+class TopK {
+public:
+    TopK(int k, bool similarity) : k_(k), similarity_(similarity) { heap_.reserve(k); }
+
+    void offer(float score, int row) {
+        if (static_cast<int>(heap_.size()) < k_) {
+            heap_.emplace_back(score, row);
+            std::push_heap(heap_.begin(), heap_.end(), Better(similarity_));
+        } else if (better(score, row, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), Better(similarity_));
+            heap_.back() = std::make_pair(score, row);
+            std::push_heap(heap_.begin(), heap_.end(), Better(similarity_));
+        }
+    }
+
+    // best first, padded with -1 up to k
+    void write(int* neighbors, float* scores) {
+        std::sort_heap(heap_.begin(), heap_.end(), Better(similarity_));
+        for (int i = 0; i < k_; i++) {
+            neighbors[i] = i < static_cast<int>(heap_.size()) ? heap_[i].second : -1;
+            scores[i] = i < static_cast<int>(heap_.size()) ? heap_[i].first : 0.0f;
+        }
+    }
+
+private:
+    // heap order: a comes before b when a is the better pair, so the front is the worst
+    struct Better {
+        bool similarity;
+        explicit Better(bool s) : similarity(s) {}
+        bool operator()(const std::pair<float, int>& a, const std::pair<float, int>& b) const {
+            if (a.first != b.first) return similarity ? a.first > b.first : a.first < b.first;
+            return a.second < b.second;
+        }
+    };
+    bool better(float score, int row, const std::pair<float, int>& than) const {
+        return Better(similarity_)(std::make_pair(score, row), than);
+    }
+
+    int k_;
+    bool similarity_;
+    std::vector<std::pair<float, int>> heap_;
+};
+
+// Dot products of rows [i0, i1) against rows [j0, j1), four columns at a time
+static void tileDots(const FeatureMatrix& data, size_t i0, size_t i1, size_t j0, size_t j1, float* dots) {
+    size_t n = data.cols();
+    size_t width = j1 - j0;
+    for (size_t i = i0; i < i1; i++) {
+        const float* a = data.row(i);
+        float* out = dots + (i - i0) * width;
+        size_t j = j0;
+        for (; j + 4 <= j1; j += 4) {
+            const float* b0 = data.row(j);
+            const float* b1 = data.row(j + 1);
+            const float* b2 = data.row(j + 2);
+            const float* b3 = data.row(j + 3);
+            float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (size_t c = 0; c < n; c++) {
+                float v = a[c];
+                s0 += v * b0[c];
+                s1 += v * b1[c];
+                s2 += v * b2[c];
+                s3 += v * b3[c];
+            }
+            out[j - j0] = s0;
+            out[j + 1 - j0] = s1;
+            out[j + 2 - j0] = s2;
+            out[j + 3 - j0] = s3;
+        }
+        for (; j < j1; j++) {
+            const float* b = data.row(j);
+            float s = 0;
+            for (size_t c = 0; c < n; c++) {
+                s += a[c] * b[c];
+            }
+            out[j - j0] = s;
+        }
+    }
+}
+
+int computeKnnGraph(const std::string& method, const FeatureMatrix& data, int k, int threads, KnnGraph& graph,
+                    std::vector<KnnPair>* pairs, float threshold) {
+    PROFILE_SCOPE("knn.graph");
+    if (!isMatchingMethod(method) || k < 1) {
+        return -1;
+    }
+    FeatureMetric metric = metricForMethod(method);
+    bool similarity = isSimilarityMethod(method);
+    KnnKernel kernel = KNN_METRIC;
+    if (method == "dnn" && data.unitRows()) {
+        kernel = KNN_DOT;
+    } else if (!similarity) {
+        kernel = KNN_SSD;
+    }
+
+    size_t rows = data.rows();
+    graph.rows = rows;
+    graph.k = k;
+    graph.similarity = similarity;
+    graph.neighbors.assign(rows * k, -1);
+    graph.scores.assign(rows * k, 0.0f);
+
+    // squared norms for the SSD decomposition
+    std::vector<float> norms;
+    if (kernel == KNN_SSD) {
+        norms.resize(rows);
+        for (size_t r = 0; r < rows; r++) {
+            const float* a = data.row(r);
+            float s = 0;
+            for (size_t c = 0; c < data.cols(); c++) s += a[c] * a[c];
+            norms[r] = s;
+        }
+    }
+
+    threads = std::max(1, threads);
+    size_t tiles = (rows + KNN_TILE_ROWS - 1) / KNN_TILE_ROWS;
+    std::atomic<size_t> nextTile(0);
+    std::atomic<long long> pairsScored(0);   // counted by the workers
+    std::mutex pairsMutex;
+    if (pairs) {
+        pairs->clear();
+    }
+    auto worker = [&]() {
+        std::vector<float> dots(KNN_TILE_ROWS * KNN_TILE_COLS);
+        std::vector<KnnPair> found;
+        long long scored = 0;
+        for (size_t tile = nextTile++; tile < tiles; tile = nextTile++) {
+            size_t i0 = tile * KNN_TILE_ROWS;
+            size_t i1 = std::min(rows, i0 + KNN_TILE_ROWS);
+            std::vector<TopK> best(i1 - i0, TopK(k, similarity));
+            for (size_t j0 = 0; j0 < rows; j0 += KNN_TILE_COLS) {
+                size_t j1 = std::min(rows, j0 + KNN_TILE_COLS);
+                size_t width = j1 - j0;
+                if (kernel != KNN_METRIC) {
+                    tileDots(data, i0, i1, j0, j1, dots.data());
+                }
+                for (size_t i = i0; i < i1; i++) {
+                    for (size_t j = j0; j < j1; j++) {
+                        if (i == j) continue;
+                        float score;
+                        if (kernel == KNN_DOT) {
+                            score = dots[(i - i0) * width + (j - j0)];
+                        } else if (kernel == KNN_SSD) {
+                            // rounding can leave a tiny negative value for equal rows
+                            score = std::max(0.0f, norms[i] + norms[j] - 2.0f * dots[(i - i0) * width + (j - j0)]);
+                        } else {
+                            score = metric(data.row(i), data.row(j), data.cols());
+                        }
+                        best[i - i0].offer(score, static_cast<int>(j));
+                        scored++;
+                        if (pairs && i < j && (similarity ? score >= threshold : score <= threshold)) {
+                            found.push_back(KnnPair{static_cast<int>(i), static_cast<int>(j), score});
+                        }
+                    }
+                }
+            }
+            for (size_t i = i0; i < i1; i++) {
+                best[i - i0].write(&graph.neighbors[i * k], &graph.scores[i * k]);
+            }
+        }
+        pairsScored += scored;
+        if (pairs && !found.empty()) {
+            std::lock_guard<std::mutex> lock(pairsMutex);
+            pairs->insert(pairs->end(), found.begin(), found.end());
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    PROFILE_COUNT("knn.pairs_scored", pairsScored.load());
+    if (pairs) {
+        std::sort(pairs->begin(), pairs->end(), [](const KnnPair& x, const KnnPair& y) {
+            return x.a < y.a || (x.a == y.a && x.b < y.b);
+        });
+    }
+    return 0;
+}
+
+int writeKnnGraph(const std::string& path, const KnnGraph& graph, const FilenameArena& filenames) {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return -1;
+    }
+    uint32_t header[4] = {
+        static_cast<uint32_t>(graph.rows), static_cast<uint32_t>(graph.k),
+        graph.similarity ? 1u : 0u, static_cast<uint32_t>(filenames.chars.size())
+    };
+    fwrite(KNN_GRAPH_MAGIC, 1, 8, fp);
+    fwrite(header, sizeof(uint32_t), 4, fp);
+    if (!filenames.chars.empty()) {
+        fwrite(filenames.chars.data(), 1, filenames.chars.size(), fp);
+    }
+    fwrite(graph.neighbors.data(), sizeof(int32_t), graph.neighbors.size(), fp);
+    fwrite(graph.scores.data(), sizeof(float), graph.scores.size(), fp);
+    int error = ferror(fp);
+    fclose(fp);
+    return error ? -1 : 0;
+}
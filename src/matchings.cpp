@@ -8,17 +8,69 @@
 
 
 #include <cmath>
+#include <cstring>
 #include <vector>
 #include <algorithm>
 #include <numeric>
 #include <opencv2/opencv.hpp>
 #include "matchings.h"
 #include "csv_util.h"
+#include "integralHistogram.h"
+#include "extractScratch.h"
+#include "profiler.h"
+
+
+// cv::BORDER_REFLECT_101, the border cv::Sobel and cv::filter2D use by default
+static inline int reflect101(int p, int length) {
+    if (length == 1) {
+        return 0;
+    }
+    while (p < 0 || p >= length) {
+        p = p < 0 ? -p : 2 * length - 2 - p;
+    }
+    return p;
+}
+
+// fixed-point weights of OpenCV's 8-bit BGR to gray conversion, Y = 0.114 B + 0.587 G + 0.299 R in 1/32768
+#define GRAY_B_WEIGHT 3735
+#define GRAY_G_WEIGHT 19235
+#define GRAY_R_WEIGHT 9798
+#define GRAY_SHIFT 15
+
+// Gray version of an image, converted into the scratch, or the image itself when it has one channel.
+// 8-bit BGR is converted here, bit-exact with cv::cvtColor(COLOR_BGR2GRAY) for every BGR value,
+// without the parallel job cvtColor allocates; other types go through cvtColor
+static cv::Mat grayImage(const cv::Mat& image, ExtractScratch& scratch) {
+    if (image.channels() == 1) {
+        return image;
+    }
+    cv::Mat& gray = scratch.mat(SCRATCH_GRAY, image.rows, image.cols, CV_MAKETYPE(image.depth(), 1));
+    if (image.type() != CV_8UC3) {
+        cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+        return gray;
+    }
+    for (int y = 0; y < image.rows; y++) {
+        const uchar* src = image.ptr<uchar>(y);
+        uchar* dst = gray.ptr<uchar>(y);
+        for (int x = 0; x < image.cols; x++, src += 3) {
+            dst[x] = static_cast<uchar>((src[0] * GRAY_B_WEIGHT + src[1] * GRAY_G_WEIGHT + src[2] * GRAY_R_WEIGHT
+                                         + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT);
+        }
+    }
+    return gray;
+}
 
 
 // Task 1: baseline matching
 // Extract 7x7 feature vector from the center of the image, make it into a 1D vector
 std::vector<float> extract7x7FeatureVector(const cv::Mat &image) {
+    std::vector<float> featureVector;
+    extract7x7FeatureVector(image, featureVector);
+    return featureVector;
+}
+
+void extract7x7FeatureVector(const cv::Mat &image, std::vector<float>& featureVector) {
+  PROFILE_SCOPE("matchings.baseline");
   // if image is empty, throw runtime error
   if (image.empty()) {
     throw std::runtime_error("Image is empty");
@@ -44,7 +96,7 @@ std::vector<float> extract7x7FeatureVector(const cv::Mat &image) {
   cv::Mat region = image(cv::Range(startY, endY), cv::Range(startX, endX));
   
   // Convert the 7x7 region to a 1D vector
-    std::vector<float> featureVector;
+    featureVector.clear();
     for (int i = 0; i < region.rows; ++i) {
         for (int j = 0; j < region.cols; ++j) {
             for (int c = 0; c < region.channels(); ++c) {
@@ -53,21 +105,22 @@ std::vector<float> extract7x7FeatureVector(const cv::Mat &image) {
             }
         }
     }
-
-    return featureVector;
 }
 
-// Compute the distance metric (sum of squared differences) between two feature vectors
 float computeSSD(const std::vector<float>& vec1, const std::vector<float>& vec2) {
     // Check if vectors are of the same size
     if (vec1.size() != vec2.size()) {
         throw std::runtime_error("Feature vectors must be of the same size");
     }
+    return computeSSD(vec1.data(), vec2.data(), vec1.size());
+}
+
+float computeSSD(const float* vec1, const float* vec2, size_t n) {
     // ssd = sum of squared differences
     float ssd = 0.0;
 
     // Compute the sum of squared differences
-    for (size_t i = 0; i < vec1.size(); ++i) {
+    for (size_t i = 0; i < n; ++i) {
         float diff = vec1[i] - vec2[i];
         ssd += diff * diff;
     }
@@ -75,10 +128,34 @@ float computeSSD(const std::vector<float>& vec1, const std::vector<float>& vec2)
     return ssd;
 }
 
+// SSD with early abandon against the current K-th best distance
+float computeSSDBounded(const float* vec1, const float* vec2, size_t n, float bound) {
+    float ssd = 0.0;
+    size_t i = 0;
+    while (i < n) {
+        size_t end = std::min(n, i + SSD_ABANDON_BLOCK);
+        for (; i < end; ++i) {
+            float diff = vec1[i] - vec2[i];
+            ssd += diff * diff;
+        }
+        if (ssd > bound) {
+            break;
+        }
+    }
+    return ssd;
+}
+
 // Task 2: 2D & 3D histogram matching
 // Extract the (RG) 2D histogram feature vector from an image
 std::vector<float> calculateRG_2DChromaHistogram(const cv::Mat& image, int binsPerChannel) {
-    std::vector<float> featureVector(binsPerChannel * binsPerChannel, 0.0f);
+    std::vector<float> featureVector;
+    calculateRG_2DChromaHistogram(image, binsPerChannel, featureVector);
+    return featureVector;
+}
+
+void calculateRG_2DChromaHistogram(const cv::Mat& image, int binsPerChannel, std::vector<float>& featureVector) {
+    PROFILE_SCOPE("matchings.rg_2d_histogram");
+    featureVector.assign(binsPerChannel * binsPerChannel, 0.0f);
 
     for (int y = 0; y < image.rows; y++) {
         for (int x = 0; x < image.cols; x++) {
@@ -103,14 +180,19 @@ std::vector<float> calculateRG_2DChromaHistogram(const cv::Mat& image, int binsP
     for (auto& val : featureVector) {
         val /= total;
     }
-
-    return featureVector;
 }
 
 // Extract the RGB 3D histogram feature vector from an image
 std::vector<float> calculateRGB_3DChromaHistogram(const cv::Mat& image, int binsPerChannel) {
+    std::vector<float> featureVector;
+    calculateRGB_3DChromaHistogram(image, binsPerChannel, featureVector);
+    return featureVector;
+}
+
+void calculateRGB_3DChromaHistogram(const cv::Mat& image, int binsPerChannel, std::vector<float>& featureVector) {
+    PROFILE_SCOPE("matchings.rgb_3d_histogram");
     int bins3D = binsPerChannel * binsPerChannel * binsPerChannel;
-    std::vector<float> featureVector(bins3D, 0.0f);
+    featureVector.assign(bins3D, 0.0f);
 
     for (int y = 0; y < image.rows; y++) {
         for (int x = 0; x < image.cols; x++) {
@@ -131,8 +213,6 @@ std::vector<float> calculateRGB_3DChromaHistogram(const cv::Mat& image, int bins
     for (auto& val : featureVector) {
         val /= total;
     }
-
-    return featureVector;
 }
 
 // Function to compute the histogram intersection distance between two vectors
@@ -141,34 +221,94 @@ float computeHistogramIntersection(const std::vector<float>& vec1, const std::ve
     if (vec1.size() != vec2.size()) {
         throw std::runtime_error("Feature vectors must be of the same size");
     }
+    return computeHistogramIntersection(vec1.data(), vec2.data(), vec1.size());
+}
 
+float computeHistogramIntersection(const float* vec1, const float* vec2, size_t n) {
     // Compute the histogram intersection distance
     float intersection = 0.0;
-    for (size_t i = 0; i < vec1.size(); i++) {
+    for (size_t i = 0; i < n; i++) {
         intersection += std::min(vec1[i], vec2[i]);
     }
     return intersection;
 }
 
+// Build the per-pixel RGB 3D bin map used by the integral histogram
+int computeRGBBinMap(const cv::Mat& image, int binsPerChannel, cv::Mat& binMap) {
+    PROFILE_SCOPE("matchings.rgb_bin_map");
+    if (image.empty() || image.type() != CV_8UC3) {
+        return -1;
+    }
+    if (binsPerChannel * binsPerChannel * binsPerChannel >= INTEGRAL_HIST_SKIP) {
+        return -1;
+    }
+
+    // same per-channel binning as calculateRGB_3DChromaHistogram, as a lookup table
+    int lut[256];
+    for (int v = 0; v < 256; v++) {
+        lut[v] = std::min(static_cast<int>(v * binsPerChannel / 256.0), binsPerChannel - 1);
+    }
+
+    binMap.create(image.rows, image.cols, CV_16UC1);
+    for (int y = 0; y < image.rows; y++) {
+        const cv::Vec3b* src = image.ptr<cv::Vec3b>(y);
+        ushort* dst = binMap.ptr<ushort>(y);
+        for (int x = 0; x < image.cols; x++) {
+            dst[x] = static_cast<ushort>(lut[src[x][2]] * binsPerChannel * binsPerChannel
+                                         + lut[src[x][1]] * binsPerChannel + lut[src[x][0]]);
+        }
+    }
+    return 0;
+}
+
+// RGB 3D histograms of several regions of an image, from a single pass over the pixels
+std::vector<std::vector<float>> calculateRegionRGBHistograms(const cv::Mat& image, int binsPerChannel, const std::vector<cv::Rect>& regions) {
+    cv::Mat binMap;
+    if (computeRGBBinMap(image, binsPerChannel, binMap) != 0) {
+        throw std::runtime_error("Image must be a non-empty 8-bit BGR image");
+    }
+    IntegralHistogram integral;
+    if (integral.build(binMap, binsPerChannel * binsPerChannel * binsPerChannel, regions.data(), regions.size()) != 0) {
+        throw std::runtime_error("Image must be a non-empty 8-bit BGR image");
+    }
+
+    std::vector<std::vector<float>> histograms;
+    histograms.reserve(regions.size());
+    for (const cv::Rect& region : regions) {
+        histograms.push_back(integral.regionHistogram(region));
+    }
+    return histograms;
+}
+
 // Task 3: Multi-histogram matching
 // Extract the multi-channel histogram feature vector from an image
 // Divided the image into 2 parts, top and bottom
 std::vector<float> calculateMultiPartRGBHistogram(const cv::Mat& image, int binsPerChannel) {
+    ExtractScratch scratch(0);
+    std::vector<float> featureVector;
+    calculateMultiPartRGBHistogram(image, binsPerChannel, scratch, featureVector);
+    return featureVector;
+}
+
+void calculateMultiPartRGBHistogram(const cv::Mat& image, int binsPerChannel, ExtractScratch& scratch, std::vector<float>& featureVector) {
+    PROFILE_SCOPE("matchings.multi_histogram");
     // Divide the image into top and bottom halves
     cv::Rect topHalf(0, 0, image.cols, image.rows / 2);
     cv::Rect bottomHalf(0, image.rows / 2, image.cols, image.rows / 2);
 
-    cv::Mat topPart = image(topHalf);
-    cv::Mat bottomPart = image(bottomHalf);
-
-    // Calculate histograms for each part
-    std::vector<float> topFeatureVector = calculateRGB_3DChromaHistogram(topPart, binsPerChannel);
-    std::vector<float> bottomFeatureVector = calculateRGB_3DChromaHistogram(bottomPart, binsPerChannel);
-
-    // Combine the two histograms into a single feature vector
-    topFeatureVector.insert(topFeatureVector.end(), bottomFeatureVector.begin(), bottomFeatureVector.end());
+    // Calculate histograms for each part from one bin map
+    int bins3D = binsPerChannel * binsPerChannel * binsPerChannel;
+    cv::Rect halves[2] = {topHalf, bottomHalf};
+    cv::Mat& binMap = scratch.mat(SCRATCH_RGB_BIN_MAP, image.rows, image.cols, CV_16UC1);
+    IntegralHistogram& integral = scratch.rgbIntegral();
+    if (computeRGBBinMap(image, binsPerChannel, binMap) != 0 || integral.build(binMap, bins3D, halves, 2) != 0) {
+        throw std::runtime_error("Image must be a non-empty 8-bit BGR image");
+    }
 
-    return topFeatureVector;
+    // The two histograms side by side in a single feature vector
+    featureVector.resize(2 * bins3D);
+    integral.regionHistogram(topHalf, featureVector.data());
+    integral.regionHistogram(bottomHalf, featureVector.data() + bins3D);
 }
 
 // Function to compute the histogram intersection distance between two vectors
@@ -180,16 +320,18 @@ float combinedHistogramIntersection(const std::vector<float>& vec1, const std::v
     if (vec1.size() != vec2.size()) {
         throw std::runtime_error("Feature vectors must be of the same size");
     }
+    return combinedHistogramIntersection(vec1.data(), vec2.data(), vec1.size(), splitPoint);
+}
+
+float combinedHistogramIntersection(const float* vec1, const float* vec2, size_t n, size_t splitPoint) {
     // validate the split point
-    if (splitPoint >= vec1.size() || splitPoint == 0) {
+    if (splitPoint >= n || splitPoint == 0) {
         throw std::runtime_error("Split point must be within the range");
     }
 
-    // Calculate intersection for each part
-    float intersection1 = computeHistogramIntersection(std::vector<float>(vec1.begin(), vec1.begin() + splitPoint), 
-                                                         std::vector<float>(vec2.begin(), vec2.begin() + splitPoint));
-    float intersection2 = computeHistogramIntersection(std::vector<float>(vec1.begin() + splitPoint, vec1.end()), 
-                                                            std::vector<float>(vec2.begin() + splitPoint, vec2.end()));
+    // Calculate intersection for each part, in place
+    float intersection1 = computeHistogramIntersection(vec1, vec2, splitPoint);
+    float intersection2 = computeHistogramIntersection(vec1 + splitPoint, vec2 + splitPoint, n - splitPoint);
 
     // Combine the intersections (example: simple average)
     return (intersection1 + intersection2) / 2.0f;
@@ -197,6 +339,17 @@ float combinedHistogramIntersection(const std::vector<float>& vec1, const std::v
 
 
 // Task 4: Texture and Color matching
+// The 3x3 filters leave the one pixel border, set it to zero instead of leaving what the buffer held
+static void zeroBorder(cv::Mat& dst) {
+    size_t rowBytes = dst.cols * dst.elemSize();
+    memset(dst.ptr(0), 0, rowBytes);
+    memset(dst.ptr(dst.rows - 1), 0, rowBytes);
+    for (int y = 1; y < dst.rows - 1; y++) {
+        memset(dst.ptr(y), 0, dst.elemSize());
+        memset(dst.ptr(y) + rowBytes - dst.elemSize(), 0, dst.elemSize());
+    }
+}
+
 // SobelX and SobelY filter from Project 1
 // Sobel_X 3 x 3 function
 int sobelX3x3(const cv::Mat &src, cv::Mat &dst ){
@@ -205,6 +358,7 @@ int sobelX3x3(const cv::Mat &src, cv::Mat &dst ){
     }
 
     dst.create(src.size(), CV_16SC3);
+    zeroBorder(dst);
 
     // Horizontal kernel [-1, 0, 1]
     for (int y = 1; y < src.rows - 1; y++) {
@@ -229,6 +383,7 @@ int sobelY3x3(const cv::Mat &src, cv::Mat &dst ){
     }
 
     dst.create(src.size(), CV_16SC3);
+    zeroBorder(dst);
 
     // Vertical kernel [-1, 0, 1] transposed
     for (int y = 1; y < src.rows - 1; y++) {
@@ -281,40 +436,65 @@ std::vector<float> calculateTextureHistogram(const cv::Mat& magnitudeImage, int
     return std::vector<float>(hist.begin<float>(), hist.end<float>());
 }
 
+// The same histogram of a single-channel 8-bit image written to bins floats, without calcHist's buffers.
+// An empty image gives zero bins, like normalizing an empty calcHist
+void calculateTextureHistogram(const cv::Mat& magnitudeImage, int bins, float* histogram) {
+    std::fill(histogram, histogram + bins, 0.0f);
+    if (magnitudeImage.empty()) {
+        return;
+    }
+    CV_Assert(magnitudeImage.type() == CV_8UC1);
+    for (int y = 0; y < magnitudeImage.rows; y++) {
+        const uchar* p = magnitudeImage.ptr<uchar>(y);
+        for (int x = 0; x < magnitudeImage.cols; x++) {
+            histogram[p[x] * bins / 256] += 1.0f;
+        }
+    }
+    double scale = 1.0 / magnitudeImage.total();
+    for (int i = 0; i < bins; i++) {
+        histogram[i] = static_cast<float>(histogram[i] * scale);
+    }
+}
+
 
 // Combine the color and texture histograms into a single feature vector, giving equal weight to both
 std::vector<float> calculateColorTextureFeatureVector(const cv::Mat& image, int colorBinsPerChannel, int textureBins) {
+    ExtractScratch scratch(0);
+    std::vector<float> colorTextureFeatureVector;
+    calculateColorTextureFeatureVector(image, colorBinsPerChannel, textureBins, scratch, colorTextureFeatureVector);
+    return colorTextureFeatureVector;
+}
+
+void calculateColorTextureFeatureVector(const cv::Mat& image, int colorBinsPerChannel, int textureBins,
+                                        ExtractScratch& scratch, std::vector<float>& colorTextureFeatureVector) {
+    PROFILE_SCOPE("matchings.texture_color");
     // Calculate color histogram
-    std::vector<float> colorHist = calculateRGB_3DChromaHistogram(image, colorBinsPerChannel);
-    
-    // Convert the Sobel magnitude image to grayscale if it's not already
-    cv::Mat sobelX, sobelY, grayImage, magnitudeImage;
-    if (magnitudeImage.channels() > 1) {
-        cv::cvtColor(magnitudeImage, grayImage, cv::COLOR_BGR2GRAY);
-    } else {
-        grayImage = magnitudeImage; // Use as-is if already single-channel
-    }
+    calculateRGB_3DChromaHistogram(image, colorBinsPerChannel, colorTextureFeatureVector);
+    size_t colorBins = colorTextureFeatureVector.size();
 
-    // Calculate Sobel magnitude image
+    // Calculate Sobel magnitude image, in the scratch
+    cv::Mat& sobelX = scratch.mat(SCRATCH_SOBEL_X, image.rows, image.cols, CV_16SC3);
+    cv::Mat& sobelY = scratch.mat(SCRATCH_SOBEL_Y, image.rows, image.cols, CV_16SC3);
+    cv::Mat& magnitudeImage = scratch.mat(SCRATCH_MAGNITUDE, image.rows, image.cols, CV_8UC3);
     sobelX3x3(image, sobelX); // Assume these functions handle multi-channel images correctly
     sobelY3x3(image, sobelY);
     magnitude(sobelX, sobelY, magnitudeImage); // Results in a multi-channel magnitude image
 
-    // Calculate texture histogram from the grayscale magnitude image
-    std::vector<float> textureHist = calculateTextureHistogram(grayImage, textureBins);
-
-    // Combine histograms
-    std::vector<float> colorTextureFeatureVector = colorHist;
-    colorTextureFeatureVector.insert(colorTextureFeatureVector.end(), textureHist.begin(), textureHist.end());
-
-    return colorTextureFeatureVector;
+    // Calculate texture histogram from the grayscale magnitude image, converted once the magnitude exists
+    // (feature files extracted before this have zero texture bins)
+    colorTextureFeatureVector.resize(colorBins + textureBins);
+    calculateTextureHistogram(grayImage(magnitudeImage, scratch), textureBins, &colorTextureFeatureVector[colorBins]);
 }
 
 // Task 5: Deep Network Embeddings
 // Function to calculate the cosine similarity between two vectors.
 float calculateCosineSimilarity(const std::vector<float>& vec1, const std::vector<float>& vec2) {
+    return calculateCosineSimilarity(vec1.data(), vec2.data(), vec1.size());
+}
+
+float calculateCosineSimilarity(const float* vec1, const float* vec2, size_t n) {
     float dotProduct = 0.0, normVec1 = 0.0, normVec2 = 0.0;
-    for (size_t i = 0; i < vec1.size(); ++i) {
+    for (size_t i = 0; i < n; ++i) {
         dotProduct += vec1[i] * vec2[i];
         normVec1 += vec1[i] * vec1[i];
         normVec2 += vec2[i] * vec2[i];
@@ -323,51 +503,122 @@ float calculateCosineSimilarity(const std::vector<float>& vec1, const std::vecto
 }
 
 
+// Dot product, equal to the cosine similarity when both vectors have unit length
+float dotProduct(const float* vec1, const float* vec2, size_t n) {
+    float dot = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        dot += vec1[i] * vec2[i];
+    }
+    return dot;
+}
+
+
 // Task 7: Custom Design
 // Calculate the custom feature vector from an image
+// Build the per-pixel gradient magnitude bin map, magnitudes outside [0, 256) are skipped like calcHist does
+int computeGradientBinMap(const cv::Mat& image, int bins, cv::Mat& binMap) {
+    ExtractScratch scratch(0);
+    return computeGradientBinMap(image, bins, scratch, binMap);
+}
+
+// 3x3 Sobel derivatives and their magnitude in one pass over the gray image, the same values as
+// cv::Sobel(gray, CV_32F, 1, 0) and (0, 1) followed by cv::magnitude, without their temporary images
+int computeGradientBinMap(const cv::Mat& image, int bins, ExtractScratch& scratch, cv::Mat& binMap) {
+    PROFILE_SCOPE("matchings.gradient_bin_map");
+    if (image.empty() || bins <= 0 || bins >= INTEGRAL_HIST_SKIP) {
+        return -1;
+    }
+
+    cv::Mat gray = grayImage(image, scratch);
+    if (gray.depth() != CV_8U) {
+        return -1;
+    }
+
+    const float scale = bins / 256.0f;
+    binMap.create(gray.rows, gray.cols, CV_16UC1);
+    for (int y = 0; y < gray.rows; y++) {
+        const uchar* up = gray.ptr<uchar>(reflect101(y - 1, gray.rows));
+        const uchar* mid = gray.ptr<uchar>(y);
+        const uchar* down = gray.ptr<uchar>(reflect101(y + 1, gray.rows));
+        ushort* dst = binMap.ptr<ushort>(y);
+        for (int x = 0; x < gray.cols; x++) {
+            int l = x > 0 ? x - 1 : reflect101(x - 1, gray.cols);
+            int r = x + 1 < gray.cols ? x + 1 : reflect101(x + 1, gray.cols);
+            float gx = static_cast<float>((up[r] - up[l]) + 2 * (mid[r] - mid[l]) + (down[r] - down[l]));
+            float gy = static_cast<float>((down[l] - up[l]) + 2 * (down[x] - up[x]) + (down[r] - up[r]));
+            int bin = cvFloor(std::sqrt(gx * gx + gy * gy) * scale);
+            dst[x] = (bin >= 0 && bin < bins) ? static_cast<ushort>(bin) : INTEGRAL_HIST_SKIP;
+        }
+    }
+    return 0;
+}
+
 // Function to calculate gradient magnitude histogram
 std::vector<float> calculateGradientMagnitudeHistogram(const cv::Mat& image, int bins) {
-    cv::Mat gray, grad_x, grad_y, grad;
-    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
-    cv::Sobel(gray, grad_x, CV_32F, 1, 0);
-    cv::Sobel(gray, grad_y, CV_32F, 0, 1);
-    cv::magnitude(grad_x, grad_y, grad);
-    std::vector<float> histogram(bins, 0.0f);
-    float range[] = {0, 256};
-    const float* ranges[] = {range};
-    cv::calcHist(&grad, 1, 0, cv::Mat(), histogram, 1, &bins, ranges, true, false);
-    cv::normalize(histogram, histogram, 1, 0, cv::NORM_L1);
-    return histogram;
+    cv::Mat binMap;
+    if (computeGradientBinMap(image, bins, binMap) != 0) {
+        throw std::runtime_error("Image is empty");
+    }
+    cv::Rect whole(0, 0, image.cols, image.rows);
+    IntegralHistogram integral;
+    integral.build(binMap, bins, &whole, 1);
+    return integral.regionHistogram(whole);
 }
 
 // Function to calculate custom feature for different sizes of object to be recognized 
 std::vector<float> calculateCustomFeature(const cv::Mat& image, int bins, const std::vector<int>& weightConfig) {
+    ExtractScratch scratch(0);
     std::vector<float> finalFeatureVector;
-    // Use the passed weight configuration
-    std::vector<int> weights = weightConfig; // Configurable weights for whole, half, quarter, and eighth sizes
-    std::vector<float> scales = {1.0, 0.5, 0.25, 0.125}; // Corresponding scales
-
-    for (size_t i = 0; i < scales.size(); i++) {
-        float scale = scales[i];
-        int scaledWidth = static_cast<int>(image.cols * scale);
-        int scaledHeight = static_cast<int>(image.rows * scale);
-        cv::Rect roi((image.cols - scaledWidth) / 2, (image.rows - scaledHeight) / 2, scaledWidth, scaledHeight);
-        cv::Mat scaledImage = image(roi);
-
-        // Calculate and weight RGB histogram
-        std::vector<float> rgbHistogram = calculateRGB_3DChromaHistogram(scaledImage, bins);
-        std::transform(rgbHistogram.begin(), rgbHistogram.end(), rgbHistogram.begin(), 
-                       [&weights, i](float val) { return val * weights[i]; });
-        finalFeatureVector.insert(finalFeatureVector.end(), rgbHistogram.begin(), rgbHistogram.end());
-
-        // Calculate and weight Gradient Magnitude histogram
-        std::vector<float> gradHistogram = calculateGradientMagnitudeHistogram(scaledImage, bins);
-        std::transform(gradHistogram.begin(), gradHistogram.end(), gradHistogram.begin(), 
-                       [&weights, i](float val) { return val * weights[i]; });
-        finalFeatureVector.insert(finalFeatureVector.end(), gradHistogram.begin(), gradHistogram.end());
+    calculateCustomFeature(image, bins, weightConfig, scratch, finalFeatureVector);
+    return finalFeatureVector;
+}
+
+void calculateCustomFeature(const cv::Mat& image, int bins, const std::vector<int>& weightConfig,
+                            ExtractScratch& scratch, std::vector<float>& finalFeatureVector) {
+    PROFILE_SCOPE("matchings.custom");
+    // Configurable weights for whole, half, quarter, and eighth sizes
+    const std::vector<int>& weights = weightConfig;
+    const float scales[4] = {1.0, 0.5, 0.25, 0.125}; // Corresponding scales
+
+    // Nested centered regions, one per scale
+    cv::Rect regions[4];
+    for (size_t i = 0; i < 4; i++) {
+        int scaledWidth = static_cast<int>(image.cols * scales[i]);
+        int scaledHeight = static_cast<int>(image.rows * scales[i]);
+        regions[i] = cv::Rect((image.cols - scaledWidth) / 2, (image.rows - scaledHeight) / 2, scaledWidth, scaledHeight);
     }
 
-    return finalFeatureVector;
+    // RGB histograms of all the regions come from one integral histogram
+    int bins3D = bins * bins * bins;
+    cv::Mat& rgbBinMap = scratch.mat(SCRATCH_RGB_BIN_MAP, image.rows, image.cols, CV_16UC1);
+    IntegralHistogram& rgbIntegral = scratch.rgbIntegral();
+    if (computeRGBBinMap(image, bins, rgbBinMap) != 0 || rgbIntegral.build(rgbBinMap, bins3D, regions, 4) != 0) {
+        throw std::runtime_error("Image must be a non-empty 8-bit BGR image");
+    }
+
+    // Gray, Sobel and magnitude run once on the full image, each scale is a region of its bin map
+    cv::Mat& gradBinMap = scratch.mat(SCRATCH_GRADIENT_BIN_MAP, image.rows, image.cols, CV_16UC1);
+    IntegralHistogram& gradIntegral = scratch.gradientIntegral();
+    if (computeGradientBinMap(image, bins, scratch, gradBinMap) != 0 || gradIntegral.build(gradBinMap, bins, regions, 4) != 0) {
+        throw std::runtime_error("Image is empty");
+    }
+
+    // per scale: the weighted RGB histogram, then the weighted gradient magnitude histogram
+    finalFeatureVector.resize(4 * (bins3D + bins));
+    float* out = finalFeatureVector.data();
+    for (size_t i = 0; i < 4; i++) {
+        rgbIntegral.regionHistogram(regions[i], out);
+        for (int b = 0; b < bins3D; b++) {
+            out[b] *= weights[i];
+        }
+        out += bins3D;
+
+        gradIntegral.regionHistogram(regions[i], out);
+        for (int b = 0; b < bins; b++) {
+            out[b] *= weights[i];
+        }
+        out += bins;
+    }
 }
 
 
@@ -378,17 +629,20 @@ std::vector<float> calculateCustomFeature(const cv::Mat& image, int bins, const
 ************************************************************************************************/
 // Extension: GLCM texture features
 std::vector<float> calculateGLCMFeatures(const cv::Mat& src, int distance, int angle, int levels) {
-    cv::Mat gray;
-    if (src.channels() > 1) {
-        cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY);
-    } else {
-        gray = src.clone();
-    }
+    ExtractScratch scratch(0);
+    std::vector<float> features;
+    calculateGLCMFeatures(src, distance, angle, levels, scratch, features);
+    return features;
+}
 
+void calculateGLCMFeatures(const cv::Mat& src, int distance, int angle, int levels, ExtractScratch& scratch, std::vector<float>& features) {
+    PROFILE_SCOPE("matchings.glcm");
     // Downscale the image to reduce the number of gray levels for simplification
-    gray.convertTo(gray, CV_8U, levels / 255.0);
+    cv::Mat& gray = scratch.mat(SCRATCH_QUANTIZED, src.rows, src.cols, CV_8UC1);
+    grayImage(src, scratch).convertTo(gray, CV_8U, levels / 255.0);
 
-    cv::Mat glcm(levels, levels, CV_32F, cv::Scalar(0));
+    cv::Mat& glcm = scratch.mat(SCRATCH_GLCM, levels, levels, CV_32F);
+    glcm.setTo(cv::Scalar(0));
     int dx = 0;
     int dy = 0;
 
@@ -430,96 +684,150 @@ std::vector<float> calculateGLCMFeatures(const cv::Mat& src, int distance, int a
         }
     }
 
-    std::vector<float> features = {energy, entropy, contrast, homogeneity, maxProbability};
-    return features;
+    features.resize(5);
+    features[0] = energy;
+    features[1] = entropy;
+    features[2] = contrast;
+    features[3] = homogeneity;
+    features[4] = maxProbability;
 }
 
 
 // EXTENSION: Laws' Histogram method
-// Generate Laws' Histogram from two vectors
-cv::Mat generateLawsFilter(const std::vector<int>& v1, const std::vector<int>& v2) {
-    cv::Mat filter(v1.size(), v2.size(), CV_32F);
-    for (size_t i = 0; i < v1.size(); ++i) {
-        for (size_t j = 0; j < v2.size(); ++j) {
-            filter.at<float>(i, j) = v1[i] * v2[j];
-        }
-    }
-    return filter;
+// Calculate texture energy feature vector for an image using Laws' filters
+std::vector<float> calculateLawsTextureFeatures(const cv::Mat& src) {
+    ExtractScratch scratch(0);
+    std::vector<float> features;
+    calculateLawsTextureFeatures(src, scratch, features);
+    return features;
 }
 
-// Apply Laws' filter and compute texture energy
-cv::Mat applyLawsFilter(const cv::Mat& src, const cv::Mat& filter) {
-    cv::Mat filtered, energyMap;
-    cv::filter2D(src, filtered, CV_32F, filter);
-    cv::pow(filtered, 2, energyMap); // Square to get energy
-    return energyMap;
+// Defining Laws' vectors
+static const int LAWS_VECTORS[5][5] = {
+    {1, 4, 6, 4, 1},        // L5 Level
+    {-1, -2, 0, 2, 1},      // E5 Edge
+    {-1, 0, 2, 0, -1},      // S5 Spot
+    {-1, 2, 0, -2, 1},      // W5 Wave
+    {1, -4, 6, -4, 1},      // R5 Ripple
+};
+
+// The five horizontal Laws passes of one gray row, out holds 5 rows of cols values
+static void lawsHorizontalPasses(const uchar* row, int cols, float* out) {
+    for (int x = 0; x < cols; x++) {
+        int pixels[5];
+        for (int k = 0; k < 5; k++) {
+            int sx = x + k - 2;
+            pixels[k] = row[(sx >= 0 && sx < cols) ? sx : reflect101(sx, cols)];
+        }
+        for (int j = 0; j < 5; j++) {
+            const int* v = LAWS_VECTORS[j];
+            out[j * cols + x] = static_cast<float>(v[0] * pixels[0] + v[1] * pixels[1] + v[2] * pixels[2]
+                                                   + v[3] * pixels[3] + v[4] * pixels[4]);
+        }
+    }
 }
 
-// Calculate texture energy feature vector for an image using Laws' filters
-std::vector<float> calculateLawsTextureFeatures(const cv::Mat& src) {
-    // Defining Laws' vectors
-    const std::vector<int> L5 = {1, 4, 6, 4, 1};  // Level
-    const std::vector<int> E5 = {-1, -2, 0, 2, 1}; // Edge
-    const std::vector<int> S5 = {-1, 0, 2, 0, -1}; // Spot
-    const std::vector<int> W5 = {-1, 2, 0, -2, 1}; // Wave
-    const std::vector<int> R5 = {1, -4, 6, -4, 1}; // Ripple
-    
-    const std::vector<std::vector<int>> vectors = {L5, E5, S5, W5, R5};
-
-    cv::Mat gray;
+/*
+  Every 5x5 Laws filter is the outer product of two vectors, so it is a
+  horizontal pass followed by a vertical pass. The five horizontal
+  passes of the five rows around the current one are kept in a ring of
+  row buffers, and the 25 vertical passes, squares and sums run on them
+  without an energy image. Same values as cv::filter2D, cv::pow and
+  cv::sum of the 25 filters, every partial sum is an exact integer.
+ */
+void calculateLawsTextureFeatures(const cv::Mat& src, ExtractScratch& scratch, std::vector<float>& features) {
+    PROFILE_SCOPE("matchings.laws");
     // Convert to grayscale if the source image is not already grayscale
-    if (src.channels() > 1) {
-        cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY);
-    } else {
-        gray = src;
+    cv::Mat gray = grayImage(src, scratch);
+    if (gray.empty() || gray.depth() != CV_8U) {
+        throw std::runtime_error("Image must be a non-empty 8-bit image");
     }
-
-    std::vector<float> features;
-    for (size_t i = 0; i < vectors.size(); ++i) {
-        for (size_t j = 0; j < vectors.size(); ++j) {
-            cv::Mat filter = generateLawsFilter(vectors[i], vectors[j]);
-            cv::Mat energyMap = applyLawsFilter(gray, filter);
-            float energy = cv::sum(energyMap)[0];
-            features.push_back(energy);
+    int rows = gray.rows, cols = gray.cols;
+
+    // ring slot s holds the horizontal passes of gray row ringRow[s], a row r always goes to slot r % 5
+    float* ring = scratch.rows(SCRATCH_LAWS_ROWS, static_cast<size_t>(25) * cols);
+    int ringRow[5] = {-1, -1, -1, -1, -1};
+    double energy[25] = {0};
+
+    for (int y = 0; y < rows; y++) {
+        const float* passes[5];
+        for (int k = 0; k < 5; k++) {
+            int r = reflect101(y + k - 2, rows);
+            float* slot = ring + static_cast<size_t>(r % 5) * 5 * cols;
+            if (ringRow[r % 5] != r) {
+                lawsHorizontalPasses(gray.ptr<uchar>(r), cols, slot);
+                ringRow[r % 5] = r;
+            }
+            passes[k] = slot;
+        }
+        for (int j = 0; j < 5; j++) {
+            const float* p0 = passes[0] + j * cols;
+            const float* p1 = passes[1] + j * cols;
+            const float* p2 = passes[2] + j * cols;
+            const float* p3 = passes[3] + j * cols;
+            const float* p4 = passes[4] + j * cols;
+            for (int i = 0; i < 5; i++) {
+                const int* v = LAWS_VECTORS[i];
+                float w0 = v[0], w1 = v[1], w2 = v[2], w3 = v[3], w4 = v[4];
+                double sum = 0.0;
+                for (int x = 0; x < cols; x++) {
+                    float filtered = w0 * p0[x] + w1 * p1[x] + w2 * p2[x] + w3 * p3[x] + w4 * p4[x];
+                    sum += filtered * filtered; // Square to get energy
+                }
+                energy[i * 5 + j] += sum;
+            }
         }
     }
-    return features;
+
+    // feature i * 5 + j is the filter with vertical vector i and horizontal vector j
+    features.resize(25);
+    for (int f = 0; f < 25; f++) {
+        features[f] = static_cast<float>(energy[f]);
+    }
 }
 
 // EXTENSION: Gabor filter method
 std::vector<float> computeGaborFeatures(const cv::Mat& img) {
+    ExtractScratch scratch(0);
+    std::vector<float> features;
+    computeGaborFeatures(img, scratch, features);
+    return features;
+}
+
+void computeGaborFeatures(const cv::Mat& img, ExtractScratch& scratch, std::vector<float>& features) {
+    PROFILE_SCOPE("matchings.gabor");
     // Convert to grayscale if the image is not already
-    cv::Mat gray;
-    if (img.channels() == 3) {
-        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
-    } else {
-        gray = img.clone();
-    }
+    cv::Mat gray = grayImage(img, scratch);
 
-    std::vector<float> features;
     int kernel_size = 31;
     double sigma = 2.5;
     double gamma = 0.5;
     double psi = CV_PI * 0.5; // Convert degrees to radians if needed
     int num_thetas = 4; // Number of orientations
-    std::vector<double> lambdas = {10.0, 20.0, 30.0}; // Example wavelengths (λ) for multi-scale analysis
-
-    for (double lambda : lambdas) {
-        for (int i = 0; i < num_thetas; ++i) {
-            double theta = i * CV_PI / num_thetas; // Vary orientation
-            cv::Mat kernel = cv::getGaborKernel(cv::Size(kernel_size, kernel_size), sigma, theta, lambda, gamma, psi, CV_32F);
-            cv::Mat dest;
-            cv::filter2D(gray, dest, CV_32F, kernel);
-
-            // Compute simple statistical features from the filter response
-            cv::Scalar mean, stddev;
-            cv::meanStdDev(dest, mean, stddev);
-            features.push_back(static_cast<float>(mean[0]));
-            features.push_back(static_cast<float>(stddev[0]));
+    const double lambdas[3] = {10.0, 20.0, 30.0}; // Example wavelengths (λ) for multi-scale analysis
+
+    // the filter bank does not depend on the image, it is made once per scratch
+    std::vector<cv::Mat>& kernels = scratch.kernels();
+    if (kernels.empty()) {
+        for (double lambda : lambdas) {
+            for (int i = 0; i < num_thetas; ++i) {
+                double theta = i * CV_PI / num_thetas; // Vary orientation
+                kernels.push_back(cv::getGaborKernel(cv::Size(kernel_size, kernel_size), sigma, theta, lambda, gamma, psi, CV_32F));
+            }
         }
     }
 
-    return features;
+    features.clear();
+    cv::Mat& dest = scratch.mat(SCRATCH_FILTER_RESPONSE, gray.rows, gray.cols, CV_32FC1);
+    for (const cv::Mat& kernel : kernels) {
+        cv::filter2D(gray, dest, CV_32F, kernel);
+
+        // Compute simple statistical features from the filter response
+        cv::Scalar mean, stddev;
+        cv::meanStdDev(dest, mean, stddev);
+        features.push_back(static_cast<float>(mean[0]));
+        features.push_back(static_cast<float>(stddev[0]));
+    }
 }
 
 
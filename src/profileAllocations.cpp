@@ -0,0 +1,36 @@
+/**
+ * @file profileAllocations.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief opt-in global operator new that counts heap allocations for the profiler's alloc.count
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdlib>
+#include <new>
+#include "profiler.h"
+
+/*
+  Linked into the front ends only when CMake is run with
+  -DCBIR_PROFILE_ALLOCATIONS=ON. Every operator new and new[] then
+  goes through here and is counted while the profiler is on; the
+  total is reported as the alloc.count counter. cv::Mat buffers count
+  once each, OpenCV allocates the UMatData of every buffer with new.
+ */
+
+void* operator new(size_t size) {
+    profilerCountAllocation();
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) {
+    profilerCountAllocation();
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
@@ -0,0 +1,216 @@
+/**
+ * @file profiler.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief scoped stage timers and counters, reported as a table, JSON or Chrome trace events
+ * @version 0.1
+ * @date 2024-02-23
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include "profiler.h"
+
+bool profilerActive = false;
+
+// Totals of one scope name
+struct ProfileStats {
+    long long calls;
+    long long wallNs;
+    long long cpuNs;
+    long long maxWallNs;
+};
+
+// One finished scope, kept only for the trace format
+struct ProfileEvent {
+    const char* name;
+    size_t thread;
+    long long startNs;
+    long long wallNs;
+};
+
+static std::mutex profileMutex;
+static ProfileFormat profileFormat = PROFILE_OFF;
+static std::string profileOutput;
+static long long profileOriginNs = 0;
+static std::map<std::string, ProfileStats> profileStats;
+static std::map<std::string, long long> profileCounters;
+static std::vector<ProfileEvent> profileEvents;
+// not behind profileMutex, operator new must not take a lock that allocates
+static std::atomic<long long> profileAllocations(0);
+
+long long profilerWallNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long profilerCpuNs() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// turn the profiler on with a report format
+void profilerEnable(ProfileFormat format, const std::string& outputFile) {
+    std::lock_guard<std::mutex> lock(profileMutex);
+    profileFormat = format;
+    profileOutput = outputFile;
+    if (profileOutput.empty() && format == PROFILE_TRACE) {
+        profileOutput = "cbir_trace.json";
+    }
+    profileOriginNs = profilerWallNs();
+    profilerActive = format != PROFILE_OFF;
+}
+
+// turn the profiler on from CBIR_PROFILE / CBIR_PROFILE_FILE
+int profilerInitFromEnv() {
+    const char* format = getenv("CBIR_PROFILE");
+    if (!format || !*format) {
+        return 0;
+    }
+    const char* file = getenv("CBIR_PROFILE_FILE");
+    std::string output = file ? file : "";
+    std::string name = format;
+    if (name == "summary") {
+        profilerEnable(PROFILE_SUMMARY, output);
+    } else if (name == "json") {
+        profilerEnable(PROFILE_JSON, output);
+    } else if (name == "trace") {
+        profilerEnable(PROFILE_TRACE, output);
+    } else {
+        fprintf(stderr, "Unknown CBIR_PROFILE format %s, use summary, json or trace\n", format);
+        return -1;
+    }
+    // report on every way out of the program, after main's scopes have closed
+    atexit(profilerReport);
+    return 0;
+}
+
+// record one finished scope
+void profilerRecord(const char* name, long long startNs, long long wallNs, long long cpuNs) {
+    std::lock_guard<std::mutex> lock(profileMutex);
+    ProfileStats& stats = profileStats[name];
+    stats.calls++;
+    stats.wallNs += wallNs;
+    stats.cpuNs += cpuNs;
+    if (wallNs > stats.maxWallNs) {
+        stats.maxWallNs = wallNs;
+    }
+    if (profileFormat == PROFILE_TRACE) {
+        ProfileEvent event;
+        event.name = name;
+        event.thread = std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000;
+        event.startNs = startNs;
+        event.wallNs = wallNs;
+        profileEvents.push_back(event);
+    }
+}
+
+// add to a named counter
+void profilerCount(const char* name, long long value) {
+    std::lock_guard<std::mutex> lock(profileMutex);
+    profileCounters[name] += value;
+}
+
+// count one heap allocation
+void profilerCountAllocation() {
+    if (profilerActive) {
+        profileAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+static void writeSummary(FILE* out) {
+    fprintf(out, "%-32s %8s %12s %12s %12s\n", "stage", "calls", "wall ms", "cpu ms", "max ms");
+    for (const auto& entry : profileStats) {
+        const ProfileStats& s = entry.second;
+        fprintf(out, "%-32s %8lld %12.3f %12.3f %12.3f\n", entry.first.c_str(), s.calls,
+                s.wallNs / 1e6, s.cpuNs / 1e6, s.maxWallNs / 1e6);
+    }
+    if (!profileCounters.empty()) {
+        fprintf(out, "%-32s %12s\n", "counter", "value");
+        for (const auto& entry : profileCounters) {
+            fprintf(out, "%-32s %12lld\n", entry.first.c_str(), entry.second);
+        }
+    }
+}
+
+static void writeJson(FILE* out) {
+    fprintf(out, "{\n  \"stages\": {");
+    const char* separator = "\n";
+    for (const auto& entry : profileStats) {
+        const ProfileStats& s = entry.second;
+        fprintf(out, "%s    \"%s\": {\"calls\": %lld, \"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"max_ms\": %.3f}",
+                separator, entry.first.c_str(), s.calls, s.wallNs / 1e6, s.cpuNs / 1e6, s.maxWallNs / 1e6);
+        separator = ",\n";
+    }
+    fprintf(out, "\n  },\n  \"counters\": {");
+    separator = "\n";
+    for (const auto& entry : profileCounters) {
+        fprintf(out, "%s    \"%s\": %lld", separator, entry.first.c_str(), entry.second);
+        separator = ",\n";
+    }
+    fprintf(out, "\n  }\n}\n");
+}
+
+// Chrome trace-event format: complete events ("X") in microseconds, counters as one "C" event each
+static void writeTrace(FILE* out) {
+    fprintf(out, "{\"traceEvents\": [\n");
+    const char* separator = "";
+    for (const ProfileEvent& event : profileEvents) {
+        fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f}",
+                separator, event.name, event.thread, (event.startNs - profileOriginNs) / 1e3, event.wallNs / 1e3);
+        separator = ",\n";
+    }
+    long long endNs = profilerWallNs();
+    for (const auto& entry : profileCounters) {
+        fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {\"value\": %lld}}",
+                separator, entry.first.c_str(), (endNs - profileOriginNs) / 1e3, entry.second);
+        separator = ",\n";
+    }
+    fprintf(out, "\n]}\n");
+}
+
+// write the report in the selected format
+void profilerReport() {
+    std::lock_guard<std::mutex> lock(profileMutex);
+    if (profileFormat == PROFILE_OFF) {
+        return;
+    }
+    // zero unless the operator new hook is linked in
+    long long allocations = profileAllocations.load();
+    if (allocations > 0) {
+        profileCounters["alloc.count"] = allocations;
+    }
+
+    FILE* out = stderr;
+    if (!profileOutput.empty()) {
+        out = fopen(profileOutput.c_str(), "w");
+        if (!out) {
+            fprintf(stderr, "Unable to open profile output %s\n", profileOutput.c_str());
+            return;
+        }
+    }
+
+    if (profileFormat == PROFILE_SUMMARY) {
+        writeSummary(out);
+    } else if (profileFormat == PROFILE_JSON) {
+        writeJson(out);
+    } else {
+        writeTrace(out);
+    }
+
+    if (out != stderr) {
+        fclose(out);
+        fprintf(stderr, "Profile written to %s\n", profileOutput.c_str());
+    }
+}
@@ -0,0 +1,297 @@
+/**
+ * @file queryCache.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief target features and query results keyed by the target's content hash
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "queryCache.h"
+#include "profiler.h"
+
+
+int contentHash(const std::string& path, unsigned long long& hash) {
+    PROFILE_SCOPE("cache.content_hash");
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+    hash = 14695981039346656037ULL;
+    unsigned char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= buffer[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    int error = ferror(fp);
+    fclose(fp);
+    return error ? -1 : 0;
+}
+
+// nanoseconds of the modification time, two rewrites within one second differ
+static long long modificationNs(const struct stat& info) {
+#if defined(__APPLE__)
+    return static_cast<long long>(info.st_mtimespec.tv_sec) * 1000000000LL + info.st_mtimespec.tv_nsec;
+#else
+    return static_cast<long long>(info.st_mtim.tv_sec) * 1000000000LL + info.st_mtim.tv_nsec;
+#endif
+}
+
+std::string featureStoreVersion(const std::vector<std::string>& paths) {
+    std::string version;
+    for (const std::string& path : paths) {
+        struct stat info;
+        version += path;
+        if (stat(path.c_str(), &info) == 0) {
+            version += ":" + std::to_string(static_cast<long long>(info.st_size)) + ":"
+                + std::to_string(modificationNs(info)) + ":" + std::to_string(static_cast<long long>(info.st_ino)) + ";";
+        } else {
+            version += ":missing;";
+        }
+    }
+    return version;
+}
+
+// length-prefixed strings of the cache files
+static void writeString(FILE* fp, const std::string& s) {
+    uint32_t length = static_cast<uint32_t>(s.size());
+    fwrite(&length, sizeof(uint32_t), 1, fp);
+    fwrite(s.data(), 1, s.size(), fp);
+}
+
+static bool readString(FILE* fp, std::string& s) {
+    uint32_t length;
+    if (fread(&length, sizeof(uint32_t), 1, fp) != 1 || length > (1u << 24)) {
+        return false;
+    }
+    s.resize(length);
+    return length == 0 || fread(&s[0], 1, length, fp) == length;
+}
+
+// opens an entry file and checks that it holds key, nullptr otherwise
+static FILE* openEntry(const std::string& path, const std::string& key) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return nullptr;
+    }
+    char magic[8];
+    std::string stored;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, QUERY_CACHE_MAGIC, 8) != 0 || !readString(fp, stored) || stored != key) {
+        fclose(fp);
+        return nullptr;
+    }
+    return fp;
+}
+
+// opens a new file of its own next to path for an entry, every writer gets a different name
+static FILE* createEntry(const std::string& path, std::string& temporary) {
+    std::vector<char> name(path.begin(), path.end());
+    const char suffix[] = ".XXXXXX";
+    name.insert(name.end(), suffix, suffix + sizeof(suffix));
+    int fd = mkstemp(name.data());
+    if (fd < 0) {
+        return nullptr;
+    }
+    temporary = name.data();
+    fchmod(fd, 0644);
+    FILE* fp = fdopen(fd, "wb");
+    if (!fp) {
+        close(fd);
+        unlink(temporary.c_str());
+    }
+    return fp;
+}
+
+// finishes an entry written to its temporary file, syncs it and moves it in place
+static void commitEntry(FILE* fp, const std::string& temporary, const std::string& path) {
+    bool ok = fflush(fp) == 0 && !ferror(fp) && fsync(fileno(fp)) == 0;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+    }
+}
+
+// bytes left between the position of fp and the end of its file
+static size_t remainingBytes(FILE* fp) {
+    struct stat info;
+    long position = ftell(fp);
+    if (position < 0 || fstat(fileno(fp), &info) != 0 || info.st_size < position) {
+        return 0;
+    }
+    return static_cast<size_t>(info.st_size - position);
+}
+
+QueryCache::QueryCache(const std::string& directory)
+    : directory_(directory), featureHits_(0), featureMisses_(0), resultHits_(0), resultMisses_(0) {
+    if (!directory_.empty()) {
+        mkdir(directory_.c_str(), 0755);  // fails harmlessly if it exists
+    }
+}
+
+std::string QueryCache::featureKey(unsigned long long hash, const std::string& method) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", hash);
+    return "v" + std::to_string(QUERY_CACHE_VERSION) + ":" + hex + ":" + method;
+}
+
+std::string QueryCache::resultKey(unsigned long long hash, const std::string& method, const std::string& parameters) {
+    return featureKey(hash, method) + ":" + parameters;
+}
+
+std::string QueryCache::entryPath(const std::string& key, const char* kind) const {
+    // the key can be long and hold any character, the file is named after its hash
+    unsigned long long hash = 14695981039346656037ULL;
+    for (char c : key) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.", hash);
+    return directory_ + "/" + name + kind;
+}
+
+void QueryCache::remember(std::deque<std::string>& order, const std::string& key, bool features) {
+    order.push_back(key);
+    if (order.size() > QUERY_CACHE_MEMORY_ENTRIES) {
+        if (features) {
+            features_.erase(order.front());
+        } else {
+            results_.erase(order.front());
+        }
+        order.pop_front();
+    }
+}
+
+bool QueryCache::findFeatures(const std::string& key, std::vector<float>& features) {
+    std::map<std::string, std::vector<float>>::const_iterator it = features_.find(key);
+    if (it != features_.end()) {
+        features = it->second;
+        featureHits_++;
+        PROFILE_COUNT("cache.feature_hits", 1);
+        return true;
+    }
+    if (!directory_.empty()) {
+        FILE* fp = openEntry(entryPath(key, "feat"), key);
+        uint32_t count;
+        // a damaged entry cannot ask for more floats than the file holds
+        if (fp && fread(&count, sizeof(uint32_t), 1, fp) == 1 && count <= remainingBytes(fp) / sizeof(float)) {
+            std::vector<float> stored(count);
+            bool ok = fread(stored.data(), sizeof(float), count, fp) == count;
+            fclose(fp);
+            if (ok) {
+                features = stored;
+                features_[key] = stored;
+                remember(featureOrder_, key, true);
+                featureHits_++;
+                PROFILE_COUNT("cache.feature_hits", 1);
+                return true;
+            }
+        } else if (fp) {
+            fclose(fp);
+        }
+    }
+    featureMisses_++;
+    PROFILE_COUNT("cache.feature_misses", 1);
+    return false;
+}
+
+void QueryCache::storeFeatures(const std::string& key, const std::vector<float>& features) {
+    if (features_.find(key) == features_.end()) {
+        remember(featureOrder_, key, true);
+    }
+    features_[key] = features;
+    if (directory_.empty()) {
+        return;
+    }
+    std::string path = entryPath(key, "feat");
+    std::string temporary;
+    FILE* fp = createEntry(path, temporary);
+    if (!fp) {
+        return;
+    }
+    uint32_t count = static_cast<uint32_t>(features.size());
+    fwrite(QUERY_CACHE_MAGIC, 1, 8, fp);
+    writeString(fp, key);
+    fwrite(&count, sizeof(uint32_t), 1, fp);
+    fwrite(features.data(), sizeof(float), features.size(), fp);
+    commitEntry(fp, temporary, path);
+}
+
+bool QueryCache::findResults(const std::string& key, const std::string& storeVersion, CachedResults& results) {
+    std::map<std::string, std::pair<std::string, CachedResults>>::const_iterator it = results_.find(key);
+    if (it != results_.end() && it->second.first == storeVersion) {
+        results = it->second.second;
+        resultHits_++;
+        PROFILE_COUNT("cache.result_hits", 1);
+        return true;
+    }
+    if (it == results_.end() && !directory_.empty()) {
+        FILE* fp = openEntry(entryPath(key, "res"), key);
+        std::string version;
+        CachedResults stored;
+        uint32_t count = 0;
+        bool ok = fp && readString(fp, version) && version == storeVersion && readString(fp, stored.header)
+            && fread(&count, sizeof(uint32_t), 1, fp) == 1;
+        for (uint32_t i = 0; ok && i < count; i++) {
+            std::pair<std::string, float> match;
+            ok = readString(fp, match.first) && fread(&match.second, sizeof(float), 1, fp) == 1;
+            stored.matches.push_back(match);
+        }
+        if (fp) {
+            fclose(fp);
+        }
+        if (ok) {
+            results = stored;
+            results_[key] = std::make_pair(version, stored);
+            remember(resultOrder_, key, false);
+            resultHits_++;
+            PROFILE_COUNT("cache.result_hits", 1);
+            return true;
+        }
+    }
+    resultMisses_++;
+    PROFILE_COUNT("cache.result_misses", 1);
+    return false;
+}
+
+void QueryCache::storeResults(const std::string& key, const std::string& storeVersion, const CachedResults& results) {
+    if (results_.find(key) == results_.end()) {
+        remember(resultOrder_, key, false);
+    }
+    results_[key] = std::make_pair(storeVersion, results);
+    if (directory_.empty()) {
+        return;
+    }
+    std::string path = entryPath(key, "res");
+    std::string temporary;
+    FILE* fp = createEntry(path, temporary);
+    if (!fp) {
+        return;
+    }
+    uint32_t count = static_cast<uint32_t>(results.matches.size());
+    fwrite(QUERY_CACHE_MAGIC, 1, 8, fp);
+    writeString(fp, key);
+    writeString(fp, storeVersion);
+    writeString(fp, results.header);
+    fwrite(&count, sizeof(uint32_t), 1, fp);
+    for (const std::pair<std::string, float>& match : results.matches) {
+        writeString(fp, match.first);
+        fwrite(&match.second, sizeof(float), 1, fp);
+    }
+    commitEntry(fp, temporary, path);
+}
+
+void QueryCache::report(FILE* fp) const {
+    fprintf(fp, "Cache: target features %zu hits %zu misses, results %zu hits %zu misses\n",
+            featureHits_, featureMisses_, resultHits_, resultMisses_);
+}
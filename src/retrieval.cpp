@@ -0,0 +1,287 @@
+/**
+ * @file retrieval.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief ranks the rows of a feature database against a target, shared by matching and dnn_embedding
+ * @version 0.1
+ * @date 2024-02-22
+*/
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include "matchings.h"
+#include "featureMethods.h"
+#include "retrieval.h"
+#include "profiler.h"
+
+
+// true if pair a ranks before pair b: higher first for similarities, lower first for distances, then by row
+static bool ranksBefore(bool similarity, const std::pair<float, int>& a, const std::pair<float, int>& b) {
+    if (a.first != b.first) return similarity ? a.first > b.first : a.first < b.first;
+    return a.second < b.second;
+}
+
+// Score every row against the target, in row order
+static void scoreRows(const std::string& method, const std::vector<float>& target, const FeatureMatrix& data,
+                      std::vector<std::pair<float, int>>& similarities) {
+    if (target.size() != data.cols()) {
+        throw std::runtime_error("Feature vectors must be of the same size");
+    }
+    if (!data.columnOrder().empty() && !metricIgnoresColumnOrder(method)) {
+        throw std::runtime_error("Method cannot score a matrix with reordered columns: " + method);
+    }
+    std::vector<float> query = data.toColumnOrder(target);
+    similarities.reserve(data.rows());
+    if (method == "dnn" && data.unitRows()) {
+        PROFILE_SCOPE("retrieval.score_dot");
+        // rows already have unit length: scale the target once, then one GEMV gives every cosine
+        double sum = 0;
+        for (float v : query) sum += static_cast<double>(v) * v;
+        if (sum > 0) {
+            float scale = static_cast<float>(1.0 / std::sqrt(sum));
+            for (float& v : query) v *= scale;
+        }
+        std::vector<float> scores(data.rows());
+        matrixVectorDot(data, query.data(), scores.data());
+        for (size_t i = 0; i < scores.size(); i++) {
+            similarities.emplace_back(scores[i], static_cast<int>(i));
+        }
+    } else {
+        PROFILE_SCOPE("retrieval.score");
+        // one walk through the contiguous rows
+        FeatureMetric metric = metricForMethod(method);
+        size_t cols = data.cols();
+        for (size_t i = 0; i < data.rows(); i++) {
+            similarities.emplace_back(metric(query.data(), data.row(i), cols), static_cast<int>(i));
+        }
+    }
+    PROFILE_COUNT("retrieval.rows_scanned", data.rows());
+}
+
+// Score every row against the target and sort, best match first
+std::vector<std::pair<float, int>> rankRows(const std::string& method, const std::vector<float>& target,
+                                            const FeatureMatrix& data) {
+    std::vector<std::pair<float, int>> similarities;
+    if (data.empty()) {
+        return similarities;
+    }
+    scoreRows(method, target, data, similarities);
+
+    PROFILE_SCOPE("retrieval.sort");
+    // by using histogram intersection or cosine, the higher the value, the more similar the images are
+    // for SSD the lower, the more similar
+    bool similarity = isSimilarityMethod(method);
+    std::sort(similarities.begin(), similarities.end(), [similarity](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return ranksBefore(similarity, a, b);
+    });
+    return similarities;
+}
+
+/*
+  SSD scan that keeps the k best rows in a max-heap. Once k rows are
+  held, the distance of the K-th best is the bound: a row whose partial
+  sum passes it cannot enter, so its sum is abandoned. A row that ties
+  the bound would rank after the rows already held (higher row index),
+  so abandoning on a strictly larger sum keeps the result exact.
+ */
+static void topRowsSSD(const std::vector<float>& target, const FeatureMatrix& data, size_t k,
+                       std::vector<std::pair<float, int>>& best) {
+    PROFILE_SCOPE("retrieval.score_abandon");
+    std::vector<float> query = data.toColumnOrder(target);
+    size_t cols = data.cols();
+    auto better = [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return ranksBefore(false, a, b);
+    };
+    float bound = std::numeric_limits<float>::infinity();
+    long long abandoned = 0;
+    best.reserve(k);
+    for (size_t i = 0; i < data.rows(); i++) {
+        float distance = computeSSDBounded(query.data(), data.row(i), cols, bound);
+        if (best.size() < k) {
+            best.emplace_back(distance, static_cast<int>(i));
+            std::push_heap(best.begin(), best.end(), better);
+            if (best.size() == k) bound = best.front().first;
+        } else if (distance < bound) {
+            std::pop_heap(best.begin(), best.end(), better);
+            best.back() = std::make_pair(distance, static_cast<int>(i));
+            std::push_heap(best.begin(), best.end(), better);
+            bound = best.front().first;
+        } else if (distance > bound) {
+            abandoned++;
+        }
+    }
+    PROFILE_COUNT("retrieval.rows_scanned", data.rows());
+    PROFILE_COUNT("retrieval.rows_abandoned", abandoned);
+}
+
+// The k best rows, best match first, the same rows rankRows puts first
+std::vector<std::pair<float, int>> rankTopRows(const std::string& method, const std::vector<float>& target,
+                                               const FeatureMatrix& data, size_t k) {
+    std::vector<std::pair<float, int>> similarities;
+    if (data.empty() || k == 0) {
+        return similarities;
+    }
+    k = std::min(k, data.rows());
+    bool similarity = isSimilarityMethod(method);
+    auto before = [similarity](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return ranksBefore(similarity, a, b);
+    };
+
+    if (isSSDMethod(method)) {
+        if (target.size() != data.cols()) {
+            throw std::runtime_error("Feature vectors must be of the same size");
+        }
+        topRowsSSD(target, data, k, similarities);
+        std::sort(similarities.begin(), similarities.end(), before);
+        return similarities;
+    }
+
+    scoreRows(method, target, data, similarities);
+    PROFILE_SCOPE("retrieval.sort");
+    std::partial_sort(similarities.begin(), similarities.begin() + k, similarities.end(), before);
+    similarities.resize(k);
+    return similarities;
+}
+
+/*
+  The target in the matrix's column order, and the metric that scores
+  it against a row. dnn on normalized rows scales the target to unit
+  length so the cosine is one dot product, as in scoreRows.
+ */
+static std::vector<float> prepareQuery(const std::string& method, const std::vector<float>& target,
+                                       const FeatureMatrix& data, FeatureMetric& metric) {
+    if (target.size() != data.cols()) {
+        throw std::runtime_error("Feature vectors must be of the same size");
+    }
+    if (!data.columnOrder().empty() && !metricIgnoresColumnOrder(method)) {
+        throw std::runtime_error("Method cannot score a matrix with reordered columns: " + method);
+    }
+    std::vector<float> query = data.toColumnOrder(target);
+    metric = metricForMethod(method);
+    if (method == "dnn" && data.unitRows()) {
+        double sum = 0;
+        for (float v : query) sum += static_cast<double>(v) * v;
+        if (sum > 0) {
+            float scale = static_cast<float>(1.0 / std::sqrt(sum));
+            for (float& v : query) v *= scale;
+        }
+        metric = dotProduct;
+    }
+    return query;
+}
+
+// Only the candidate rows are scored, the k best of them returned
+std::vector<std::pair<float, int>> rankCandidateRows(const std::string& method, const std::vector<float>& target,
+                                                     const FeatureMatrix& data, const std::vector<int>& candidates,
+                                                     size_t k) {
+    PROFILE_SCOPE("retrieval.score_candidates");
+    std::vector<std::pair<float, int>> similarities;
+    if (data.empty() || candidates.empty() || k == 0) {
+        return similarities;
+    }
+    FeatureMetric metric;
+    std::vector<float> query = prepareQuery(method, target, data, metric);
+    similarities.reserve(candidates.size());
+    for (int row : candidates) {
+        if (row < 0 || static_cast<size_t>(row) >= data.rows()) {
+            throw std::runtime_error("Candidate row out of range");
+        }
+        similarities.emplace_back(metric(query.data(), data.row(row), data.cols()), row);
+    }
+    PROFILE_COUNT("retrieval.rows_scanned", candidates.size());
+
+    bool similarity = isSimilarityMethod(method);
+    k = std::min(k, similarities.size());
+    std::partial_sort(similarities.begin(), similarities.begin() + k, similarities.end(),
+                      [similarity](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+                          return ranksBefore(similarity, a, b);
+                      });
+    similarities.resize(k);
+    return similarities;
+}
+
+// A fusion source ready to score: its query, metric and score normalization
+struct FusionScorer {
+    const FusionSource* source;
+    std::vector<float> query;
+    FeatureMetric metric;
+    float mean;
+    float scale;    // weight / standard deviation, negative for distances so lower is better
+};
+
+// The k best rows by weighted sum of normalized scores, best match first
+std::vector<std::pair<float, int>> fuseTopRows(const std::vector<FusionSource>& sources, size_t rows, size_t k) {
+    PROFILE_SCOPE("retrieval.fuse");
+    std::vector<std::pair<float, int>> best;
+    if (sources.empty() || rows == 0 || k == 0) {
+        return best;
+    }
+
+    // score statistics of each source from a strided sample of the rows, not the whole scan
+    std::vector<FusionScorer> scorers(sources.size());
+    size_t step = std::max<size_t>(1, rows / FUSION_SAMPLE_ROWS);
+    for (size_t s = 0; s < sources.size(); s++) {
+        const FusionSource& source = sources[s];
+        if (source.rows.size() != rows) {
+            throw std::runtime_error("Fusion source is not aligned with the fused rows: " + source.method);
+        }
+        FusionScorer& scorer = scorers[s];
+        scorer.source = &source;
+        scorer.query = prepareQuery(source.method, source.target, *source.data, scorer.metric);
+        double sum = 0, squares = 0;
+        size_t count = 0;
+        for (size_t r = 0; r < rows; r += step) {
+            if (source.rows[r] < 0) continue;
+            double score = scorer.metric(scorer.query.data(), source.data->row(source.rows[r]), source.data->cols());
+            sum += score;
+            squares += score * score;
+            count++;
+        }
+        double mean = count ? sum / count : 0.0;
+        double deviation = count ? std::sqrt(std::max(0.0, squares / count - mean * mean)) : 0.0;
+        scorer.mean = static_cast<float>(mean);
+        scorer.scale = static_cast<float>(source.weight / (deviation > 0 ? deviation : 1.0));
+        if (!isSimilarityMethod(source.method)) {
+            scorer.scale = -scorer.scale;
+        }
+    }
+
+    // one pass: each row scored by every source in turn, only the k best fused scores kept
+    auto better = [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
+        return ranksBefore(true, a, b);
+    };
+    best.reserve(k);
+    size_t fused = 0;
+    for (size_t r = 0; r < rows; r++) {
+        float score = 0.0f;
+        bool complete = true;
+        for (const FusionScorer& scorer : scorers) {
+            int row = scorer.source->rows[r];
+            if (row < 0) {
+                complete = false;
+                break;
+            }
+            const FeatureMatrix& data = *scorer.source->data;
+            score += scorer.scale * (scorer.metric(scorer.query.data(), data.row(row), data.cols()) - scorer.mean);
+        }
+        if (!complete) {
+            continue;
+        }
+        fused++;
+        std::pair<float, int> scored(score, static_cast<int>(r));
+        if (best.size() < k) {
+            best.push_back(scored);
+            std::push_heap(best.begin(), best.end(), better);
+        } else if (better(scored, best.front())) {
+            std::pop_heap(best.begin(), best.end(), better);
+            best.back() = scored;
+            std::push_heap(best.begin(), best.end(), better);
+        }
+    }
+    PROFILE_COUNT("retrieval.rows_fused", fused);
+    std::sort(best.begin(), best.end(), better);
+    return best;
+}
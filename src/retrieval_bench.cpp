@@ -0,0 +1,267 @@
+/**
+ * @file retrieval_bench.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief end-to-end retrieval benchmark, load time, query latency percentiles, throughput and peak memory
+ * @version 0.1
+ * @date 2024-02-22
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sys/resource.h>
+#include <opencv2/opencv.hpp>
+#include "csv_util.h"
+#include "featureMethods.h"
+#include "imageIO.h"
+#include "retrieval.h"
+#include "filenameIndex.h"
+
+// rows of the synthetic corpus when no images or csv are given
+#define RETRIEVAL_BENCH_ROWS 1000
+// queries fired at the database
+#define RETRIEVAL_BENCH_QUERIES 100
+// dimension of the ResNet18 embeddings used by dnn_embedding
+#define DNN_EMBEDDING_DIM 512
+
+
+void retrievalBenchMenu() {
+    printf("Usage: ./retrieval_bench <method> [options]\n");
+    printf("method: a matching method (b, h2, h3, m, tc, glcm, l, gabor, custom_s, custom_m, custom_l) or dnn\n");
+    printf("options:\n");
+    printf("  --images <dir>: build the database from a directory of images, queries run like matching\n");
+    printf("  --csv <file>: use an existing feature file as the database, queries run like dnn_embedding\n");
+    printf("  --synthetic <n>: n random feature rows as the database (default %d)\n", RETRIEVAL_BENCH_ROWS);
+    printf("  --rows <n>: scale mode, replicate the corpus up to n rows\n");
+    printf("  --queries <n>: number of queries (default %d)\n", RETRIEVAL_BENCH_QUERIES);
+    printf("  --top <n>: matches per query (default 3)\n");
+    printf("  --variance-order: SSD methods sum the high variance dimensions first, like matching --variance-order\n");
+    printf("  --huge-pages: load the database into a huge page backed feature matrix\n");
+    printf("  --format <text|json>: report format (default text)\n");
+}
+
+static double elapsedMs(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident set size of the process in MB
+static double peakRssMb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / (1024.0 * 1024.0);  // bytes on macOS
+#else
+    return usage.ru_maxrss / 1024.0;  // kilobytes on Linux
+#endif
+}
+
+// Value below which the given fraction of the sorted samples fall
+static double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty()) return 0.0;
+    size_t index = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+// Random feature rows with the dimension the method produces
+static void syntheticCorpus(const std::string& method, size_t rows, std::vector<std::string>& names,
+                            std::vector<std::vector<float>>& features) {
+    size_t dim = DNN_EMBEDDING_DIM;
+    if (method != "dnn") {
+        cv::Mat probe(120, 160, CV_8UC3);
+        cv::randu(probe, cv::Scalar(0, 0, 0), cv::Scalar(256, 256, 256));
+        dim = extractFeatureByMethod(method, probe).size();
+    }
+    unsigned seed = 12345u;
+    for (size_t r = 0; r < rows; r++) {
+        std::vector<float> feature(dim);
+        for (size_t i = 0; i < dim; i++) {
+            seed = seed * 1103515245u + 12345u;
+            feature[i] = ((seed >> 8) & 0xFFFF) / 65536.0f;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "synthetic.%06zu.jpg", r);
+        names.push_back(name);
+        features.push_back(feature);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        retrievalBenchMenu();
+        return EXIT_FAILURE;
+    }
+    std::string method = argv[1];
+    if (!isMatchingMethod(method)) {
+        std::cerr << "Error: invalid method" << std::endl;
+        retrievalBenchMenu();
+        return EXIT_FAILURE;
+    }
+
+    std::string imageDir, csvInput, format = "text";
+    size_t syntheticRows = RETRIEVAL_BENCH_ROWS, scaleRows = 0, queries = RETRIEVAL_BENCH_QUERIES;
+    int N = 3;
+    bool hugePages = false, varianceOrder = false;
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--images" && i + 1 < argc) {
+            imageDir = argv[++i];
+        } else if (option == "--csv" && i + 1 < argc) {
+            csvInput = argv[++i];
+        } else if (option == "--synthetic" && i + 1 < argc) {
+            syntheticRows = std::stoul(argv[++i]);
+        } else if (option == "--rows" && i + 1 < argc) {
+            scaleRows = std::stoul(argv[++i]);
+        } else if (option == "--queries" && i + 1 < argc) {
+            queries = std::stoul(argv[++i]);
+        } else if (option == "--top" && i + 1 < argc) {
+            N = std::stoi(argv[++i]);
+        } else if (option == "--variance-order") {
+            varianceOrder = true;
+        } else if (option == "--huge-pages") {
+            hugePages = true;
+        } else if (option == "--format" && i + 1 < argc) {
+            format = argv[++i];
+        } else {
+            std::cerr << "Error: invalid option " << option << std::endl;
+            retrievalBenchMenu();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!imageDir.empty() && method == "dnn") {
+        std::cerr << "Error: dnn embeddings cannot be extracted from images, use --csv" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (queries < 1 || N < 1 || (format != "text" && format != "json")) {
+        retrievalBenchMenu();
+        return EXIT_FAILURE;
+    }
+
+    // Build the corpus
+    std::vector<std::string> names;
+    std::vector<std::vector<float>> features;
+    std::vector<std::string> imageFiles;
+    auto start = std::chrono::steady_clock::now();
+    if (!imageDir.empty()) {
+        if (listImageFiles(imageDir, imageFiles) != 0) {
+            std::cerr << "Error: cannot open directory " << imageDir << std::endl;
+            return EXIT_FAILURE;
+        }
+        for (const std::string& file_name : imageFiles) {
+            cv::Mat img = readImage(imageDir + "/" + file_name, fullDecodePolicy());
+            if (img.empty()) continue;
+            names.push_back(file_name);
+            features.push_back(extractFeatureByMethod(method, img));
+        }
+    } else if (!csvInput.empty()) {
+        FilenameArena filenames;
+        if (read_image_data_csv(const_cast<char*>(csvInput.c_str()), filenames, features, false) != 0) {
+            std::cerr << "Error: cannot read " << csvInput << std::endl;
+            return EXIT_FAILURE;
+        }
+        for (size_t i = 0; i < filenames.size(); i++) {
+            names.push_back(filenames.str(i));
+        }
+    } else {
+        syntheticCorpus(method, syntheticRows, names, features);
+    }
+    double buildMs = elapsedMs(start);
+    size_t corpusRows = names.size();
+    if (corpusRows == 0) {
+        std::cerr << "Error: empty corpus" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    // Write the database, replicated up to the requested number of rows in scale mode
+    std::string dbFile = "retrieval_bench_tmp.csv";
+    size_t dbRows = std::max(scaleRows, corpusRows);
+    start = std::chrono::steady_clock::now();
+    FILE* fp = fopen(dbFile.c_str(), "w");
+    if (!fp) {
+        std::cerr << "Error: cannot write " << dbFile << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (size_t r = 0; r < dbRows; r++) {
+        size_t source = r % corpusRows;
+        std::string name = names[source];
+        if (r >= corpusRows) {
+            name += "#" + std::to_string(r / corpusRows);
+        }
+        write_image_data_csv_row(fp, name.c_str(), features[source]);
+    }
+    fclose(fp);
+    double writeMs = elapsedMs(start);
+    size_t dim = features[0].size();
+    std::vector<std::vector<float>>().swap(features);
+
+    // Load it the way matching and dnn_embedding do
+    FilenameArena filenames;
+    FeatureMatrix data;
+    data.setHugePages(hugePages);
+    start = std::chrono::steady_clock::now();
+    if (read_image_data_csv(const_cast<char*>(dbFile.c_str()), filenames, data, false) != 0) {
+        std::cerr << "Error: cannot read " << dbFile << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (method == "dnn") {
+        data.normalizeRows();  // like dnn_embedding
+    }
+    if (varianceOrder && isSSDMethod(method)) {
+        data.orderColumnsByVariance();  // like matching --variance-order
+    }
+    FilenameIndex index;
+    index.build(filenames);
+    double loadMs = elapsedMs(start);
+    double loadRssMb = peakRssMb();
+
+    // Fire the queries: extract from the image like matching, or look the row up by name like dnn_embedding
+    std::vector<double> latencies;
+    latencies.reserve(queries);
+    for (size_t q = 0; q < queries; q++) {
+        size_t row = (q * 7919) % corpusRows;
+        start = std::chrono::steady_clock::now();
+        std::vector<float> target;
+        if (!imageFiles.empty()) {
+            cv::Mat target_image = readImage(imageDir + "/" + names[row], fullDecodePolicy());
+            target = extractFeatureByMethod(method, target_image);
+        } else {
+            int targetRow = index.find(names[row]);
+            if (targetRow >= 0) {
+                target = data.rowVector(targetRow);
+            }
+        }
+        std::vector<std::pair<float, int>> matches = rankTopRows(method, target, data, N + 1);
+        latencies.push_back(elapsedMs(start));
+    }
+
+    std::remove(dbFile.c_str());
+
+    double totalMs = 0;
+    for (double latency : latencies) totalMs += latency;
+    std::sort(latencies.begin(), latencies.end());
+    double qps = totalMs > 0 ? latencies.size() * 1000.0 / totalMs : 0.0;
+
+    if (format == "json") {
+        printf("{\"method\": \"%s\", \"corpus_rows\": %zu, \"db_rows\": %zu, \"dim\": %zu, \"queries\": %zu, "
+               "\"build_ms\": %.1f, \"write_ms\": %.1f, \"load_ms\": %.1f, \"load_rss_mb\": %.1f, "
+               "\"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f, \"qps\": %.2f, \"peak_rss_mb\": %.1f}\n",
+               method.c_str(), corpusRows, dbRows, dim, latencies.size(), buildMs, writeMs, loadMs, loadRssMb,
+               percentile(latencies, 0.50), percentile(latencies, 0.95), percentile(latencies, 0.99), qps, peakRssMb());
+    } else {
+        printf("Method %s, %zu rows (%zu distinct), %zu dimensions, %zu queries, top %d\n",
+               method.c_str(), dbRows, corpusRows, dim, latencies.size(), N);
+        printf("  build corpus: %10.1f ms\n", buildMs);
+        printf("  write csv:    %10.1f ms\n", writeMs);
+        printf("  load csv:     %10.1f ms  (peak RSS after load %.1f MB)\n", loadMs, loadRssMb);
+        printf("  query p50:    %10.3f ms\n", percentile(latencies, 0.50));
+        printf("  query p95:    %10.3f ms\n", percentile(latencies, 0.95));
+        printf("  query p99:    %10.3f ms\n", percentile(latencies, 0.99));
+        printf("  throughput:   %10.2f queries/s\n", qps);
+        printf("  peak RSS:     %10.1f MB\n", peakRssMb());
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * @file shard.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief split a feature CSV in shards that matching --shards queries by scatter-gather
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "shardedStore.h"
+#include "profiler.h"
+
+
+void shardMenu() {
+    printf("Usage: ./shard <feature csv> <K> [--by hash|range]\n");
+    printf("Writes <feature csv without .csv>.shard-<i>-of-<K>.csv for i = 0 .. K-1\n");
+    printf("  --by hash: an image goes to the shard of the hash of its file name (default), new images do not move the others\n");
+    printf("  --by range: consecutive blocks of rows, in CSV order\n");
+}
+
+int main(int argc, char* argv[]) {
+    // Stage timers and counters, see profiler.h
+    profilerInitFromEnv();
+    PROFILE_SCOPE("shard.total");
+
+    if (argc < 3) {
+        shardMenu();
+        return EXIT_FAILURE;
+    }
+    std::string csvFile = argv[1];
+    int shards = std::atoi(argv[2]);
+    ShardPolicy policy = SHARD_BY_HASH;
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--by" && i + 1 < argc) {
+            std::string by = argv[++i];
+            if (by == "hash") {
+                policy = SHARD_BY_HASH;
+            } else if (by == "range") {
+                policy = SHARD_BY_RANGE;
+            } else {
+                shardMenu();
+                return EXIT_FAILURE;
+            }
+        } else {
+            std::cerr << "Error: invalid option " << option << std::endl;
+            shardMenu();
+            return EXIT_FAILURE;
+        }
+    }
+    if (shards < 1) {
+        shardMenu();
+        return EXIT_FAILURE;
+    }
+
+    if (splitFeatureCsv(csvFile, shards, policy) != 0) {
+        std::cerr << "Error: cannot split " << csvFile << std::endl;
+        return EXIT_FAILURE;
+    }
+    for (int s = 0; s < shards; s++) {
+        printf("%s\n", shardCsvPath(csvFile, s, shards).c_str());
+    }
+    return 0;
+}
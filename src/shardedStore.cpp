@@ -0,0 +1,144 @@
+/**
+ * @file shardedStore.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief feature CSVs split in shards and queried by scatter-gather
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "csv_util.h"
+#include "featureMatrix.h"
+#include "featureMethods.h"
+#include "retrieval.h"
+#include "shardedStore.h"
+#include "profiler.h"
+
+
+std::string shardCsvPath(const std::string& csvFile, size_t shard, size_t shards) {
+    std::string base = csvFile;
+    if (base.size() >= 4 && base.compare(base.size() - 4, 4, ".csv") == 0) {
+        base.resize(base.size() - 4);
+    }
+    return base + ".shard-" + std::to_string(shard) + "-of-" + std::to_string(shards) + ".csv";
+}
+
+size_t shardOfName(const char* name, size_t length, size_t shards) {
+    // 32-bit FNV-1a, the same on every platform so shards can be built on one machine and used on another
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619u;
+    }
+    return hash % shards;
+}
+
+int splitFeatureCsv(const std::string& csvFile, size_t shards, ShardPolicy policy) {
+    PROFILE_SCOPE("shard.split");
+    if (shards == 0) {
+        return -1;
+    }
+    FilenameArena filenames;
+    FeatureMatrix data;
+    if (read_image_data_csv(const_cast<char*>(csvFile.c_str()), filenames, data, false) != 0) {
+        return -1;
+    }
+
+    std::vector<FILE*> files(shards, nullptr);
+    int result = 0;
+    for (size_t s = 0; s < shards && result == 0; s++) {
+        files[s] = fopen(shardCsvPath(csvFile, s, shards).c_str(), "w");
+        if (!files[s]) {
+            result = -1;
+        }
+    }
+    size_t perShard = (data.rows() + shards - 1) / shards;
+    for (size_t r = 0; r < data.rows() && result == 0; r++) {
+        size_t s = policy == SHARD_BY_HASH ? shardOfName(filenames.name(r), filenames.length(r), shards) : r / perShard;
+        if (write_image_data_csv_row(files[s], filenames.name(r), data.rowVector(r)) != 0) {
+            result = -1;
+        }
+    }
+    for (FILE* fp : files) {
+        if (fp && fclose(fp) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+int scatterGatherTopRows(const std::string& method, const std::vector<float>& target, const std::string& csvFile,
+                         size_t shards, size_t k, int threads, std::vector<ShardMatch>& matches) {
+    PROFILE_SCOPE("shard.scatter_gather");
+    matches.clear();
+    if (shards == 0) {
+        return -1;
+    }
+
+    // scatter: every thread takes the next shard, loads it and keeps its k best
+    std::vector<std::vector<ShardMatch>> partial(shards);
+    std::atomic<size_t> nextShard(0);
+    std::atomic<int> failed(0);
+    auto worker = [&]() {
+        for (size_t s = nextShard++; s < shards; s = nextShard++) {
+            std::string path = shardCsvPath(csvFile, s, shards);
+            FilenameArena filenames;
+            FeatureMatrix data;
+            if (read_image_data_csv(const_cast<char*>(path.c_str()), filenames, data, false) != 0) {
+                fprintf(stderr, "Cannot read shard %s\n", path.c_str());
+                failed++;
+                continue;
+            }
+            if (method == "dnn") {
+                data.normalizeRows();
+            }
+            // a shard of another width throws, and an exception must not leave a thread
+            std::vector<std::pair<float, int>> best;
+            try {
+                best = rankTopRows(method, target, data, k);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Cannot rank shard %s: %s\n", path.c_str(), e.what());
+                failed++;
+                continue;
+            }
+            for (const std::pair<float, int>& match : best) {
+                partial[s].push_back(ShardMatch{match.first, s, match.second, filenames.str(match.second)});
+            }
+        }
+    };
+    threads = std::max(1, std::min(threads, static_cast<int>(shards)));
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : pool) {
+        t.join();
+    }
+    if (failed > 0) {
+        return -1;
+    }
+
+    // gather: the global k best are among the k best of each shard
+    bool similarity = isSimilarityMethod(method);
+    for (std::vector<ShardMatch>& list : partial) {
+        matches.insert(matches.end(), list.begin(), list.end());
+    }
+    std::sort(matches.begin(), matches.end(), [similarity](const ShardMatch& a, const ShardMatch& b) {
+        if (a.score != b.score) return similarity ? a.score > b.score : a.score < b.score;
+        if (a.shard != b.shard) return a.shard < b.shard;
+        return a.row < b.row;
+    });
+    if (matches.size() > k) {
+        matches.resize(k);
+    }
+    PROFILE_COUNT("shard.shards_queried", shards);
+    return 0;
+}
@@ -0,0 +1,264 @@
+/**
+ * @file tarReader.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief streaming the members of a tar archive from a file or stdin
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "tarReader.h"
+#include "profiler.h"
+
+// stdio buffer of the archive, large reads keep the system calls per small member down
+#define TAR_READ_BUFFER (1 << 20)
+
+
+bool isTarInput(const std::string& input) {
+    return input == "-" || (input.size() > 4 && input.compare(input.size() - 4, 4, ".tar") == 0);
+}
+
+// numeric header field: octal text, or base-256 when the high bit of the first byte is set (GNU, sizes of 8 GB and more)
+static bool parseNumber(const unsigned char* field, size_t length, size_t& value) {
+    value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < length; i++) {
+            value = (value << 8) | field[i];
+        }
+        return true;
+    }
+    size_t i = 0;
+    while (i < length && field[i] == ' ') i++;
+    size_t digits = 0;
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++, digits++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return digits > 0 || i == length || field[i] == '\0';
+}
+
+// text of a fixed-size header field, which is not terminated when it is full
+static std::string fieldText(const unsigned char* field, size_t length) {
+    const char* text = reinterpret_cast<const char*>(field);
+    return std::string(text, strnlen(text, length));
+}
+
+// the stored checksum is the sum of the header bytes with the checksum field read as spaces
+static bool checksumMatches(const unsigned char* block) {
+    size_t stored;
+    if (!parseNumber(block + 148, 8, stored)) {
+        return false;
+    }
+    unsigned long unsignedSum = 0;
+    long signedSum = 0;
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        unsigned char c = (i >= 148 && i < 156) ? ' ' : block[i];
+        unsignedSum += c;
+        signedSum += static_cast<signed char>(c);
+    }
+    // some old writers summed signed chars
+    return stored == unsignedSum || static_cast<long>(stored) == signedSum;
+}
+
+TarReader::TarReader() : fp_(nullptr), ownsFile_(false), remaining_(0), padding_(0), ended_(false), fileSize_(-1) {}
+
+TarReader::~TarReader() {
+    if (fp_ && ownsFile_) {
+        fclose(fp_);
+    }
+}
+
+int TarReader::open(const std::string& input) {
+    if (input == "-") {
+        fp_ = stdin;
+        ownsFile_ = false;
+    } else {
+        fp_ = fopen(input.c_str(), "rb");
+        ownsFile_ = true;
+    }
+    if (!fp_) {
+        return -1;
+    }
+    setvbuf(fp_, nullptr, _IOFBF, TAR_READ_BUFFER);
+    remaining_ = padding_ = 0;
+    ended_ = false;
+    struct stat info;
+    fileSize_ = fstat(fileno(fp_), &info) == 0 && S_ISREG(info.st_mode) ? static_cast<long long>(info.st_size) : -1;
+    return 0;
+}
+
+// 1 with a block, 0 at a clean end of file, -1 if the file ends inside the block
+int TarReader::readBlock(unsigned char* block) {
+    size_t n = fread(block, 1, TAR_BLOCK_SIZE, fp_);
+    if (n == TAR_BLOCK_SIZE) {
+        return 1;
+    }
+    return n == 0 && !ferror(fp_) ? 0 : -1;
+}
+
+// true if the archive still holds bytes more bytes, always true on a pipe
+bool TarReader::available(size_t bytes) {
+    if (fileSize_ < 0) {
+        return true;
+    }
+    off_t position = ftello(fp_);
+    return position >= 0 && static_cast<unsigned long long>(fileSize_ - position) >= bytes;
+}
+
+int TarReader::skip(size_t bytes) {
+    if (bytes == 0) {
+        return 0;
+    }
+    // seeking past the end of a file succeeds, so a truncated file is caught here
+    if (!available(bytes)) {
+        return -1;
+    }
+    // a file seeks, a pipe has to be read
+    if (fseeko(fp_, static_cast<off_t>(bytes), SEEK_CUR) == 0) {
+        return 0;
+    }
+    unsigned char buffer[65536];
+    while (bytes > 0) {
+        size_t n = fread(buffer, 1, std::min(bytes, sizeof(buffer)), fp_);
+        if (n == 0) {
+            return -1;
+        }
+        bytes -= n;
+    }
+    return 0;
+}
+
+// data of a GNU long name or pax header, with its padding
+int TarReader::readLongText(size_t size, std::string& text) {
+    if (size > (1u << 20)) {
+        return -1;
+    }
+    text.resize(size);
+    if (size > 0 && fread(&text[0], 1, size, fp_) != size) {
+        return -1;
+    }
+    return skip((TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+}
+
+int TarReader::next(TarMember& member) {
+    if (!fp_ || ended_) {
+        return 0;
+    }
+    if (skip(remaining_ + padding_) != 0) {
+        return -1;
+    }
+    remaining_ = padding_ = 0;
+
+    // a long name or pax header applies to the header that follows it
+    std::string longPath;
+    bool haveSize = false;
+    size_t paxSize = 0;
+    unsigned char block[TAR_BLOCK_SIZE];
+    for (;;) {
+        int status = readBlock(block);
+        if (status <= 0) {
+            // an archive may stop without its two zero blocks
+            ended_ = true;
+            return status;
+        }
+        bool zero = true;
+        for (int i = 0; i < TAR_BLOCK_SIZE && zero; i++) {
+            zero = block[i] == 0;
+        }
+        if (zero) {
+            ended_ = true;
+            return 0;
+        }
+        size_t size;
+        if (!checksumMatches(block) || !parseNumber(block + 124, 12, size)) {
+            return -1;
+        }
+        if (haveSize) {
+            size = paxSize;
+        }
+        size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+        char type = static_cast<char>(block[156]);
+        // the data of every entry must be in the file, a damaged size or a cut file stops here
+        if (!available(size)) {
+            return -1;
+        }
+
+        if (type == 'L') {
+            if (readLongText(size, longPath) != 0) {
+                return -1;
+            }
+            longPath = std::string(longPath.c_str());
+            continue;
+        }
+        if (type == 'x') {
+            // "<length> <key>=<value>\n" records
+            std::string records;
+            if (readLongText(size, records) != 0) {
+                return -1;
+            }
+            size_t pos = 0;
+            while (pos < records.size()) {
+                size_t space = records.find(' ', pos);
+                if (space == std::string::npos) break;
+                size_t length = std::strtoul(records.c_str() + pos, nullptr, 10);
+                if (length == 0 || pos + length > records.size()) break;
+                std::string record = records.substr(space + 1, pos + length - space - 2);
+                size_t equals = record.find('=');
+                if (equals != std::string::npos) {
+                    std::string key = record.substr(0, equals);
+                    if (key == "path") {
+                        longPath = record.substr(equals + 1);
+                    } else if (key == "size") {
+                        paxSize = std::strtoull(record.c_str() + equals + 1, nullptr, 10);
+                        haveSize = true;
+                    }
+                }
+                pos += length;
+            }
+            continue;
+        }
+        if (type != '0' && type != '\0' && type != '7') {
+            // directories, links, devices, global pax headers and GNU long link names
+            if (skip(size + padding) != 0) {
+                return -1;
+            }
+            if (type != 'K' && type != 'g') {
+                longPath.clear();
+                haveSize = false;
+            }
+            continue;
+        }
+
+        member.path = longPath;
+        if (member.path.empty()) {
+            member.path = fieldText(block, 100);
+            std::string prefix = fieldText(block + 345, 155);
+            if (memcmp(block + 257, "ustar", 5) == 0 && !prefix.empty()) {
+                member.path = prefix + "/" + member.path;
+            }
+        }
+        member.size = size;
+        remaining_ = size;
+        padding_ = padding;
+        PROFILE_COUNT("tar.members", 1);
+        return 1;
+    }
+}
+
+int TarReader::read(std::vector<unsigned char>& bytes) {
+    PROFILE_SCOPE("tar.read_member");
+    if (remaining_ > TAR_MAX_MEMBER_BYTES) {
+        return -1;
+    }
+    bytes.resize(remaining_);
+    size_t n = remaining_ > 0 ? fread(bytes.data(), 1, remaining_, fp_) : 0;
+    bool ok = n == remaining_;
+    remaining_ = 0;
+    return ok ? 0 : -1;
+}
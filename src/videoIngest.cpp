@@ -0,0 +1,111 @@
+/**
+ * @file videoIngest.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief feature extraction of the frames of a video, at a stride and skipping unchanged frames
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+#include "matchings.h"
+#include "csv_util.h"
+#include "featureMethods.h"
+#include "extractScratch.h"
+#include "videoIngest.h"
+#include "profiler.h"
+
+
+bool isVideoInput(const std::string& input) {
+    size_t dot = input.find_last_of('.');
+    if (dot == std::string::npos) {
+        return false;
+    }
+    std::string extension = input.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    return extension == "mp4" || extension == "avi" || extension == "mov" || extension == "mkv"
+        || extension == "m4v" || extension == "webm" || extension == "mpg" || extension == "mpeg";
+}
+
+VideoOptions defaultVideoOptions() {
+    VideoOptions options;
+    options.stride = VIDEO_FRAME_STRIDE;
+    options.changeThreshold = VIDEO_CHANGE_THRESHOLD;
+    options.decodePolicy = fullDecodePolicy();
+    return options;
+}
+
+// h2 histogram of a small copy of the frame, nearest neighbour is enough for a color distribution
+static std::vector<float> changeProbe(const cv::Mat& frame) {
+    PROFILE_SCOPE("video.change_probe");
+    int largest = std::max(frame.cols, frame.rows);
+    if (largest <= VIDEO_PROBE_DIMENSION) {
+        return calculateRG_2DChromaHistogram(frame, BINS_2D);
+    }
+    double scale = static_cast<double>(VIDEO_PROBE_DIMENSION) / largest;
+    cv::Mat small;
+    cv::resize(frame, small, cv::Size(), scale, scale, cv::INTER_NEAREST);
+    return calculateRG_2DChromaHistogram(small, BINS_2D);
+}
+
+int extractVideoFeatures(const std::string& method, const std::string& videoPath, FILE* fp,
+                         const VideoOptions& options, FaceDetector& faceDetector, VideoStats& stats) {
+    PROFILE_SCOPE("video.extract");
+    stats = VideoStats{0, 0, 0, 0, 0};
+    cv::VideoCapture capture(videoPath);
+    if (!capture.isOpened()) {
+        std::cerr << "Error: cannot open the video " << videoPath << std::endl;
+        return -1;
+    }
+    std::string name = videoPath.substr(videoPath.find_last_of('/') + 1);
+    size_t stride = static_cast<size_t>(std::max(1, options.stride));
+
+    cv::Mat frame;
+    std::vector<float> lastProbe, probe;
+    ExtractScratch scratch;
+    for (size_t index = 0; capture.grab(); index++) {
+        stats.frames++;
+        // frames off the stride are only grabbed: the codec still decodes them (later frames depend on them),
+        // what is skipped is retrieve(), the conversion to BGR, and everything after it
+        if (index % stride != 0) continue;
+        stats.candidates++;
+        if (!capture.retrieve(frame) || frame.empty()) {
+            stats.failed++;
+            continue;
+        }
+        cv::Mat image = applyDecodePolicy(frame, options.decodePolicy);
+
+        if (options.changeThreshold > 0) {
+            probe = changeProbe(image);
+            // a black frame has no chromaticity and a NaN histogram, the comparison then counts it as changed
+            if (!lastProbe.empty() && 1.0f - computeHistogramIntersection(probe, lastProbe) <= options.changeThreshold) {
+                stats.unchanged++;
+                continue;
+            }
+        }
+
+        const std::vector<float>* feature;
+        try {
+            feature = &extractFeatureByMethod(method, image, &faceDetector, scratch);
+        } catch (const std::exception& e) {
+            std::cerr << "Could not extract " << name << "#" << index << ": " << e.what() << std::endl;
+            stats.failed++;
+            continue;
+        }
+        std::string key = name + "#" + std::to_string(index);
+        if (write_image_data_csv_row(fp, key.c_str(), *feature) != 0) {
+            std::cerr << "Error: cannot append to the csv file" << std::endl;
+            return -1;
+        }
+        stats.indexed++;
+        lastProbe.swap(probe);
+    }
+    PROFILE_COUNT("video.frames", stats.frames);
+    PROFILE_COUNT("video.frames_indexed", stats.indexed);
+    return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file vpTree.cpp
+ * @author Yuan Zhao (zhao.yuan2@northeatern.edu)
+ * @brief exact vantage-point tree index for the SSD methods
+ * @version 0.1
+ * @date 2024-02-25
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "matchings.h"
+#include "vpTree.h"
+#include "profiler.h"
+
+// bounds are loosened by this fraction of the distances involved, so float rounding of an SSD
+// cannot break the triangle inequality and prune a row that belongs
+#define VP_TREE_SLACK 1e-4f
+
+
+// the best first: smaller SSD, then lower row
+static bool closer(const std::pair<float, int>& a, const std::pair<float, int>& b) {
+    return a.first < b.first || (a.first == b.first && a.second < b.second);
+}
+
+// Keeps the k closest rows, the farthest kept one on top of the heap
+class VpTopK {
+public:
+    explicit VpTopK(size_t k) : k_(k) { heap_.reserve(k); }
+    float bound() const {
+        return heap_.size() < k_ ? std::numeric_limits<float>::infinity() : heap_.front().first;
+    }
+    void offer(float ssd, int row) {
+        std::pair<float, int> scored(ssd, row);
+        if (heap_.size() < k_) {
+            heap_.push_back(scored);
+            std::push_heap(heap_.begin(), heap_.end(), closer);
+        } else if (closer(scored, heap_.front())) {
+            std::pop_heap(heap_.begin(), heap_.end(), closer);
+            heap_.back() = scored;
+            std::push_heap(heap_.begin(), heap_.end(), closer);
+        }
+    }
+    std::vector<std::pair<float, int>>& rows() { return heap_; }
+
+private:
+    size_t k_;
+    std::vector<std::pair<float, int>> heap_;
+};
+
+// Keeps every row within the radius
+class VpRange {
+public:
+    explicit VpRange(float radius) : radius_(radius) {}
+    float bound() const { return radius_; }
+    void offer(float ssd, int row) {
+        if (ssd <= radius_) {
+            rows_.emplace_back(ssd, row);
+        }
+    }
+    std::vector<std::pair<float, int>>& rows() { return rows_; }
+
+private:
+    float radius_;
+    std::vector<std::pair<float, int>> rows_;
+};
+
+/*
+  Depth-first walk, the side of the vantage row the target falls on
+  first, so the K-th best distance shrinks before the other side is
+  tested. Collector is VpTopK or VpRange.
+ */
+template <class Collector>
+void VpTree::search(int index, const float* query, const FeatureMatrix& data, Collector& found, size_t& distances) const {
+    const Node& node = nodes_[index];
+    size_t cols = data.cols();
+    if (node.inside < 0) {
+        for (int i = node.begin; i < node.end; i++) {
+            found.offer(computeSSD(query, data.row(items_[i]), cols), items_[i]);
+        }
+        distances += node.end - node.begin;
+        return;
+    }
+
+    int vantage = items_[node.begin];
+    float ssd = computeSSD(query, data.row(vantage), cols);
+    distances++;
+    found.offer(ssd, vantage);
+    float dq = std::sqrt(ssd);
+
+    // rows inside are no closer than dq - mu, rows outside no closer than mu - dq
+    bool insideFirst = dq < node.mu;
+    for (int side = 0; side < 2; side++) {
+        bool inside = (side == 0) == insideFirst;
+        float tau = std::sqrt(found.bound());
+        float lower = inside ? dq - node.mu : node.mu - dq;
+        if (lower > tau + VP_TREE_SLACK * (dq + node.mu + tau) + 1e-6f) {
+            continue;
+        }
+        search(inside ? node.inside : node.outside, query, data, found, distances);
+    }
+}
+
+int VpTree::build(const FeatureMatrix& data) {
+    PROFILE_SCOPE("vptree.build");
+    items_.clear();
+    nodes_.clear();
+    if (data.empty()) {
+        return -1;
+    }
+    rows_ = data.rows();
+    cols_ = data.cols();
+    fingerprint_ = data.fingerprint();
+    items_.resize(rows_);
+    for (size_t r = 0; r < rows_; r++) {
+        items_[r] = static_cast<int>(r);
+    }
+
+    std::mt19937 rng(VP_TREE_SEED);
+    std::vector<std::pair<float, int>> scratch;
+    // nodes still to split, each one owns items_[begin, end)
+    std::vector<int> pending(1, 0);
+    nodes_.push_back(Node{0, static_cast<int>(rows_), -1, -1, 0.0f});
+    while (!pending.empty()) {
+        int index = pending.back();
+        pending.pop_back();
+        int begin = nodes_[index].begin;
+        int end = nodes_[index].end;
+        if (end - begin <= VP_TREE_LEAF) {
+            continue;
+        }
+
+        // a random vantage row, the others split at their median distance from it
+        std::uniform_int_distribution<int> pick(begin, end - 1);
+        std::swap(items_[begin], items_[pick(rng)]);
+        const float* vantage = data.row(items_[begin]);
+        scratch.clear();
+        for (int i = begin + 1; i < end; i++) {
+            scratch.emplace_back(std::sqrt(computeSSD(vantage, data.row(items_[i]), cols_)), items_[i]);
+        }
+        size_t median = scratch.size() / 2;
+        std::nth_element(scratch.begin(), scratch.begin() + median, scratch.end());
+        for (size_t i = 0; i < scratch.size(); i++) {
+            items_[begin + 1 + i] = scratch[i].second;
+        }
+        int mid = begin + 1 + static_cast<int>(median);
+
+        nodes_[index].mu = scratch[median].first;
+        nodes_[index].inside = static_cast<int>(nodes_.size());
+        nodes_.push_back(Node{begin + 1, mid, -1, -1, 0.0f});
+        nodes_[index].outside = static_cast<int>(nodes_.size());
+        nodes_.push_back(Node{mid, end, -1, -1, 0.0f});
+        pending.push_back(nodes_[index].inside);
+        pending.push_back(nodes_[index].outside);
+    }
+    return 0;
+}
+
+std::vector<std::pair<float, int>> VpTree::topRows(const std::vector<float>& target, const FeatureMatrix& data,
+                                                   size_t k, VpTreeStats* stats) const {
+    PROFILE_SCOPE("vptree.top_rows");
+    if (nodes_.empty() || data.rows() != rows_ || data.cols() != cols_) {
+        throw std::runtime_error("VP-tree was built from another feature matrix");
+    }
+    if (target.size() != data.cols()) {
+        throw std::runtime_error("Feature vectors must be of the same size");
+    }
+    std::vector<float> query = data.toColumnOrder(target);
+    VpTopK found(std::min(k, rows_));
+    size_t distances = 0;
+    if (k > 0) {
+        search(0, query.data(), data, found, distances);
+    }
+    PROFILE_COUNT("vptree.rows", rows_);
+    PROFILE_COUNT("vptree.distances", distances);
+    if (stats) {
+        stats->rows = rows_;
+        stats->distances = distances;
+    }
+    std::vector<std::pair<float, int>>& rows = found.rows();
+    std::sort(rows.begin(), rows.end(), closer);
+    return rows;
+}
+
+std::vector<std::pair<float, int>> VpTree::rangeRows(const std::vector<float>& target, const FeatureMatrix& data,
+                                                     float radius, VpTreeStats* stats) const {
+    PROFILE_SCOPE("vptree.range_rows");
+    if (nodes_.empty() || data.rows() != rows_ || data.cols() != cols_) {
+        throw std::runtime_error("VP-tree was built from another feature matrix");
+    }
+    if (target.size() != data.cols()) {
+        throw std::runtime_error("Feature vectors must be of the same size");
+    }
+    std::vector<float> query = data.toColumnOrder(target);
+    VpRange found(radius);
+    size_t distances = 0;
+    if (radius >= 0) {
+        search(0, query.data(), data, found, distances);
+    }
+    PROFILE_COUNT("vptree.rows", rows_);
+    PROFILE_COUNT("vptree.distances", distances);
+    if (stats) {
+        stats->rows = rows_;
+        stats->distances = distances;
+    }
+    std::vector<std::pair<float, int>>& rows = found.rows();
+    std::sort(rows.begin(), rows.end(), closer);
+    return rows;
+}
+
+size_t VpTree::bytes() const {
+    return items_.size() * sizeof(int) + nodes_.size() * sizeof(Node);
+}
+
+int VpTree::write(const std::string& path) const {
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return -1;
+    }
+    uint32_t header[3] = {
+        static_cast<uint32_t>(rows_), static_cast<uint32_t>(cols_), static_cast<uint32_t>(nodes_.size())
+    };
+    uint64_t print = fingerprint_;
+    fwrite(VP_TREE_MAGIC, 1, 8, fp);
+    fwrite(header, sizeof(uint32_t), 3, fp);
+    fwrite(&print, sizeof(uint64_t), 1, fp);
+    fwrite(items_.data(), sizeof(int32_t), items_.size(), fp);
+    for (const Node& node : nodes_) {
+        int32_t links[4] = {node.begin, node.end, node.inside, node.outside};
+        fwrite(links, sizeof(int32_t), 4, fp);
+        fwrite(&node.mu, sizeof(float), 1, fp);
+    }
+    int error = ferror(fp);
+    fclose(fp);
+    return error ? -1 : 0;
+}
+
+int VpTree::read(const std::string& path, const FeatureMatrix& data) {
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return -1;
+    }
+    char magic[8];
+    uint32_t header[3];
+    uint64_t print = 0;
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, VP_TREE_MAGIC, 8) != 0
+        || fread(header, sizeof(uint32_t), 3, fp) != 3 || fread(&print, sizeof(uint64_t), 1, fp) != 1
+        || header[0] != data.rows() || header[1] != data.cols() || print != data.fingerprint()) {
+        fclose(fp);
+        return -1;
+    }
+    // a split makes two nodes and leaves at least one row in each, so there are fewer nodes than 2 x rows
+    if (header[2] == 0 || header[2] >= 2ULL * header[0]) {
+        fclose(fp);
+        return -1;
+    }
+    std::vector<int> items(header[0]);
+    std::vector<Node> nodes(header[2]);
+    bool ok = fread(items.data(), sizeof(int32_t), items.size(), fp) == items.size();
+    for (size_t i = 0; ok && i < items.size(); i++) {
+        ok = items[i] >= 0 && static_cast<size_t>(items[i]) < items.size();
+    }
+    for (size_t i = 0; ok && i < nodes.size(); i++) {
+        int32_t links[4];
+        ok = fread(links, sizeof(int32_t), 4, fp) == 4 && fread(&nodes[i].mu, sizeof(float), 1, fp) == 1;
+        nodes[i].begin = links[0];
+        nodes[i].end = links[1];
+        nodes[i].inside = links[2];
+        nodes[i].outside = links[3];
+        // a damaged file must not send a query outside the items or the nodes, and build() numbers
+        // children after their parent, so children with higher indices also rule out cycles
+        ok = ok && links[0] >= 0 && links[0] <= links[1] && links[1] <= static_cast<int32_t>(items.size())
+            && (links[2] < 0) == (links[3] < 0) && links[2] < static_cast<int32_t>(nodes.size())
+            && links[3] < static_cast<int32_t>(nodes.size()) && (links[2] < 0 || links[0] < links[1])
+            && (links[2] < 0 || (links[2] > static_cast<int32_t>(i) && links[3] > static_cast<int32_t>(i)));
+    }
+    fclose(fp);
+    if (!ok || nodes.empty()) {
+        return -1;
+    }
+
+    rows_ = header[0];
+    cols_ = header[1];
+    fingerprint_ = print;
+    items_.swap(items);
+    nodes_.swap(nodes);
+    return 0;
+}